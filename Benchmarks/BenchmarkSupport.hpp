@@ -0,0 +1,73 @@
+//
+//  BenchmarkSupport.hpp
+//  HyperSpace Service Benchmarks
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "TestPackets.hpp"
+
+namespace hs::bench {
+    /**
+     * Command line shared by every benchmark. --quick runs a fraction of
+     * the work, for ctest to check the benchmark runs rather than to
+     * measure anything.
+     */
+    struct Options {
+        bool quick = false;
+
+        Options(int argc, char **argv) {
+            for (int i = 1; i < argc; ++i) {
+                if (strcmp(argv[i], "--quick") == 0) {
+                    quick = true;
+                } else {
+                    std::fprintf(stderr, "usage: %s [--quick]\n", argv[0]);
+                    std::exit(2);
+                }
+            }
+        }
+
+        // full, or a hundredth of it with --quick
+        size_t scaled(size_t full) const {
+            return quick ? (full / 100 > 0 ? full / 100 : 1) : full;
+        }
+    };
+
+    class Stopwatch final {
+    public:
+        Stopwatch() : started(std::chrono::steady_clock::now()) {}
+
+        double seconds() const {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point started;
+    };
+
+    inline void report(const char *name, size_t packets, double seconds) {
+        std::printf("%-44s %10zu packets %8.3f s %12.0f pps\n", name, packets, seconds,
+                    seconds > 0 ? static_cast<double>(packets) / seconds : 0.0);
+    }
+
+    // Fails the run, for a benchmark whose packets didn't all arrive
+    inline void require(bool condition, const char *what) {
+        if (!condition) {
+            std::fprintf(stderr, "benchmark failed: %s\n", what);
+            std::exit(1);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+//
+//  BusyPollBenchmark.cpp
+//  HyperSpace Service Benchmarks
+//
+
+// Write latency from a packet being queued to its write being issued, with the TUN thread blocking
+// between events and with adaptive busy polling. Packets are paced apart so the queue stays short and
+// the time measured is the TUN thread noticing them, at gaps inside and well past the spin budget
+
+#include "BenchmarkSupport.hpp"
+#include "TUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#include <sys/socket.h>
+#include <thread>
+
+using namespace hs;
+
+static void run(const char *mode, const BusyPollConfig &busyPoll, const char *pattern,
+                std::chrono::microseconds gap, size_t packets) {
+    auto device = FakeTunDevice::create(0);
+    const int peer = device->peerFD();
+
+    // Nothing is dropped, so the receiver below always gets every packet
+    WriteQueueConfig config;
+    config.policy = WriteQueuePolicy::Block;
+    TUNInterface tun(std::move(device), config);
+    tun.setBusyPoll(busyPoll);
+    tun.start();
+
+    // Blocks on the peer, so it takes no time from the TUN thread while there's nothing to read
+    size_t received = 0;
+    std::thread receiver([&] {
+        uint8_t packet[2048];
+        while (received < packets && recv(peer, packet, sizeof(packet), 0) > 0) {
+            received += 1;
+        }
+    });
+
+    const std::vector<uint8_t> packet = test::udpPacket(256);
+    bench::Stopwatch clock;
+    for (size_t i = 0; i < packets; ++i) {
+        tun.enqueueWrite(packet.data(), packet.size());
+        std::this_thread::sleep_for(gap);
+    }
+    receiver.join();
+    const double seconds = clock.seconds();
+
+    const WriteQueueStats stats = tun.writeQueueStats();
+    const BusyPollStats spins = tun.busyPollStats();
+    tun.stop();
+
+    bench::require(received == packets, "writes went missing");
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s, %s", mode, pattern);
+    bench::report(name, packets, seconds);
+    std::printf("    write latency p50 %8llu ns  p99 %8llu ns  wakeups %8llu  spins %8llu\n",
+                static_cast<unsigned long long>(stats.writeLatencyP50),
+                static_cast<unsigned long long>(stats.writeLatencyP99),
+                static_cast<unsigned long long>(stats.wakeups),
+                static_cast<unsigned long long>(spins.spins));
+}
+
+int main(int argc, char **argv) {
+    bench::Options options(argc, argv);
+
+    BusyPollConfig blocking;
+    BusyPollConfig adaptive;
+    adaptive.enabled = true;
+
+    std::printf("256 byte packets written through a fake device, %u cores\n", std::thread::hardware_concurrency());
+    for (const auto &[pattern, gap, packets] : {
+             std::tuple<const char *, std::chrono::microseconds, size_t>{ "10us apart", std::chrono::microseconds(10), 20000 },
+             std::tuple<const char *, std::chrono::microseconds, size_t>{ "500us apart", std::chrono::microseconds(500), 2000 } }) {
+        run("blocking", blocking, pattern, gap, options.scaled(packets));
+        run("adaptive busy poll", adaptive, pattern, gap, options.scaled(packets));
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+//
+//  ChecksumBenchmark.cpp
+//  HyperSpace Service Benchmarks
+//
+
+// Time per Internet checksum for the one word per iteration loop TUNInterface::computeIPChecksum
+// used to run and for hs::checksum, over packet sizes from a bare IPv4 header to 64KB,
+// starting one byte in so neither gets aligned data
+
+#include "BenchmarkSupport.hpp"
+#include "Checksum.hpp"
+
+using namespace hs;
+
+// The loop computeIPChecksum used to run
+static uint16_t oldChecksum(const uint8_t *data, size_t length) {
+    uint32_t sum = 0;
+    const uint16_t *words = reinterpret_cast<const uint16_t *>(data);
+
+    while (length > 1) {
+        sum += *words++;
+        length -= 2;
+    }
+
+    if (length == 1) {
+        sum += static_cast<uint16_t>(*reinterpret_cast<const uint8_t *>(words) << 8);
+    }
+
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return static_cast<uint16_t>(~sum);
+}
+
+static uint16_t newChecksum(const uint8_t *data, size_t length) {
+    return checksum::finish(checksum::add(data, length, 0));
+}
+
+template<typename Checksum>
+static double nanosPerSum(Checksum compute, std::vector<uint8_t> &buffer, size_t length, size_t rounds) {
+    volatile uint16_t sink = 0;
+    bench::Stopwatch clock;
+    for (size_t i = 0; i < rounds; ++i) {
+        // Changes the data each round so the sum can't be hoisted out of the loop
+        buffer[0] = static_cast<uint8_t>(i);
+        sink = sink + compute(buffer.data() + 1, length);
+    }
+    return clock.seconds() * 1e9 / static_cast<double>(rounds);
+}
+
+int main(int argc, char **argv) {
+    bench::Options options(argc, argv);
+    std::vector<uint8_t> buffer(65536 + 1);
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = static_cast<uint8_t>(i * 131 + 7);
+    }
+
+    std::printf("%8s %12s %12s %8s\n", "bytes", "old ns", "new ns", "speedup");
+    for (size_t length : {20, 64, 576, 1500, 9000, 65535}) {
+        // About the same number of bytes summed at every size
+        const size_t rounds = options.scaled(200000000 / (length + 50));
+        const double before = nanosPerSum(oldChecksum, buffer, length, rounds);
+        const double after = nanosPerSum(newChecksum, buffer, length, rounds);
+        std::printf("%8zu %12.1f %12.1f %7.1fx\n", length, before, after, after > 0 ? before / after : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+//
+//  EventLoopBenchmark.cpp
+//  HyperSpace Service Benchmarks
+//
+
+// The cost of each EventLoop backend per event, first bare, with one packet bounced between
+// two socket pairs so every dispatch reads one and writes the next, then under a TUNInterface
+// reading packets from a fake device one readiness event at a time
+
+#include "BenchmarkSupport.hpp"
+#include "EventLoop.hpp"
+#include "TUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#include <atomic>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace hs;
+
+static constexpr EventLoopBackend backends[] = { EventLoopBackend::LibEvent, EventLoopBackend::Native, EventLoopBackend::IoUring };
+
+struct PingPong {
+    EventLoop *loop = nullptr;
+    // Each event reads from its own pair's far end and writes to the other pair's near end
+    int near[2] = { -1, -1 };
+    int far[2] = { -1, -1 };
+    size_t remaining = 0;
+    size_t bounced = 0;
+
+    void bounce(int fd) {
+        const int side = fd == far[0] ? 0 : 1;
+        uint8_t packet[64];
+        if (recv(fd, packet, sizeof(packet), 0) != sizeof(packet)) {
+            return;
+        }
+        bounced += 1;
+        if (--remaining == 0) {
+            loop->stop();
+            return;
+        }
+        bench::require(send(near[1 - side], packet, sizeof(packet), 0) == sizeof(packet), "bounce send failed");
+    }
+
+    static void onReadable(int fd, void *context) {
+        static_cast<PingPong *>(context)->bounce(fd);
+    }
+};
+
+static void pingPong(EventLoopBackend backend, size_t events) {
+    std::unique_ptr<EventLoop> loop = EventLoop::create(backend);
+    if (!loop) {
+        return;
+    }
+
+    PingPong state;
+    state.loop = loop.get();
+    state.remaining = events;
+    for (int side = 0; side < 2; ++side) {
+        int pair[2];
+        bench::require(socketpair(AF_UNIX, SOCK_DGRAM, 0, pair) == 0, "socketpair failed");
+        fcntl(pair[1], F_SETFL, fcntl(pair[1], F_GETFL) | O_NONBLOCK);
+        state.near[side] = pair[0];
+        state.far[side] = pair[1];
+        bench::require(loop->add(pair[1], PingPong::onReadable, nullptr, &state), "add failed");
+    }
+
+    const std::vector<uint8_t> packet = test::udpPacket(64);
+    send(state.near[0], packet.data(), packet.size(), 0);
+
+    bench::Stopwatch clock;
+    loop->run();
+    const double seconds = clock.seconds();
+
+    bench::require(state.bounced == events, "bounces went missing");
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s, ping-pong", loop->name());
+    bench::report(name, events, seconds);
+
+    for (int side = 0; side < 2; ++side) {
+        loop->remove(state.far[side]);
+    }
+    loop.reset();
+    for (int side = 0; side < 2; ++side) {
+        close(state.near[side]);
+        close(state.far[side]);
+    }
+}
+
+static void tunReads(EventLoopBackend backend, const char *backendName, size_t packets) {
+    auto device = FakeTunDevice::create(0);
+    const int peer = device->peerFD();
+
+    TUNInterface tun(std::move(device));
+    tun.setEventLoopBackend(backend);
+    // One packet per readiness event, so the loop's own overhead isn't spread over a batch
+    tun.readBatchLimit = 1;
+
+    std::atomic<size_t> received = 0;
+    tun.setOutgoingPacketCallBack([&](PacketBatch &batch) {
+        received.fetch_add(batch.size(), std::memory_order_relaxed);
+    });
+    tun.start();
+
+    const std::vector<uint8_t> packet = test::udpPacket(256);
+    bench::Stopwatch clock;
+    std::thread sender([&] {
+        for (size_t i = 0; i < packets; ++i) {
+            while (send(peer, packet.data(), packet.size(), 0) < 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    sender.join();
+    while (received.load(std::memory_order_relaxed) < packets && clock.seconds() < 30) {
+        std::this_thread::yield();
+    }
+    const double seconds = clock.seconds();
+    tun.stop();
+
+    bench::require(received.load() == packets, "packets went missing");
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s, TUN reads", backendName);
+    bench::report(name, packets, seconds);
+}
+
+int main(int argc, char **argv) {
+    bench::Options options(argc, argv);
+    const size_t events = options.scaled(1000000);
+    const size_t packets = options.scaled(500000);
+
+    std::printf("Backends that can't be created here are left out, default is %s\n",
+                EventLoop::create(EventLoop::defaultBackend())->name());
+    for (EventLoopBackend backend : backends) {
+        pingPong(backend, events);
+    }
+    // The io_uring backend reads the TUN fd by completion rather than readiness, so it is left out here
+    tunReads(EventLoopBackend::LibEvent, "libevent", packets);
+    tunReads(EventLoopBackend::Native, "native", packets);
+    return 0;
+}
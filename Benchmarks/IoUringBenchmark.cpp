@@ -0,0 +1,110 @@
+//
+//  IoUringBenchmark.cpp
+//  HyperSpace Service Benchmarks
+//
+
+// Packets per second through a TUNInterface reading and writing its device by io_uring
+// completions, against the readiness loop calling read and write itself
+
+#include "BenchmarkSupport.hpp"
+#include "EventLoop.hpp"
+#include "TUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#include <atomic>
+#include <sys/socket.h>
+#include <thread>
+
+using namespace hs;
+
+static void reads(EventLoopBackend backend, const char *backendName, size_t packets) {
+    auto device = FakeTunDevice::create(0);
+    const int peer = device->peerFD();
+
+    TUNInterface tun(std::move(device));
+    tun.setEventLoopBackend(backend);
+
+    std::atomic<size_t> received = 0;
+    tun.setOutgoingPacketCallBack([&](PacketBatch &batch) {
+        received.fetch_add(batch.size(), std::memory_order_relaxed);
+    });
+    tun.start();
+
+    const std::vector<uint8_t> packet = test::udpPacket(256);
+    bench::Stopwatch clock;
+    std::thread sender([&] {
+        for (size_t i = 0; i < packets; ++i) {
+            while (send(peer, packet.data(), packet.size(), 0) < 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    sender.join();
+    while (received.load(std::memory_order_relaxed) < packets && clock.seconds() < 30) {
+        std::this_thread::yield();
+    }
+    const double seconds = clock.seconds();
+    tun.stop();
+
+    bench::require(received.load() == packets, "packets went missing");
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s, reads", backendName);
+    bench::report(name, packets, seconds);
+}
+
+static void writes(EventLoopBackend backend, const char *backendName, size_t packets) {
+    auto device = FakeTunDevice::create(0);
+    const int peer = device->peerFD();
+
+    // Blocking, so the injecting thread waits for room rather than losing packets
+    WriteQueueConfig config;
+    config.policy = WriteQueuePolicy::Block;
+    TUNInterface tun(std::move(device), config);
+    tun.setEventLoopBackend(backend);
+    tun.start();
+
+    const std::vector<uint8_t> packet = test::udpPacket(256);
+    bench::Stopwatch clock;
+
+    // Drains the peer end as fast as the TUN thread fills it
+    size_t written = 0;
+    std::thread receiver([&] {
+        uint8_t framed[2048];
+        while (written < packets && clock.seconds() < 30) {
+            if (recv(peer, framed, sizeof(framed), MSG_DONTWAIT) > 0) {
+                written += 1;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (size_t i = 0; i < packets; ++i) {
+        tun.enqueueWrite(packet.data(), packet.size());
+    }
+    receiver.join();
+    const double seconds = clock.seconds();
+    tun.stop();
+
+    bench::require(written == packets, "writes went missing");
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s, writes", backendName);
+    bench::report(name, packets, seconds);
+}
+
+int main(int argc, char **argv) {
+    bench::Options options(argc, argv);
+    const size_t packets = options.scaled(500000);
+
+    const bool ioUring = EventLoop::create(EventLoopBackend::IoUring) != nullptr;
+    std::printf("256 byte packets between a fake device's peer and a TUNInterface%s\n",
+                ioUring ? "" : ", io_uring unavailable here");
+    reads(EventLoopBackend::Native, "readiness", packets);
+    if (ioUring) {
+        reads(EventLoopBackend::IoUring, "io_uring", packets);
+    }
+    writes(EventLoopBackend::Native, "readiness", packets);
+    if (ioUring) {
+        writes(EventLoopBackend::IoUring, "io_uring", packets);
+    }
+    return 0;
+}
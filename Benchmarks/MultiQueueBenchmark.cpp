@@ -0,0 +1,78 @@
+//
+//  MultiQueueBenchmark.cpp
+//  HyperSpace Service Benchmarks
+//
+
+// Aggregate packets per second read through a MultiQueueTUNInterface as queues are added,
+// one per core up to the cores there are, each queue fed by its own sender on a fake device
+
+#include "BenchmarkSupport.hpp"
+#include "MultiQueueTUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <sys/socket.h>
+#include <thread>
+
+using namespace hs;
+
+static void run(size_t queueCount, size_t packetsPerQueue) {
+    std::vector<std::unique_ptr<TunDevice>> devices;
+    std::vector<int> peers;
+    for (size_t i = 0; i < queueCount; ++i) {
+        auto device = FakeTunDevice::create(0);
+        peers.push_back(device->peerFD());
+        devices.push_back(std::move(device));
+    }
+
+    MultiQueueTUNInterface tun(std::move(devices));
+    std::atomic<size_t> received = 0;
+    tun.setOutgoingPacketCallBack([&](PacketBatch &batch) {
+        received.fetch_add(batch.size(), std::memory_order_relaxed);
+    });
+    tun.start();
+
+    const size_t packets = queueCount * packetsPerQueue;
+    bench::Stopwatch clock;
+
+    std::vector<std::thread> senders;
+    for (size_t i = 0; i < queueCount; ++i) {
+        senders.emplace_back([&, i] {
+            const std::vector<uint8_t> packet = test::udpPacket(256, static_cast<uint16_t>(1000 + i));
+            for (size_t n = 0; n < packetsPerQueue; ++n) {
+                while (send(peers[i], packet.data(), packet.size(), 0) < 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (std::thread &sender : senders) {
+        sender.join();
+    }
+    while (received.load(std::memory_order_relaxed) < packets && clock.seconds() < 30) {
+        std::this_thread::yield();
+    }
+    const double seconds = clock.seconds();
+    tun.stop();
+
+    bench::require(received.load() == packets, "packets went missing");
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "%zu queue%s", queueCount, queueCount == 1 ? "" : "s");
+    bench::report(name, packets, seconds);
+}
+
+int main(int argc, char **argv) {
+    bench::Options options(argc, argv);
+    const size_t packetsPerQueue = options.scaled(300000);
+
+    // Always past one queue, so steering and the per-queue threads are exercised even on one core
+    const size_t cores = std::max<size_t>(std::thread::hardware_concurrency(), 2);
+
+    std::printf("256 byte packets read from every queue at once, %u cores\n", std::thread::hardware_concurrency());
+    for (size_t queues = 1; queues <= cores; queues *= 2) {
+        run(queues, packetsPerQueue);
+    }
+    return 0;
+}
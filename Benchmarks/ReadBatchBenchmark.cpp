@@ -0,0 +1,70 @@
+//
+//  ReadBatchBenchmark.cpp
+//  HyperSpace Service Benchmarks
+//
+
+// Packets per second read from the device and handed to the outgoing call back,
+// draining one packet per readiness event against a batch of up to 64
+
+#include "BenchmarkSupport.hpp"
+#include "TUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#include <atomic>
+#include <sys/socket.h>
+#include <thread>
+
+using namespace hs;
+
+static void run(EventLoopBackend backend, const char *backendName, size_t batchLimit, size_t packets) {
+    auto device = FakeTunDevice::create(0);
+    const int peer = device->peerFD();
+
+    TUNInterface tun(std::move(device));
+    tun.setEventLoopBackend(backend);
+    tun.readBatchLimit = batchLimit;
+
+    std::atomic<size_t> received = 0;
+    tun.setOutgoingPacketCallBack([&](PacketBatch &batch) {
+        received.fetch_add(batch.size(), std::memory_order_relaxed);
+    });
+    tun.start();
+
+    const std::vector<uint8_t> packet = test::udpPacket(256);
+    bench::Stopwatch clock;
+
+    // The peer end blocks once the device end's receive queue is full, so the sender keeps it full
+    std::thread sender([&] {
+        for (size_t i = 0; i < packets; ++i) {
+            while (send(peer, packet.data(), packet.size(), 0) < 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    sender.join();
+    while (received.load(std::memory_order_relaxed) < packets && clock.seconds() < 30) {
+        std::this_thread::yield();
+    }
+    const double seconds = clock.seconds();
+    tun.stop();
+
+    const ReadStats stats = tun.readStats();
+    bench::require(received.load() == packets, "packets went missing");
+
+    char name[96];
+    std::snprintf(name, sizeof(name), "%s, batch limit %zu (%.1f per event)", backendName, batchLimit,
+                  stats.readEvents > 0 ? static_cast<double>(stats.packetsRead) / static_cast<double>(stats.readEvents) : 0.0);
+    bench::report(name, packets, seconds);
+}
+
+int main(int argc, char **argv) {
+    bench::Options options(argc, argv);
+    const size_t packets = options.scaled(500000);
+
+    std::printf("256 byte packets from the fake device's peer to the outgoing call back\n");
+    for (size_t batchLimit : {1, 64}) {
+        run(EventLoopBackend::LibEvent, "libevent", batchLimit, packets);
+        run(EventLoopBackend::Native, "native", batchLimit, packets);
+    }
+    return 0;
+}
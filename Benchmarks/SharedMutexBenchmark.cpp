@@ -0,0 +1,72 @@
+//
+//  SharedMutexBenchmark.cpp
+//  HyperSpace Service Benchmarks
+//
+
+// Lock acquisitions per second through reader_biased_mutex and the shared_recursive_global_mutex
+// it replaced in LinkedBlockingDeque, at 1 to 16 threads, all reading and with one in ten writing
+
+#include "BenchmarkSupport.hpp"
+#include "ReaderBiasedMutex.hpp"
+#include "SharedRecursiveMutex.hpp"
+
+#include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+template<typename Mutex>
+static void run(const char *mutexName, size_t threadCount, size_t writeEvery, size_t locksPerThread) {
+    Mutex mutex;
+    // What the lock guards, read under the shared lock and bumped under the exclusive one
+    std::array<uint64_t, 8> guarded{};
+
+    hs::bench::Stopwatch clock;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&] {
+            uint64_t seen = 0;
+            for (size_t i = 1; i <= locksPerThread; ++i) {
+                if (writeEvery > 0 && i % writeEvery == 0) {
+                    std::unique_lock write_guard(mutex);
+                    for (uint64_t &value : guarded) {
+                        value += 1;
+                    }
+                } else {
+                    std::shared_lock read_guard(mutex);
+                    for (uint64_t value : guarded) {
+                        seen += value;
+                    }
+                }
+            }
+            // Keeps the reads from being optimized away
+            hs::bench::require(seen != UINT64_MAX, "impossible sum");
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    const double seconds = clock.seconds();
+
+    const size_t writes = writeEvery > 0 ? threadCount * (locksPerThread / writeEvery) : 0;
+    hs::bench::require(guarded[0] == writes, "writes went missing");
+
+    char name[96];
+    std::snprintf(name, sizeof(name), "%s, %zu thread%s", mutexName, threadCount, threadCount == 1 ? "" : "s");
+    hs::bench::report(name, threadCount * locksPerThread, seconds);
+}
+
+int main(int argc, char **argv) {
+    hs::bench::Options options(argc, argv);
+    const size_t locksPerThread = options.scaled(200000);
+
+    std::printf("Lock acquisitions counted as packets, %u cores\n", std::thread::hardware_concurrency());
+    for (size_t writeEvery : {0, 10}) {
+        std::printf(writeEvery == 0 ? "all reads\n" : "one lock in %zu exclusive\n", writeEvery);
+        for (size_t threads : {1, 2, 4, 8, 16}) {
+            run<mtx::shared_recursive_global_mutex>("shared_recursive_global_mutex", threads, writeEvery, locksPerThread);
+            run<mtx::reader_biased_mutex>("reader_biased_mutex", threads, writeEvery, locksPerThread);
+        }
+    }
+    return 0;
+}
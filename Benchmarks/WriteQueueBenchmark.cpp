@@ -0,0 +1,92 @@
+//
+//  WriteQueueBenchmark.cpp
+//  HyperSpace Service Benchmarks
+//
+
+// Packets per second from one injecting thread to one draining thread, through the
+// LinkedBlockingDeque the write queue used to be and the SPSCRingBuffer it is now
+
+#include "BenchmarkSupport.hpp"
+#include "LinkedBlockingDeque.hpp"
+#include "SPSCRingBuffer.hpp"
+
+#include <iterator>
+#include <thread>
+
+using namespace hs;
+
+static constexpr size_t capacity = 4096;
+static constexpr size_t packetSize = 64;
+
+static void deque(size_t packets) {
+    LinkedBlockingDeque<std::vector<uint8_t>> queue(capacity);
+    size_t bytes = 0;
+
+    bench::Stopwatch clock;
+    std::thread consumer([&] {
+        for (size_t i = 0; i < packets; ++i) {
+            bytes += queue.take()->size();
+        }
+    });
+    for (size_t i = 0; i < packets; ++i) {
+        queue.put(std::vector<uint8_t>(packetSize));
+    }
+    consumer.join();
+    const double seconds = clock.seconds();
+
+    bench::require(bytes == packets * packetSize, "deque lost packets");
+    bench::report("LinkedBlockingDeque put/take", packets, seconds);
+}
+
+static void ring(size_t packets, size_t batch) {
+    SPSCRingBuffer<std::vector<uint8_t>> queue(capacity);
+    size_t bytes = 0;
+
+    bench::Stopwatch clock;
+    std::thread consumer([&] {
+        std::vector<std::vector<uint8_t>> popped;
+        popped.reserve(batch);
+        size_t received = 0;
+        while (received < packets) {
+            popped.clear();
+            if (batch > 1) {
+                queue.pop_bulk(std::back_inserter(popped), batch);
+            } else if (std::optional<std::vector<uint8_t>> packet = queue.try_pop()) {
+                popped.push_back(std::move(*packet));
+            }
+            const size_t n = popped.size();
+            if (n == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (const std::vector<uint8_t> &packet : popped) {
+                bytes += packet.size();
+            }
+            received += n;
+        }
+    });
+    for (size_t i = 0; i < packets; ++i) {
+        std::vector<uint8_t> packet(packetSize);
+        while (!queue.try_push(std::move(packet))) {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    const double seconds = clock.seconds();
+
+    char name[64];
+    std::snprintf(name, sizeof(name), batch == 1 ? "SPSCRingBuffer try_push/try_pop" : "SPSCRingBuffer try_push/pop_bulk(%zu)", batch);
+    bench::require(bytes == packets * packetSize, "ring lost packets");
+    bench::report(name, packets, seconds);
+}
+
+int main(int argc, char **argv) {
+    bench::Options options(argc, argv);
+    const size_t packets = options.scaled(2000000);
+
+    std::printf("%zu byte packets, %zu slots, one producer and one consumer thread\n", packetSize, capacity);
+    deque(packets);
+    ring(packets, 1);
+    ring(packets, 64);
+    return 0;
+}
@@ -0,0 +1,57 @@
+//
+//  LatencyHistogram.cpp
+//  HyperSpaceTunnel
+//
+
+#include "LatencyHistogram.hpp"
+
+namespace hs {
+
+    void LatencyHistogram::addTo(Counts &total) const {
+        for (size_t i = 0; i < bucketCount; ++i) {
+            total[i] += counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t LatencyHistogram::percentile(const Counts &counts, double fraction) {
+        uint64_t recorded = 0;
+        for (uint64_t count : counts) {
+            recorded += count;
+        }
+        if (recorded == 0) {
+            return 0;
+        }
+
+        // The rank of the value wanted, counting from 1
+        uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(recorded) + 0.5);
+        rank = rank < 1 ? 1 : (rank > recorded ? recorded : rank);
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucketCount; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return upperBound(i);
+            }
+        }
+        return upperBound(bucketCount - 1);
+    }
+
+    uint64_t LatencyHistogram::percentile(double fraction) const {
+        Counts snapshot = {};
+        addTo(snapshot);
+        return percentile(snapshot, fraction);
+    }
+
+    uint64_t LatencyHistogram::upperBound(size_t index) {
+        if (index < subBuckets) {
+            return index;
+        }
+        const size_t shift = index / subBuckets - 1;
+        const uint64_t mantissa = subBuckets + index % subBuckets;
+        // The top bucket's bound doesn't fit, so it saturates
+        if (shift + 4 >= 64) {
+            return UINT64_MAX;
+        }
+        return ((mantissa + 1) << shift) - 1;
+    }
+}
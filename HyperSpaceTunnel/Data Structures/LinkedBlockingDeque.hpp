@@ -12,76 +12,93 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
 #include <optional>
+#include <utility>
 #include <atomic>
 #include <limits>
 #include <string>
 #include <iostream>
 
 #include "Semaphore.hpp"
-#include "SharedRecursiveMutex.hpp"
+#include "ReaderBiasedMutex.hpp"
 
 namespace hs {
     template<typename T>
     class Node__class;
 
     template<typename T>
-    using Node = std::shared_ptr<Node__class<T>>;
+    using Node = Node__class<T>*;
 
+    /**
+     * An intrusive deque node. The item is stored inline so that linking
+     * a node never allocates beyond the node itself.
+     */
     template<typename T>
     class Node__class final {
     public:
-        std::shared_ptr<std::optional<T>> item;
-        std::optional<Node<T>> next;
-
-        explicit Node__class() = default;
-
-        static Node<T> new_Node() {
-            return std::make_shared<Node__class>();
-        }
+        std::optional<T> item;
+        Node<T> next = nullptr;
+    };
 
-        explicit Node__class(std::optional<T> item) {
-            this->item = std::make_shared<std::optional<T>>(item);
-            this->next = std::nullopt;
-        }
+    /**
+     * A per-queue freelist of nodes carved out of fixed-size slabs.
+     *
+     * Slabs are only ever added, never returned to the heap, so once a
+     * queue has reached its working size put/take no longer allocate.
+     *
+     * NOTE: Not thread safe, callers must hold the owning queue's lock.
+     */
+    template<typename T>
+    class NodePool final {
+    private:
+        static constexpr size_t slabSize = 32;
 
-        static Node<T> new_Node(std::optional<T> item) {
-            return std::make_shared<Node__class>(item);
-        }
+        std::vector<std::unique_ptr<Node__class<T>[]>> slabs;
+        Node<T> freeList = nullptr;
 
-        explicit Node__class(std::optional<T> item, std::optional<Node<T>> next) {
-            this->item = std::make_shared<std::optional<T>>(item);
-            this->next = next;
-        }
+        void grow() {
+            slabs.push_back(std::make_unique<Node__class<T>[]>(slabSize));
+            Node__class<T> *slab = slabs.back().get();
 
-        static Node<T> new_Node(std::optional<T> item, std::optional<Node<T>> next) {
-            return std::make_shared<Node__class>(item, next);
+            for (size_t i = 0; i < slabSize; ++i) {
+                slab[i].next = freeList;
+                freeList = &slab[i];
+            }
         }
 
-        explicit Node__class(T item, std::optional<Node<T>> next) {
-            this->item = std::make_shared<std::optional<T>>(std::optional(item));
-            this->next = next;
-        }
+    public:
+        NodePool() = default;
+        NodePool(const NodePool&) = delete;
+        NodePool& operator=(const NodePool&) = delete;
+
+        template<typename... Args>
+        Node<T> acquire(Args&&... args) {
+            if (freeList == nullptr) {
+                grow();
+            }
 
-        static Node<T> new_Node(T item, std::optional<Node<T>> next) {
-            return std::make_shared<Node__class>(item, next);
-        }
+            Node<T> node = freeList;
+            freeList = node->next;
 
-        explicit Node__class(std::shared_ptr<std::optional<T>> item, std::optional<Node<T>> next) {
-            this->item = item;
-            this->next = next;
-        }
+            node->next = nullptr;
+            if constexpr (sizeof...(Args) > 0) {
+                node->item.emplace(std::forward<Args>(args)...);
+            }
 
-        static Node<T> new_Node(std::shared_ptr<std::optional<T>> item, std::optional<Node<T>> next) {
-            return std::make_shared<Node__class>(item, next);
+            return node;
         }
 
-        bool operator==(Node<T> rhs) {
-
-            return ((item == rhs.item) && (next == rhs.next));
+        void release(Node<T> node) {
+            node->item.reset();
+            node->next = freeList;
+            freeList = node;
         }
     };
 
@@ -92,12 +109,16 @@ namespace hs {
         Semaphore nFilled;
         Semaphore nHoles;
         
-        mutable mtx::shared_recursive_global_mutex mutex = mtx::shared_recursive_global_mutex();
+        mutable mtx::reader_biased_mutex mutex;
+
+        NodePool<T> pool;
+
+        // head is a dummy node, head->next is the first element
+        Node<T> head = nullptr;
+        Node<T> last = nullptr;
 
     public:
         int capacity = std::numeric_limits<int>::max();
-        std::optional<Node<T>> head;
-        std::optional<Node<T>> last;
         
         /**
          * Returns the number of elements in this queue
@@ -119,64 +140,71 @@ namespace hs {
             return capacity - _count;
         }
 
-        explicit LinkedBlockingDeque() {
-            this->capacity = std::numeric_limits<int>::max();
-
-            nFilled = Semaphore(0);
-            nHoles = Semaphore(capacity);
-
-            head = Node__class<T>::new_Node();
+        explicit LinkedBlockingDeque()
+            : nFilled(0)
+            , nHoles(std::numeric_limits<int>::max()) {
+            head = pool.acquire();
             last = head;
         }
 
-        explicit LinkedBlockingDeque(const int capacity) {
-            this->capacity = capacity;
-
-            nFilled = Semaphore(0);
-            nHoles = Semaphore(capacity);
-
-            head = Node__class<T>::new_Node();
+        explicit LinkedBlockingDeque(const int capacity)
+            : nFilled(0)
+            , nHoles(capacity)
+            , capacity(capacity) {
+            head = pool.acquire();
             last = head;
         }
 
-        explicit LinkedBlockingDeque(std::vector<T> &elements, const int capacity = std::numeric_limits<int>::max()) {
-            this->capacity = capacity;
-
-            nFilled = Semaphore(0);
-            nHoles = Semaphore(capacity);
-
-            head = Node__class<T>::new_Node();
+        explicit LinkedBlockingDeque(std::vector<T> &elements, const int capacity = std::numeric_limits<int>::max())
+            : nFilled(0)
+            , nHoles(capacity)
+            , capacity(capacity) {
+            head = pool.acquire();
             last = head;
 
-            int n = 0;
-
             for (const auto &e : elements) {
-                if (n >= capacity) {
+                if (_count >= capacity) {
                     // Throw here
+                    break;
                 }
-                enqueue(Node__class<T>::new_Node(e));
-                n += 1;
+                nHoles.wait();
+                enqueue(pool.acquire(e));
+                nFilled.signal();
             }
-
-            _count = n;
         }
 
+        LinkedBlockingDeque(const LinkedBlockingDeque&) = delete;
+        LinkedBlockingDeque& operator=(const LinkedBlockingDeque&) = delete;
+
         /**
          * Inserts the specific element at the tail of this queue,
          * waiting if necessary for space to become available.
          *
          * @param e The element to insert
          */
-        void put(T e) {
-            Node<T> node = Node__class<T>::new_Node(e);
+        void put(const T &e) {
+            emplace(e);
+        }
 
+        void put(T &&e) {
+            emplace(std::move(e));
+        }
+
+        /**
+         * Constructs an element in place at the tail of this queue,
+         * waiting if necessary for space to become available.
+         *
+         * @param args The arguments forwarded to T's constructor
+         */
+        template<typename... Args>
+        void emplace(Args&&... args) {
             nHoles.wait();
 
             {
                 // NOTE:- Java uses lockInterruptibly.
                 std::unique_lock write_guard(mutex); // Exclusive single writer access
 
-                enqueue(node);
+                enqueue(pool.acquire(std::forward<Args>(args)...));
             }
 
             nFilled.signal();
@@ -186,29 +214,79 @@ namespace hs {
             return size() == 0;
         }
         
-        void putFirst(T e) {
-            Node<T> node = Node__class<T>::new_Node(e);
+        /**
+         * Inserts the specific element at the head of this queue,
+         * waiting if necessary for space to become available.
+         *
+         * @param e The element to insert
+         */
+        void putFirst(const T &e) {
+            emplaceFirst(e);
+        }
+
+        void putFirst(T &&e) {
+            emplaceFirst(std::move(e));
+        }
 
+        template<typename... Args>
+        void emplaceFirst(Args&&... args) {
             nHoles.wait();
             
             {
                 // NOTE:- Java uses lockInterruptibly.
                 std::unique_lock write_guard(mutex); // Exclusive single writer access
-            
-                if (head.has_value()) {
-                    node->next = head.value();
-                }
 
-                head = node;
+                Node<T> node = pool.acquire(std::forward<Args>(args)...);
+                node->next = head->next;
+                head->next = node;
+
+                if (last == head) {
+                    last = node;
+                }
 
                 _count += 1;
             }
 
             nFilled.signal();
-            
         }
         
 
+        /**
+         * Inserts every element of the range at the tail of this queue,
+         * waiting if necessary for space to become available.
+         *
+         * Holes are reserved and the lock is taken once per batch rather
+         * than once per element. A batch is at most capacity elements.
+         *
+         * @param elements The elements to insert, moved from if the range is an rvalue
+         */
+        template<typename Range>
+        void putAll(Range &&elements) {
+            auto it = std::begin(elements);
+            const auto end = std::end(elements);
+
+            while (it != end) {
+                long n = std::min<long>(std::distance(it, end), capacity);
+
+                nHoles.wait(n);
+
+                {
+                    // NOTE:- Java uses lockInterruptibly.
+                    std::unique_lock write_guard(mutex); // Exclusive single writer access
+
+                    for (long i = 0; i < n; ++i, ++it) {
+                        if constexpr (std::is_rvalue_reference_v<Range&&>) {
+                            enqueue(pool.acquire(std::move(*it)));
+                        } else {
+                            enqueue(pool.acquire(*it));
+                        }
+                    }
+                }
+
+                nFilled.signal(n);
+            }
+        }
+
         /**
             A bool representing the empty status of the deque.
 
@@ -226,27 +304,32 @@ namespace hs {
 
             @returns True if element was inserted, false otherwise
          */
-        bool offer(T e){
-            bool offered = false;
+        bool offer(const T &e){
+            return tryEmplace(e);
+        }
+
+        bool offer(T &&e){
+            return tryEmplace(std::move(e));
+        }
+
+        template<typename... Args>
+        bool tryEmplace(Args&&... args){
+            if (!nHoles.try_wait()) {
+                return false;
+            }
 
             {
                 std::unique_lock write_guard(mutex); // Exclusive single writer access
 
-                if (remainingCapacity() > 0) {
-                    Node<T> node = Node__class<T>::new_Node(e);
-                    enqueue(node);
-                    offered = true;
-                }
+                enqueue(pool.acquire(std::forward<Args>(args)...));
             }
 
-            if (offered) {
-                nFilled.signal();
-            }
+            nFilled.signal();
 
-            return offered;
+            return true;
         }
 
-        bool contains(T e){
+        bool contains(const T &e){
             bool hasValue = false;
 
             forEach([&](const T &t) {
@@ -256,29 +339,38 @@ namespace hs {
             return hasValue;
         }
         
-        bool remove(T e) {
-            std::unique_lock write_guard(mutex); // Exclusive single writer access
-
-            std::optional<Node<T>> optionalCurrent = head;
-            std::optional<Node<T>> optionalPred = std::nullopt;
-
-            while (optionalCurrent.has_value()) {
-                auto current = optionalCurrent.value();
-                auto item = current->item;
-                
-                if (item != nullptr) {
-                    if (current->item->has_value()) {
-                        if (current->item->value() == e) {
-                            unlink(optionalCurrent, optionalPred);
-                            return true;
-                        }
+        bool remove(const T &e) {
+            // Reserve an element first so a concurrent take can't be left waiting on a removed one
+            if (!nFilled.try_wait()) {
+                return false;
+            }
+
+            bool removed = false;
+
+            {
+                std::unique_lock write_guard(mutex); // Exclusive single writer access
+
+                Node<T> pred = head;
+                Node<T> current = head->next;
+
+                while (current != nullptr) {
+                    if (current->item.has_value() && current->item.value() == e) {
+                        unlink(current, pred);
+                        removed = true;
+                        break;
                     }
+                    pred = current;
+                    current = current->next;
                 }
-                optionalPred = optionalCurrent;
-                optionalCurrent = current->next;
             }
-            
-            return false;
+
+            if (removed) {
+                nHoles.signal();
+            } else {
+                nFilled.signal();
+            }
+
+            return removed;
         }
 
         /**
@@ -288,19 +380,19 @@ namespace hs {
             Unlike take, this method will NOT block.
          */
         std::optional<T> poll() {
-            std::optional<T> x = std::nullopt;
+            if (!nFilled.try_wait()) {
+                return std::nullopt;
+            }
+
+            std::optional<T> x;
 
             {
                 std::unique_lock write_guard(mutex); // Exclusive single writer access
 
-                if (_count > 0) {
-                    x = dequeue();
-                }
+                x = dequeue();
             }
             
-            if (x.has_value()) {
-                nHoles.signal();
-            }
+            nHoles.signal();
 
             return x;
         }
@@ -308,6 +400,8 @@ namespace hs {
         /**
          * Attempts to take a node's item from the queue.
          *
+         * The item is moved out of its node, never copied.
+         *
          * @returns: An optional element
          */
         std::optional<T> take() {
@@ -327,85 +421,74 @@ namespace hs {
         }
 
         /**
-         * Removes every node from the queue.
+         * Moves up to maxElements items from the head of the queue into
+         * the output iterator.
          *
-         * NOTE: The puts and takes are locked during this time.
+         * Like poll, this method will NOT block. The lock is taken once
+         * for the whole batch.
+         *
+         * @returns: The number of items written to out
          */
-        void clear() {
-            std::unique_lock write_guard(mutex); // Exclusive single writer access
-
-            // Stupid workaround to capture reference
-            std::optional<Node<T>> t = std::nullopt;
-            std::optional<Node<T>> &p = t;
-            std::optional<Node<T>> &h = head;
-
-            while (h.has_value() && h.value()->next.has_value()) {
-                if (h.has_value()) {
-                    p = h.value()->next;
-                    h.value()->next = h;
-                } else {
-                    p = {};
-                }
-
-                if (p.has_value()) {
-                    p.value()->item = nullptr;
-                }
+        template<typename OutputIt>
+        int drainTo(OutputIt out, int maxElements = std::numeric_limits<int>::max()) {
+            long n = nFilled.try_wait_up_to(maxElements);
 
-                h = p;
+            if (n == 0) {
+                return 0;
             }
 
-            head = last;
+            {
+                std::unique_lock write_guard(mutex); // Exclusive single writer access
 
-            _count = 0;
+                for (long i = 0; i < n; ++i) {
+                    *out = std::move(dequeue().value());
+                    ++out;
+                }
+            }
+
+            nHoles.signal(n);
 
-            nHoles.reset();
+            return static_cast<int>(n);
         }
 
-        void unlink(std::optional<Node<T>> p, std::optional<Node<T>> pred) {
-            std::unique_lock write_guard(mutex); // Exclusive single writer access
+        /**
+         * Removes every node from the queue.
+         *
+         * Elements already claimed by a blocked take are left in place for it.
+         *
+         * NOTE: The puts and takes are locked during this time.
+         */
+        void clear() {
+            int n = static_cast<int>(nFilled.try_wait_up_to(std::numeric_limits<int>::max()));
 
-            if (p.has_value()) {
-                p.value()->item = {};
-            }
+            {
+                std::unique_lock write_guard(mutex); // Exclusive single writer access
 
-            if (pred.has_value()) {
-                if (p.has_value()) {
-                    pred.value()->next = p.value()->next;
-                } else {
-                    pred.value()->next = std::nullopt;
+                for (int i = 0; i < n; ++i) {
+                    dequeue();
                 }
             }
 
-            if (last == p) {
-                last = pred;
-            }
-
-            _count -= 1;
-
-            if (_count < capacity) {
-                signalNotFull();
-            }
+            nHoles.signal(n);
         }
 
     private:
 
         /**
-         * Signals a waiting take.
+         * Unlinks node p from its predecessor and returns it to the pool.
          *
-         * Called only from put/offer (which do not
-         * otherwise ordinarily lock takeLock.)
+         * NOTE: Callers must hold the exclusive lock.
          */
-        void signalNotEmpty() {
-            nHoles.signal();
-        }
+        void unlink(Node<T> p, Node<T> pred) {
+            pred->next = p->next;
 
-        /**
-         * Signals a waiting put.
-         *
-         * Called only from take/poll.
-         */
-        void signalNotFull() {
-            nFilled.signal();
+            if (last == p) {
+                last = pred;
+            }
+
+            pool.release(p);
+
+            _count -= 1;
         }
 
         /**
@@ -414,11 +497,7 @@ namespace hs {
          * @param node The node to be linked
          */
         void enqueue(Node<T> node) {
-
-            if (last.has_value()) {
-                last.value()->next = node;
-            }
-
+            last->next = node;
             last = node;
 
             _count += 1;
@@ -428,24 +507,24 @@ namespace hs {
         /**
          * Removes a node from the head of the queue.
          *
-         * @returns: A Node
+         * The first node becomes the new dummy head and the old
+         * head is returned to the pool.
+         *
+         * @returns: The first node's item
          */
         std::optional<T> dequeue() {
-            std::optional<Node<T>> h = head;
-            std::optional<Node<T>> first;
+            Node<T> h = head;
+            Node<T> first = h->next;
 
-            if (h.has_value()) {
-                first = h.value()->next;
+            if (first == nullptr) {
+                return std::nullopt;
             }
 
-            head = first;
+            std::optional<T> x = std::move(first->item);
+            first->item.reset();
 
-            std::optional<T> x;
-
-            if (first.has_value()) {
-                x = *(first.value()->item);
-                first.value()->item = nullptr;
-            }
+            head = first;
+            pool.release(h);
 
             _count -= 1;
 
@@ -457,18 +536,10 @@ namespace hs {
         void forEach(F fn){
             std::shared_lock read_guard(mutex); // Shared multi-reader access
 
-            auto optionalCurrent = head;
-            while (optionalCurrent.has_value()) {
-                auto current = optionalCurrent.value();
-                auto item = current->item;
-
-                if (item != nullptr) {
-                    if (current->item->has_value()) {
-                        fn(current->item->value());
-                    }
+            for (Node<T> current = head->next; current != nullptr; current = current->next) {
+                if (current->item.has_value()) {
+                    fn(current->item.value());
                 }
-
-                optionalCurrent = current->next;
             }
         }
 
@@ -476,20 +547,12 @@ namespace hs {
         std::optional<T> first(F fn){
             std::shared_lock read_guard(mutex); // Shared multi-reader access
 
-            auto optionalCurrent = head;
-            while (optionalCurrent.has_value()) {
-                auto current = optionalCurrent.value();
-                auto item = current->item;
-
-                if (item != nullptr) {
-                    if (current->item->has_value()) {
-                        if (fn(current->item->value())) {
-                            return current->item->value();
-                        }
+            for (Node<T> current = head->next; current != nullptr; current = current->next) {
+                if (current->item.has_value()) {
+                    if (fn(current->item.value())) {
+                        return current->item.value();
                     }
                 }
-
-                optionalCurrent = current->next;
             }
 
             return std::nullopt;
@@ -0,0 +1,6 @@
+//
+//  PacketBuf.cpp
+//  HyperSpaceTunnel
+//
+
+#include "PacketBuf.hpp"
@@ -0,0 +1,312 @@
+//
+//  PacketBuf.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include "PacketBufferPool.hpp"
+
+namespace hs {
+    /**
+     * A reference counted packet in a pooled buffer, modeled on the Linux
+     * sk_buff.
+     *
+     * The packet occupies [data(), tail()) of the buffer, with headroom in
+     * front of it and tailroom behind it, so adding or removing headers and
+     * trailers moves a pointer instead of reallocating:
+     *
+     *   push(n)  grows the packet into the headroom, for prepending a header
+     *   pull(n)  shrinks it from the front, for stripping a header
+     *   put(n)   grows it into the tailroom, for appending data
+     *   trim(n)  shrinks it from the back to n bytes
+     *
+     * A packet may also carry segmentation and checksum offload metadata,
+     * as a virtio-net header would describe it: a TCP or UDP super-packet
+     * still to be cut into gsoSize segments, and/or a transport checksum
+     * left partial, holding only the pseudo-header sum.
+     *
+     * Copying a PacketBuf shares the underlying bytes, and each copy has
+     * its own window onto them. Call unshare() before writing through a
+     * copy that may be shared. The bookkeeping lives at the end of the
+     * buffer itself, so a PacketBuf costs no allocation beyond the pool.
+     */
+    class PacketBuf final {
+    public:
+        enum class GSOType : uint8_t {
+            None,
+            TCPv4,
+            TCPv6,
+            UDP
+        };
+
+        struct Offload {
+            GSOType gsoType = GSOType::None;
+            // Payload bytes per segment
+            uint16_t gsoSize = 0;
+            bool checksumPartial = false;
+            // Where the checksummed range starts, from the start of the buffer so pushes and pulls leave it alone
+            uint16_t checksumStart = 0;
+            // Where the checksum field is, from checksumStart
+            uint16_t checksumOffset = 0;
+        };
+
+        // Enough in front of a fresh packet for the utun header and the external app's framing
+        static constexpr size_t defaultHeadroom = 64;
+
+        PacketBuf() = default;
+
+        /**
+         * A packet with room for size bytes after headroom bytes, from the
+         * smallest pool that fits it.
+         */
+        static PacketBuf allocate(size_t size, size_t headroom = defaultHeadroom) {
+            const size_t needed = headroom + size + sizeof(Shared);
+
+            if (needed <= PacketBufferPool::small().bufferSize()) {
+                return allocate(PacketBufferPool::small(), headroom);
+            }
+            if (needed <= PacketBufferPool::large().bufferSize()) {
+                return allocate(PacketBufferPool::large(), headroom);
+            }
+            throw std::length_error("Packet too large for any buffer pool");
+        }
+
+        /**
+         * An empty packet using all of a buffer from pool, headroom bytes in.
+         */
+        static PacketBuf allocate(PacketBufferPool &pool, size_t headroom) {
+            uint8_t *base = pool.acquire();
+            auto *shared = new (base + pool.bufferSize() - sizeof(Shared)) Shared(&pool);
+
+            PacketBuf buf(shared, base);
+            buf.reserve(headroom);
+            return buf;
+        }
+
+        static PacketBuf copyOf(const uint8_t *bytes, size_t length, size_t headroom = defaultHeadroom) {
+            PacketBuf buf = allocate(length, headroom);
+            memcpy(buf.put(length), bytes, length);
+            return buf;
+        }
+
+        PacketBuf(const PacketBuf &other)
+            : shared(other.shared)
+            , head(other.head)
+            , start(other.start)
+            , length(other.length)
+            , offloads(other.offloads) {
+            if (shared != nullptr) {
+                shared->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        PacketBuf(PacketBuf &&other) noexcept
+            : shared(std::exchange(other.shared, nullptr))
+            , head(std::exchange(other.head, nullptr))
+            , start(std::exchange(other.start, nullptr))
+            , length(std::exchange(other.length, 0))
+            , offloads(std::exchange(other.offloads, Offload())) {
+        }
+
+        PacketBuf& operator=(const PacketBuf &other) {
+            if (this != &other) {
+                PacketBuf copy(other);
+                *this = std::move(copy);
+            }
+            return *this;
+        }
+
+        PacketBuf& operator=(PacketBuf &&other) noexcept {
+            if (this != &other) {
+                reset();
+                shared = std::exchange(other.shared, nullptr);
+                head = std::exchange(other.head, nullptr);
+                start = std::exchange(other.start, nullptr);
+                length = std::exchange(other.length, 0);
+                offloads = std::exchange(other.offloads, Offload());
+            }
+            return *this;
+        }
+
+        ~PacketBuf() {
+            reset();
+        }
+
+        explicit operator bool() const {
+            return shared != nullptr;
+        }
+
+        uint8_t *data() const { return start; }
+        uint8_t *tail() const { return start + length; }
+        size_t size() const { return length; }
+        bool empty() const { return length == 0; }
+
+        size_t headroom() const { return static_cast<size_t>(start - head); }
+        size_t tailroom() const { return static_cast<size_t>(end() - tail()); }
+
+        /**
+         * Moves an empty packet n bytes further into the buffer.
+         */
+        void reserve(size_t n) {
+            if (length != 0 || n > tailroom()) {
+                throw std::out_of_range("PacketBuf::reserve");
+            }
+            start += n;
+        }
+
+        /**
+         * Grows the packet n bytes into the headroom, returning the new start.
+         */
+        uint8_t *push(size_t n) {
+            if (n > headroom()) {
+                throw std::out_of_range("PacketBuf::push");
+            }
+            start -= n;
+            length += n;
+            return start;
+        }
+
+        /**
+         * Strips n bytes from the front, returning the new start.
+         */
+        uint8_t *pull(size_t n) {
+            if (n > length) {
+                throw std::out_of_range("PacketBuf::pull");
+            }
+            start += n;
+            length -= n;
+            return start;
+        }
+
+        /**
+         * Grows the packet n bytes into the tailroom, returning where the
+         * new bytes go.
+         */
+        uint8_t *put(size_t n) {
+            if (n > tailroom()) {
+                throw std::out_of_range("PacketBuf::put");
+            }
+            uint8_t *added = tail();
+            length += n;
+            return added;
+        }
+
+        /**
+         * Shrinks the packet to its first n bytes, if it's longer.
+         */
+        void trim(size_t n) {
+            if (n < length) {
+                length = n;
+            }
+        }
+
+        const Offload &offload() const { return offloads; }
+
+        bool hasOffload() const {
+            return offloads.gsoType != GSOType::None || offloads.checksumPartial;
+        }
+
+        /**
+         * Marks the packet as a super-packet to be cut into segmentSize
+         * payload bytes per segment.
+         */
+        void setSegmentation(GSOType type, uint16_t segmentSize) {
+            offloads.gsoType = type;
+            offloads.gsoSize = segmentSize;
+        }
+
+        /**
+         * Marks the transport checksum as partial. The range summed starts
+         * start bytes into the packet and the field is offset bytes into it.
+         */
+        void setChecksumPartial(size_t start, size_t offset) {
+            offloads.checksumPartial = true;
+            offloads.checksumStart = static_cast<uint16_t>(headroom() + start);
+            offloads.checksumOffset = static_cast<uint16_t>(offset);
+        }
+
+        // Where the checksummed range starts, from data()
+        size_t checksumStart() const {
+            return offloads.checksumStart - headroom();
+        }
+
+        void clearOffload() {
+            offloads = Offload();
+        }
+
+        /**
+         * Whether another PacketBuf refers to the same bytes.
+         */
+        bool isShared() const {
+            return shared != nullptr && shared->refs.load(std::memory_order_acquire) > 1;
+        }
+
+        uint32_t useCount() const {
+            return shared != nullptr ? shared->refs.load(std::memory_order_relaxed) : 0;
+        }
+
+        /**
+         * Makes this the only reference to its bytes, copying them into a
+         * new buffer with the same headroom if they are shared.
+         */
+        void unshare() {
+            if (isShared()) {
+                Offload metadata = offloads;
+                *this = copyOf(start, length, headroom());
+                offloads = metadata;
+            }
+        }
+
+        void reset() {
+            if (shared != nullptr && shared->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                PacketBufferPool *pool = shared->pool;
+                shared->~Shared();
+                pool->recycle(head);
+            }
+            shared = nullptr;
+            head = nullptr;
+            start = nullptr;
+            length = 0;
+            offloads = Offload();
+        }
+
+    private:
+        struct alignas(16) Shared {
+            explicit Shared(PacketBufferPool *pool)
+                : pool(pool) {
+            }
+
+            std::atomic<uint32_t> refs = 1;
+            PacketBufferPool *pool;
+        };
+
+        PacketBuf(Shared *shared, uint8_t *head)
+            : shared(shared)
+            , head(head)
+            , start(head) {
+        }
+
+        // The usable part of the buffer ends where the bookkeeping starts
+        uint8_t *end() const { return reinterpret_cast<uint8_t *>(shared); }
+
+        Shared *shared = nullptr;
+        uint8_t *head = nullptr;
+        uint8_t *start = nullptr;
+        size_t length = 0;
+        Offload offloads;
+    };
+}
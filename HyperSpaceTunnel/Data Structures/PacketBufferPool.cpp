@@ -0,0 +1,6 @@
+//
+//  PacketBufferPool.cpp
+//  HyperSpaceTunnel
+//
+
+#include "PacketBufferPool.hpp"
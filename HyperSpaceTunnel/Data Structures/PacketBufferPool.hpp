@@ -0,0 +1,219 @@
+//
+//  PacketBufferPool.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+namespace hs {
+    /**
+     * A pool of fixed-size packet buffers carved out of large slabs.
+     *
+     * Each thread keeps a small cache of free buffers per pool, so
+     * acquiring and releasing in steady state touches neither malloc nor
+     * a lock. Caches refill from and spill to the shared freelist in
+     * batches of half their size.
+     *
+     * Slabs are never returned to the heap, and pools must outlive every
+     * thread that uses them, so use the process-wide instances.
+     */
+    class PacketBufferPool final {
+    public:
+        static constexpr size_t maxPools = 4;
+
+        /**
+         * The pool for buffers that fit any packet on a standard MTU link
+         * plus the 4-byte utun header.
+         */
+        static PacketBufferPool &small() {
+            static PacketBufferPool *pool = new PacketBufferPool(2048, 512, 64);
+            return *pool;
+        }
+
+        /**
+         * The pool for packets up to the 65535 byte IP maximum plus the
+         * 4-byte utun header. Fewer per slab and per thread, since each
+         * one is 32 times the size of a small buffer.
+         */
+        static PacketBufferPool &large() {
+            static PacketBufferPool *pool = new PacketBufferPool(64 * 1024 + 64, 16, 8);
+            return *pool;
+        }
+
+        PacketBufferPool(const PacketBufferPool&) = delete;
+        PacketBufferPool& operator=(const PacketBufferPool&) = delete;
+
+        size_t bufferSize() const {
+            return size;
+        }
+
+        // A slab's memory, which holds a run of buffers back to back
+        struct Region {
+            uint8_t *base;
+            size_t length;
+        };
+
+        /**
+         * Every slab allocated so far, for registering the memory with
+         * the kernel. Slabs are never freed, so a region stays valid for
+         * the life of the process.
+         */
+        std::vector<Region> slabRegions() {
+            std::lock_guard<std::mutex> guard(mutex);
+
+            std::vector<Region> regions;
+            regions.reserve(slabs.size());
+            for (const auto &slab : slabs) {
+                regions.push_back({slab.get(), size * slabBuffers});
+            }
+            return regions;
+        }
+
+        // Without the lock, so checking whether slabRegions() has grown is cheap
+        size_t slabCount() const {
+            return slabsAllocated.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Takes a buffer of bufferSize() bytes from the pool. Hand it back
+         * with recycle() when done.
+         */
+        uint8_t *acquire() {
+            ThreadCache &cache = threadCache();
+
+            if (cache.free.empty()) {
+                refill(cache);
+            }
+
+            uint8_t *base = cache.free.back();
+            cache.free.pop_back();
+
+            return base;
+        }
+
+        /**
+         * Returns a buffer previously taken with acquire(), from any thread.
+         */
+        void recycle(uint8_t *base) {
+            ThreadCache &cache = threadCache();
+
+            cache.free.push_back(base);
+
+            if (cache.free.size() >= threadCacheSize) {
+                spill(cache, threadCacheSize / 2);
+            }
+        }
+
+    private:
+        struct ThreadCache {
+            PacketBufferPool *pool = nullptr;
+            std::vector<uint8_t *> free;
+        };
+
+        // Spills every cache back to its pool when the thread exits
+        struct ThreadCaches {
+            std::array<ThreadCache, maxPools> caches;
+
+            ~ThreadCaches() {
+                for (ThreadCache &cache : caches) {
+                    if (cache.pool != nullptr) {
+                        cache.pool->spill(cache, cache.free.size());
+                    }
+                }
+            }
+        };
+
+        PacketBufferPool(size_t bufferSize, size_t buffersPerSlab, size_t threadCacheSize)
+            : size(bufferSize)
+            , slabBuffers(buffersPerSlab)
+            , threadCacheSize(threadCacheSize)
+            , id(nextId()) {
+        }
+
+        // Indexes each thread's caches, so there can be no more than maxPools
+        static size_t nextId() {
+            static std::atomic<size_t> ids = 0;
+            const size_t id = ids.fetch_add(1);
+            if (id >= maxPools) {
+                throw std::logic_error("More packet buffer pools than PacketBufferPool::maxPools");
+            }
+            return id;
+        }
+
+        ThreadCache &threadCache() {
+            thread_local ThreadCaches caches;
+
+            ThreadCache &cache = caches.caches[id];
+            if (cache.pool == nullptr) {
+                cache.pool = this;
+                cache.free.reserve(threadCacheSize);
+            }
+            return cache;
+        }
+
+        void refill(ThreadCache &cache) {
+            std::lock_guard<std::mutex> guard(mutex);
+
+            if (shared.size() < threadCacheSize / 2) {
+                grow();
+            }
+
+            for (size_t i = 0; i < threadCacheSize / 2 && !shared.empty(); ++i) {
+                cache.free.push_back(shared.back());
+                shared.pop_back();
+            }
+        }
+
+        void spill(ThreadCache &cache, size_t n) {
+            std::lock_guard<std::mutex> guard(mutex);
+
+            for (size_t i = 0; i < n && !cache.free.empty(); ++i) {
+                shared.push_back(cache.free.back());
+                cache.free.pop_back();
+            }
+        }
+
+        // NOTE: Callers must hold mutex
+        void grow() {
+            slabs.emplace_back(new (std::align_val_t(64)) uint8_t[size * slabBuffers]);
+            uint8_t *slab = slabs.back().get();
+            slabsAllocated.store(slabs.size(), std::memory_order_release);
+
+            shared.reserve(shared.size() + slabBuffers);
+            for (size_t i = 0; i < slabBuffers; ++i) {
+                shared.push_back(slab + i * size);
+            }
+        }
+
+        struct SlabDeleter {
+            void operator()(uint8_t *p) const {
+                ::operator delete[](p, std::align_val_t(64));
+            }
+        };
+
+        const size_t size;
+        const size_t slabBuffers;
+        const size_t threadCacheSize;
+        const size_t id;
+
+        std::mutex mutex;
+        std::vector<uint8_t *> shared;
+        std::vector<std::unique_ptr<uint8_t[], SlabDeleter>> slabs;
+        std::atomic<size_t> slabsAllocated = 0;
+    };
+}
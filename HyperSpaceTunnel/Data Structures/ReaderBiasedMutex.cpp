@@ -0,0 +1,6 @@
+//
+//  ReaderBiasedMutex.cpp
+//  HyperSpaceTunnel
+//
+
+#include "ReaderBiasedMutex.hpp"
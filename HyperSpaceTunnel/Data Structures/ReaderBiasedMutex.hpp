@@ -0,0 +1,181 @@
+//
+//  ReaderBiasedMutex.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <shared_mutex>
+#include <thread>
+
+namespace mtx {
+
+// A reader-biased shared mutex after BRAVO (Dice & Kogan, USENIX ATC '19).
+//
+// While reader bias is on, lock_shared() publishes the calling thread in
+// one of a fixed set of cache-line sized slots and never touches the
+// underlying lock, so readers on different cores don't share a line.
+// A writer first takes the underlying std::shared_mutex, turns the bias
+// off and waits for the slots to drain. Bias is turned back on by a slow
+// path reader once a back-off proportional to the last revocation cost
+// has elapsed, which keeps write-heavy phases from paying for revocation
+// on every lock(). Slow path readers hold off while a writer is waiting,
+// so a reader-preferring std::shared_mutex can't starve writers.
+//
+// Not recursive for writers. A thread may take the shared lock more than
+// once, as long as no writer on another thread is waiting in between.
+
+class reader_biased_mutex {
+public:
+
+    reader_biased_mutex() = default;
+
+    void lock() {
+        writersWaiting.fetch_add(1, std::memory_order_relaxed);
+        underlying.lock();
+        writersWaiting.fetch_sub(1, std::memory_order_relaxed);
+        revokeReaderBias();
+    }
+
+    bool try_lock() {
+        if (!underlying.try_lock()) {
+            return false;
+        }
+        revokeReaderBias();
+        return true;
+    }
+
+    void unlock() {
+        underlying.unlock();
+    }
+
+    void lock_shared() {
+        if (tryFastLockShared()) {
+            return;
+        }
+
+        // The underlying lock may prefer readers (glibc does), let waiting writers in first
+        while (writersWaiting.load(std::memory_order_relaxed) > 0) {
+            std::this_thread::yield();
+        }
+
+        underlying.lock_shared();
+        maybeRestoreReaderBias();
+    }
+
+    bool try_lock_shared() {
+        if (tryFastLockShared()) {
+            return true;
+        }
+
+        if (writersWaiting.load(std::memory_order_relaxed) > 0 || !underlying.try_lock_shared()) {
+            return false;
+        }
+        maybeRestoreReaderBias();
+        return true;
+    }
+
+    void unlock_shared() {
+        Slot &slot = slots[slotIndex()];
+
+        if (slot.owner.load(std::memory_order_relaxed) == threadToken()) {
+            slot.owner.store(nullptr, std::memory_order_release);
+            return;
+        }
+
+        underlying.unlock_shared();
+    }
+
+    reader_biased_mutex(const reader_biased_mutex&) = delete;
+    reader_biased_mutex& operator=(const reader_biased_mutex&) = delete;
+
+private:
+
+    static constexpr size_t slotCount = 64;
+    static constexpr int64_t inhibitMultiplier = 9;
+
+    struct alignas(64) Slot {
+        std::atomic<const void *> owner = nullptr;
+    };
+
+    // The address of a thread_local is unique for the lifetime of the thread
+    static const void *threadToken() {
+        thread_local char token;
+        return &token;
+    }
+
+    static size_t slotIndex() {
+        auto v = reinterpret_cast<uintptr_t>(threadToken());
+        return static_cast<size_t>((v >> 4) * 0x9E3779B97F4A7C15ull >> 58) & (slotCount - 1);
+    }
+
+    static int64_t nowNanos() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline bool tryFastLockShared() {
+        if (!readerBias.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        Slot &slot = slots[slotIndex()];
+        const void *expected = nullptr;
+
+        if (!slot.owner.compare_exchange_strong(expected, threadToken())) {
+            return false;
+        }
+
+        // Pairs with the writer clearing readerBias before it scans the slots
+        if (readerBias.load()) {
+            return true;
+        }
+
+        slot.owner.store(nullptr, std::memory_order_release);
+        return false;
+    }
+
+    inline void maybeRestoreReaderBias() {
+        // Safe while the underlying lock is held shared, no writer can be inside
+        if (!readerBias.load(std::memory_order_relaxed) &&
+            nowNanos() >= inhibitUntil.load(std::memory_order_relaxed)) {
+            readerBias.store(true);
+        }
+    }
+
+    inline void revokeReaderBias() {
+        if (!readerBias.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        readerBias.store(false);
+
+        const int64_t start = nowNanos();
+
+        for (Slot &slot : slots) {
+            while (slot.owner.load() != nullptr) {
+                std::this_thread::yield();
+            }
+        }
+
+        const int64_t now = nowNanos();
+        inhibitUntil.store(now + (now - start) * inhibitMultiplier, std::memory_order_relaxed);
+    }
+
+    std::array<Slot, slotCount> slots;
+    alignas(64) std::atomic<bool> readerBias = true;
+    std::atomic<int64_t> inhibitUntil = 0;
+    std::atomic<int32_t> writersWaiting = 0;
+    std::shared_mutex underlying;
+};
+
+}
@@ -0,0 +1,6 @@
+//
+//  SPSCRingBuffer.cpp
+//  HyperSpaceTunnel
+//
+
+#include "SPSCRingBuffer.hpp"
@@ -0,0 +1,177 @@
+//
+//  SPSCRingBuffer.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace hs {
+    /**
+     * A bounded, lock-free ring buffer for exactly one producer thread
+     * and exactly one consumer thread.
+     *
+     * The capacity is rounded up to a power of two so that slot indices
+     * can be derived with a mask. The producer and consumer indices live
+     * on separate cache lines, and each side keeps a private cached copy
+     * of the other side's index so the shared line is only re-read when
+     * the ring looks full (producer) or empty (consumer).
+     */
+    template<typename T>
+    class SPSCRingBuffer final {
+    public:
+        static constexpr size_t cacheLineSize = 64;
+
+        explicit SPSCRingBuffer(size_t capacity = 4096)
+            : mask(roundUpToPowerOfTwo(capacity) - 1)
+            , slots(std::make_unique<T[]>(mask + 1)) {
+        }
+
+        SPSCRingBuffer(const SPSCRingBuffer&) = delete;
+        SPSCRingBuffer& operator=(const SPSCRingBuffer&) = delete;
+
+        /**
+         * Returns the number of slots in the ring.
+         */
+        size_t capacity() const {
+            return mask + 1;
+        }
+
+        /**
+         * Returns an approximation of the number of queued elements.
+         *
+         * Exact when called from either the producer or the consumer
+         * while the other side is idle.
+         */
+        size_t size() const {
+            size_t t = tail.load(std::memory_order_acquire);
+            size_t h = head.load(std::memory_order_acquire);
+            return t - h;
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        /**
+         * Attempts to insert an element at the tail of the ring.
+         *
+         * Producer only. Never blocks.
+         *
+         * @returns true if the element was inserted, false if the ring is full
+         */
+        bool try_push(const T &e) {
+            return try_emplace(e);
+        }
+
+        bool try_push(T &&e) {
+            return try_emplace(std::move(e));
+        }
+
+        template<typename... Args>
+        bool try_emplace(Args&&... args) {
+            const size_t t = tail.load(std::memory_order_relaxed);
+
+            if (t - cachedHead > mask) {
+                cachedHead = head.load(std::memory_order_acquire);
+                if (t - cachedHead > mask) {
+                    return false;
+                }
+            }
+
+            slots[t & mask] = T(std::forward<Args>(args)...);
+            tail.store(t + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * Attempts to take the element at the head of the ring.
+         *
+         * Consumer only. Never blocks.
+         *
+         * @returns The element, or std::nullopt if the ring is empty
+         */
+        std::optional<T> try_pop() {
+            std::optional<T> x;
+
+            const size_t h = head.load(std::memory_order_relaxed);
+
+            if (h == cachedTail) {
+                cachedTail = tail.load(std::memory_order_acquire);
+                if (h == cachedTail) {
+                    return x;
+                }
+            }
+
+            x.emplace(std::move(slots[h & mask]));
+            head.store(h + 1, std::memory_order_release);
+
+            return x;
+        }
+
+        /**
+         * Moves up to maxElements elements from the head of the ring into
+         * the output iterator, publishing the new head index once.
+         *
+         * Consumer only. Never blocks.
+         *
+         * @returns The number of elements written to out
+         */
+        template<typename OutputIt>
+        size_t pop_bulk(OutputIt out, size_t maxElements) {
+            const size_t h = head.load(std::memory_order_relaxed);
+
+            if (cachedTail - h < maxElements) {
+                cachedTail = tail.load(std::memory_order_acquire);
+            }
+
+            size_t n = cachedTail - h;
+            if (n > maxElements) {
+                n = maxElements;
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                *out = std::move(slots[(h + i) & mask]);
+                ++out;
+            }
+
+            if (n > 0) {
+                head.store(h + n, std::memory_order_release);
+            }
+
+            return n;
+        }
+
+    private:
+        static size_t roundUpToPowerOfTwo(size_t n) {
+            size_t p = 2;
+            while (p < n) {
+                p <<= 1;
+            }
+            return p;
+        }
+
+        // Consumer owned
+        alignas(cacheLineSize) std::atomic<size_t> head = 0;
+        size_t cachedTail = 0;
+
+        // Producer owned
+        alignas(cacheLineSize) std::atomic<size_t> tail = 0;
+        size_t cachedHead = 0;
+
+        // Read-only after construction
+        alignas(cacheLineSize) const size_t mask;
+        std::unique_ptr<T[]> slots;
+    };
+}
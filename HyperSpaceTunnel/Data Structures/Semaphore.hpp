@@ -11,83 +11,304 @@
 
 #pragma once
 
-#include <vector>
-#include <list>
-#include <mutex>
-#include <shared_mutex>
-#include <optional>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <limits>
-#include <string>
-#include <iostream>
+#include <thread>
+
+#if defined(__APPLE__)
+#include <os/os_sync_wait_on_address.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <ctime>
 
 namespace hs {
+    namespace detail {
+        inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+            __asm__ __volatile__("yield");
+#else
+            std::this_thread::yield();
+#endif
+        }
+
+        /**
+         * Parks the calling thread while *word still holds expected.
+         *
+         * @param timeout Relative timeout, or a negative value to wait forever
+         * @returns false only if the timeout elapsed. Spurious wakeups return true.
+         */
+        inline bool parkWhileEqual(std::atomic<int32_t> *word,
+                                   int32_t expected,
+                                   std::chrono::nanoseconds timeout) {
+#if defined(__APPLE__)
+            int result;
+            if (timeout.count() < 0) {
+                result = os_sync_wait_on_address(word,
+                                                 static_cast<uint64_t>(static_cast<uint32_t>(expected)),
+                                                 sizeof(int32_t),
+                                                 OS_SYNC_WAIT_ON_ADDRESS_NONE);
+            } else {
+                result = os_sync_wait_on_address_with_timeout(word,
+                                                              static_cast<uint64_t>(static_cast<uint32_t>(expected)),
+                                                              sizeof(int32_t),
+                                                              OS_SYNC_WAIT_ON_ADDRESS_NONE,
+                                                              OS_CLOCK_MACH_ABSOLUTE_TIME,
+                                                              static_cast<uint64_t>(timeout.count()));
+            }
+            return !(result < 0 && errno == ETIMEDOUT);
+#elif defined(__linux__)
+            struct timespec ts;
+            struct timespec *tsp = nullptr;
+
+            if (timeout.count() >= 0) {
+                ts.tv_sec = static_cast<time_t>(timeout.count() / 1'000'000'000);
+                ts.tv_nsec = static_cast<long>(timeout.count() % 1'000'000'000);
+                tsp = &ts;
+            }
+
+            long result = syscall(SYS_futex, reinterpret_cast<int32_t *>(word), FUTEX_WAIT_PRIVATE, expected, tsp, nullptr, 0);
+            return !(result < 0 && errno == ETIMEDOUT);
+#else
+            if (timeout.count() < 0) {
+                word->wait(expected);
+                return true;
+            }
+            // No timed wait on an address here, poll instead and let the caller recheck its deadline
+            std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, std::chrono::microseconds(50)));
+            return true;
+#endif
+        }
+
+        /**
+         * Wakes threads parked on word, one if n == 1, otherwise all of them.
+         */
+        inline void wake(std::atomic<int32_t> *word, int32_t n) {
+#if defined(__APPLE__)
+            if (n == 1) {
+                os_sync_wake_by_address_any(word, sizeof(int32_t), OS_SYNC_WAKE_BY_ADDRESS_NONE);
+            } else {
+                os_sync_wake_by_address_all(word, sizeof(int32_t), OS_SYNC_WAKE_BY_ADDRESS_NONE);
+            }
+#elif defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<int32_t *>(word), FUTEX_WAKE_PRIVATE,
+                    n == 1 ? 1 : std::numeric_limits<int32_t>::max(), nullptr, nullptr, 0);
+#else
+            if (n == 1) {
+                word->notify_one();
+            } else {
+                word->notify_all();
+            }
+#endif
+        }
+    }
+
+    /**
+     * A counting semaphore whose uncontended paths are a single atomic
+     * operation.
+     *
+     * Waiters spin briefly and then park on the permit counter itself
+     * (futex on Linux, os_sync_wait_on_address on Darwin). Signalers only
+     * make a wake call when a waiter has announced itself, so neither
+     * side enters the kernel unless a thread actually has to sleep.
+     */
     class Semaphore {
     private:
-        pthread_mutex_t lock = pthread_mutex_t();
-        pthread_cond_t cv = pthread_cond_t();
+        static constexpr int spinLimit = 128;
+
+        std::atomic<int32_t> permits = 0;
+        std::atomic<int32_t> waiters = 0;
+        std::atomic<int32_t> bulkWaiters = 0;
+
+        static int32_t clamp(long val) {
+            if (val > std::numeric_limits<int32_t>::max()) {
+                return std::numeric_limits<int32_t>::max();
+            }
+            return val < 0 ? 0 : static_cast<int32_t>(val);
+        }
+
+        /**
+         * Attempts to take n permits, spinning briefly before parking.
+         *
+         * @param deadline The point after which to give up, or nullptr to wait forever
+         */
+        bool acquire(int32_t n, const std::chrono::steady_clock::time_point *deadline) {
+            for (int i = 0; i < spinLimit; ++i) {
+                if (tryAcquire(n)) {
+                    return true;
+                }
+                detail::cpuRelax();
+            }
+
+            waiters.fetch_add(1);
+            if (n > 1) {
+                bulkWaiters.fetch_add(1);
+            }
+
+            bool acquired = false;
+
+            while (true) {
+                int32_t current = permits.load();
+
+                if (current >= n) {
+                    if (permits.compare_exchange_weak(current, current - n)) {
+                        acquired = true;
+                        break;
+                    }
+                    continue;
+                }
+
+                std::chrono::nanoseconds timeout(-1);
+                if (deadline != nullptr) {
+                    timeout = *deadline - std::chrono::steady_clock::now();
+                    if (timeout.count() <= 0) {
+                        break;
+                    }
+                }
+
+                detail::parkWhileEqual(&permits, current, timeout);
+            }
+
+            if (n > 1) {
+                bulkWaiters.fetch_sub(1);
+            }
+            waiters.fetch_sub(1);
+
+            return acquired;
+        }
+
+        bool tryAcquire(int32_t n) {
+            int32_t current = permits.load(std::memory_order_relaxed);
+
+            while (current >= n) {
+                if (permits.compare_exchange_weak(current, current - n,
+                                                  std::memory_order_acquire,
+                                                  std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
     public:
-        long count = 0;
+        Semaphore() = default;
 
-        Semaphore() {
-            pthread_mutex_init(&lock, nullptr);
-            pthread_cond_init(&cv, nullptr);
+        explicit Semaphore(const long val)
+            : permits(clamp(val)) {
         }
 
-        explicit Semaphore(const long val) {
-            this->count = val;
-            pthread_mutex_init(&lock, nullptr);
-            pthread_cond_init(&cv, nullptr);
+        Semaphore(const Semaphore&) = delete;
+        Semaphore& operator=(const Semaphore&) = delete;
+
+        /**
+         * Returns the number of permits currently available.
+         */
+        long value() const {
+            return permits.load(std::memory_order_relaxed);
         }
 
         // Acquire & Wait
         void wait() {
-            pthread_mutex_lock(&lock);
-
-            while (count <= 0) {
-                pthread_cond_wait(&cv, &lock);
+            if (!tryAcquire(1)) {
+                acquire(1, nullptr);
             }
+        }
 
-            count--;
+        // Acquire n permits at once & Wait
+        void wait(long n) {
+            if (n <= 0) {
+                return;
+            }
+            if (!tryAcquire(clamp(n))) {
+                acquire(clamp(n), nullptr);
+            }
+        }
 
-            pthread_mutex_unlock(&lock);
+        // Acquire without waiting
+        bool try_wait() {
+            return tryAcquire(1);
         }
 
-        void waitNanos(long duration) {
-            pthread_mutex_lock(&lock);
+        // Acquire up to max permits without waiting, returns the number acquired
+        long try_wait_up_to(long max) {
+            const int32_t limit = clamp(max);
+            int32_t current = permits.load(std::memory_order_relaxed);
 
-            struct timespec timeToWait;
+            while (current > 0) {
+                int32_t n = current < limit ? current : limit;
+                if (permits.compare_exchange_weak(current, current - n,
+                                                  std::memory_order_acquire,
+                                                  std::memory_order_relaxed)) {
+                    return n;
+                }
+            }
 
-            clock_gettime(CLOCK_REALTIME, &timeToWait);
+            return 0;
+        }
 
-            timeToWait.tv_sec += duration / (long) 1'000'000'000;
+        /**
+         * Acquires a permit, waiting until the steady clock reaches deadline.
+         *
+         * @returns true if a permit was acquired, false on timeout
+         */
+        template<typename Duration>
+        bool wait_until(const std::chrono::time_point<std::chrono::steady_clock, Duration> &deadline) {
+            if (tryAcquire(1)) {
+                return true;
+            }
+            const std::chrono::steady_clock::time_point d = std::chrono::time_point_cast<std::chrono::steady_clock::duration>(deadline);
+            return acquire(1, &d);
+        }
 
-            pthread_cond_timedwait(&cv, &lock, &timeToWait);
+        /**
+         * Acquires a permit, waiting at most duration.
+         *
+         * @returns true if a permit was acquired, false on timeout
+         */
+        template<typename Rep, typename Period>
+        bool wait_for(const std::chrono::duration<Rep, Period> &duration) {
+            return wait_until(std::chrono::steady_clock::now() + duration);
+        }
 
-            pthread_mutex_unlock(&lock);
+        bool waitNanos(long duration) {
+            return wait_for(std::chrono::nanoseconds(duration));
         }
 
         // Acquire & Signal
         void signal() {
-            pthread_mutex_lock(&lock);
-            count += 1;
+            signal(1);
+        }
 
-            if (count >= 1) {
-                pthread_cond_signal(&cv);
+        // Release n permits at once
+        void signal(long n) {
+            if (n <= 0) {
+                return;
             }
-            pthread_mutex_unlock(&lock);
-        }
 
-        void reset() {
-            pthread_mutex_lock(&lock);
+            permits.fetch_add(clamp(n));
 
-            if (count >= 1) {
-                pthread_cond_signal(&cv);
+            if (waiters.load() > 0) {
+                // A bulk waiter might not be satisfied by n, so let everyone recheck
+                detail::wake(&permits, bulkWaiters.load() > 0 ? std::numeric_limits<int32_t>::max() : clamp(n));
             }
+        }
 
-            pthread_mutex_unlock(&lock);
+        // Wakes every parked waiter so it can recheck the permit count
+        void reset() {
+            if (waiters.load() > 0) {
+                detail::wake(&permits, std::numeric_limits<int32_t>::max());
+            }
         }
     };
 }
 
-
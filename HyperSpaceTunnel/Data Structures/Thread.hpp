@@ -72,7 +72,9 @@ public:
         if (m_running == 1 && m_detached == 0) {
             pthread_detach(m_tid);
         }
-        if (m_running == 1) {
+        // A thread deleting itself at the end of run() has nothing left to cancel, and
+        // cancelling itself would unwind through run()'s catch (...), which glibc aborts on
+        if (m_running == 1 && !pthread_equal(m_tid, pthread_self())) {
             pthread_cancel(m_tid);
         }
     }
@@ -146,7 +148,12 @@ public:
 static void *runThread(void *arg) {
     try {
         pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+#if defined(__APPLE__)
         pthread_setname_np(&((Thread *)arg)->threadName[0]);
+#else
+        // Linux caps thread names at 15 characters and rejects longer ones outright
+        pthread_setname_np(pthread_self(), ((Thread *)arg)->threadName.substr(0, 15).c_str());
+#endif
         ((Thread *)arg)->run();
     } catch (std::exception& e) {
     } catch (...) {
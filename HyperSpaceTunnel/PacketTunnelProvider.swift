@@ -57,6 +57,8 @@ final class PacketTunnelProvider: NEPacketTunnelProvider,
         }
         let b = TUNInterfaceBridge(tunFD: tunFD)
         b.delegate = self
+        // Watermarks at a quarter and three quarters of the default 4096 packet write queue
+        b.pauseIngress(atHighWatermark: 3072, lowWatermark: 1024)
         b.start()
         self.bridge = b
 
@@ -251,6 +253,14 @@ final class PacketTunnelProvider: NEPacketTunnelProvider,
         dataServer?.sendPacketsToExternalApp([UInt8](packet))
     }
 
+    func bridgeShouldPauseIngress() {
+        dataServer?.pauseIngress()
+    }
+
+    func bridgeShouldResumeIngress() {
+        dataServer?.resumeIngress()
+    }
+
     private func encJSON(_ obj: [String: Any]) -> Data? {
         try? JSONSerialization.data(withJSONObject: obj)
     }
@@ -0,0 +1,173 @@
+//
+//  Checksum.cpp
+//  HyperSpaceTunnel
+//
+
+#include "Checksum.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace hs::checksum {
+
+    // The loops below sum native order words. Swapping the bytes of every word swaps the bytes of
+    // their ones' complement sum (RFC 1071 2.B), so only the folded result needs turning big-endian
+
+    // A 32-bit lane takes at most two 16-bit words per vector, so it can't overflow in this many
+    static constexpr size_t vectorsPerChunk = 32767;
+
+#if defined(__SSE2__)
+    // Sums the whole 16 byte vectors at the start of data, and moves data past them
+    static uint64_t addSSE2(const uint8_t *&data, size_t &length) {
+        const __m128i lowWords = _mm_set1_epi32(0xFFFF);
+        uint64_t total = 0;
+
+        while (length >= 16) {
+            const size_t vectors = std::min(length / 16, vectorsPerChunk);
+            __m128i acc = _mm_setzero_si128();
+            for (size_t i = 0; i < vectors; ++i) {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+                acc = _mm_add_epi32(acc, _mm_and_si128(v, lowWords));
+                acc = _mm_add_epi32(acc, _mm_srli_epi32(v, 16));
+                data += 16;
+            }
+            length -= vectors * 16;
+
+            uint32_t lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+            total += static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+        }
+        return total;
+    }
+#endif
+
+#if defined(__x86_64__)
+    // As addSSE2, 32 bytes at a time
+    __attribute__((target("avx2")))
+    static uint64_t addAVX2(const uint8_t *&data, size_t &length) {
+        const __m256i lowWords = _mm256_set1_epi32(0xFFFF);
+        uint64_t total = 0;
+
+        while (length >= 32) {
+            const size_t vectors = std::min(length / 32, vectorsPerChunk);
+            __m256i acc = _mm256_setzero_si256();
+            for (size_t i = 0; i < vectors; ++i) {
+                const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+                acc = _mm256_add_epi32(acc, _mm256_and_si256(v, lowWords));
+                acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+                data += 32;
+            }
+            length -= vectors * 32;
+
+            uint32_t lanes[8];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+            for (uint32_t lane : lanes) {
+                total += lane;
+            }
+        }
+        return total;
+    }
+
+    static bool hasAVX2() {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+#endif
+
+#if defined(__aarch64__)
+    // Sums the whole 16 byte vectors at the start of data, and moves data past them
+    static uint64_t addNEON(const uint8_t *&data, size_t &length) {
+        uint64_t total = 0;
+
+        while (length >= 16) {
+            const size_t vectors = std::min(length / 16, vectorsPerChunk);
+            uint32x4_t acc = vdupq_n_u32(0);
+            for (size_t i = 0; i < vectors; ++i) {
+                // Adds each pair of neighbouring words into a 32-bit lane
+                acc = vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(data)));
+                data += 16;
+            }
+            length -= vectors * 16;
+            total += vaddlvq_u32(acc);
+        }
+        return total;
+    }
+#endif
+
+    // Whatever's left, or all of it with no vector unit to hand
+    static uint64_t addScalar(const uint8_t *data, size_t length, uint64_t acc) {
+        while (length >= 8) {
+            uint64_t v;
+            memcpy(&v, data, sizeof(v));
+            // Both halves are two words, and 2^16 is 1 in ones' complement, so they sum as they are
+            acc += (v & 0xFFFFFFFF) + (v >> 32);
+            data += 8;
+            length -= 8;
+        }
+
+        while (length >= 2) {
+            uint16_t word;
+            memcpy(&word, data, sizeof(word));
+            acc += word;
+            data += 2;
+            length -= 2;
+        }
+
+        if (length == 1) {
+            // Padded with a zero byte after it
+            const uint8_t last[2] = {data[0], 0};
+            uint16_t word;
+            memcpy(&word, last, sizeof(word));
+            acc += word;
+        }
+        return acc;
+    }
+
+    uint32_t add(const uint8_t *data, size_t length, uint32_t sum) {
+        uint64_t acc = 0;
+
+#if defined(__x86_64__)
+        acc = hasAVX2() ? addAVX2(data, length) : addSSE2(data, length);
+#elif defined(__SSE2__)
+        acc = addSSE2(data, length);
+#elif defined(__aarch64__)
+        acc = addNEON(data, length);
+#endif
+        acc = addScalar(data, length, acc);
+
+        const uint64_t total = static_cast<uint64_t>(sum) + ntohs(fold(acc));
+        return static_cast<uint32_t>((total & 0xFFFFFFFF) + (total >> 32));
+    }
+
+    uint16_t fold(uint64_t sum) {
+        while (sum >> 16) {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        return static_cast<uint16_t>(sum);
+    }
+
+    // RFC 1624 eqn. 3, HC' = ~(~HC + ~m + m'), which can't turn a checksum into -0
+
+    uint16_t update16(uint16_t checksum, uint16_t oldValue, uint16_t newValue) {
+        return finish(static_cast<uint64_t>(static_cast<uint16_t>(~checksum)) +
+                      static_cast<uint16_t>(~oldValue) + newValue);
+    }
+
+    uint16_t update32(uint16_t checksum, uint32_t oldValue, uint32_t newValue) {
+        return finish(static_cast<uint64_t>(static_cast<uint16_t>(~checksum)) +
+                      static_cast<uint16_t>(~(oldValue >> 16)) + static_cast<uint16_t>(~oldValue) +
+                      (newValue >> 16) + (newValue & 0xFFFF));
+    }
+
+    uint16_t update(uint16_t checksum, const uint8_t *oldBytes, const uint8_t *newBytes, size_t length) {
+        return finish(static_cast<uint64_t>(static_cast<uint16_t>(~checksum)) +
+                      static_cast<uint16_t>(~fold(add(oldBytes, length, 0))) + add(newBytes, length, 0));
+    }
+}
@@ -0,0 +1,48 @@
+//
+//  Checksum.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Internet checksum arithmetic (RFC 1071). Sums are of the data as
+ * big-endian 16-bit words, the way they're written into headers, and
+ * stay partial until finish() turns one into a checksum field.
+ */
+namespace hs::checksum {
+    /**
+     * Adds data to sum, as if it continued from an even offset. Any
+     * alignment is fine. Uses AVX2 or SSE2 on x86 and NEON on arm64,
+     * and 64 bits at a time elsewhere.
+     */
+    uint32_t add(const uint8_t *data, size_t length, uint32_t sum);
+
+    // Folds a sum of partial sums down to 16 bits
+    uint16_t fold(uint64_t sum);
+
+    // The checksum field for sum
+    inline uint16_t finish(uint64_t sum) {
+        return static_cast<uint16_t>(~fold(sum));
+    }
+
+    /**
+     * Incremental updates (RFC 1624): the checksum field once a 16 or
+     * 32-bit field it covers, such as the TTL and protocol word, a port
+     * or an IPv4 address, has changed from oldValue to newValue, without
+     * summing the rest again. A checksum that was wrong stays wrong.
+     */
+    uint16_t update16(uint16_t checksum, uint16_t oldValue, uint16_t newValue);
+    uint16_t update32(uint16_t checksum, uint32_t oldValue, uint32_t newValue);
+
+    // As above, for a field of length bytes at an even offset, such as an IPv6 address
+    uint16_t update(uint16_t checksum, const uint8_t *oldBytes, const uint8_t *newBytes, size_t length);
+}
@@ -0,0 +1,263 @@
+//
+//  CoDel.cpp
+//  HyperSpaceTunnel
+//
+
+#include "CoDel.hpp"
+
+#include <cmath>
+#include <random>
+
+namespace hs {
+
+    CoDelQueue::CoDelQueue(uint64_t targetNanos,
+                           uint64_t intervalNanos,
+                           size_t maxPacketBytes)
+        : target(targetNanos)
+        , interval(intervalNanos)
+        , maxPacket(maxPacketBytes) {
+    }
+
+    void CoDelQueue::enqueue(QueuedPacket &&packet) {
+        backlogBytes += packet.buf.size();
+        queue.push_back(std::move(packet));
+    }
+
+    std::optional<QueuedPacket> CoDelQueue::dropHead() {
+        if (queue.empty()) {
+            return std::nullopt;
+        }
+
+        QueuedPacket packet = std::move(queue.front());
+        queue.pop_front();
+        backlogBytes -= packet.buf.size();
+
+        return packet;
+    }
+
+    uint64_t CoDelQueue::controlLaw(uint64_t t, uint32_t count) const {
+        return t + static_cast<uint64_t>(static_cast<double>(interval) / std::sqrt(static_cast<double>(count)));
+    }
+
+    CoDelQueue::DoDequeueResult CoDelQueue::doDequeue(uint64_t now) {
+        DoDequeueResult result;
+        result.packet = dropHead();
+
+        if (!result.packet.has_value()) {
+            firstAboveTime = 0;
+            return result;
+        }
+
+        const uint64_t sojourn = now > result.packet->enqueuedAt ? now - result.packet->enqueuedAt : 0;
+
+        if (sojourn < target || backlogBytes <= maxPacket) {
+            // Went below target, or there's less than one MTU queued so dropping can't help
+            firstAboveTime = 0;
+        } else if (firstAboveTime == 0) {
+            // Just went above target, give it one interval to drain before dropping
+            firstAboveTime = now + interval;
+        } else if (now >= firstAboveTime) {
+            result.okToDrop = true;
+        }
+
+        return result;
+    }
+
+    std::optional<QueuedPacket> CoDelQueue::dequeue(uint64_t now, const DropCallBack &onDrop) {
+        DoDequeueResult r = doDequeue(now);
+
+        if (!r.packet.has_value()) {
+            dropping = false;
+            return std::nullopt;
+        }
+
+        if (dropping) {
+            if (!r.okToDrop) {
+                // Sojourn time fell below target, leave the dropping state
+                dropping = false;
+            }
+
+            // Drop as many packets as the control law schedules for now
+            while (dropping && now >= dropNext) {
+                onDrop(*r.packet);
+                count += 1;
+
+                r = doDequeue(now);
+
+                if (!r.packet.has_value() || !r.okToDrop) {
+                    dropping = false;
+                } else {
+                    dropNext = controlLaw(dropNext, count);
+                }
+            }
+        } else if (r.okToDrop) {
+            onDrop(*r.packet);
+            r = doDequeue(now);
+            dropping = true;
+
+            // Resume near the last drop rate if we left the dropping state only recently
+            const uint32_t delta = count - lastCount;
+            if (delta > 1 && static_cast<int64_t>(now - dropNext) < static_cast<int64_t>(16 * interval)) {
+                count = delta;
+            } else {
+                count = 1;
+            }
+
+            dropNext = controlLaw(now, count);
+            lastCount = count;
+        }
+
+        return std::move(r.packet);
+    }
+
+    FQCoDelScheduler::FQCoDelScheduler(size_t flowCount,
+                                       size_t quantum,
+                                       uint64_t targetNanos,
+                                       uint64_t intervalNanos,
+                                       CoDelQueue::DropCallBack onDrop)
+        : quantum(quantum)
+        , perturbation(std::random_device()())
+        , onDrop(std::move(onDrop)) {
+        if (flowCount == 0) {
+            flowCount = 1;
+        }
+
+        flows.reserve(flowCount);
+        for (size_t i = 0; i < flowCount; ++i) {
+            flows.push_back(Flow { CoDelQueue(targetNanos, intervalNanos, quantum) });
+        }
+    }
+
+    void FQCoDelScheduler::enqueue(QueuedPacket &&packet) {
+        uint32_t index = 0;
+
+        if (flows.size() > 1) {
+            index = flowHash(packet.buf.data(), packet.buf.size(), perturbation) % flows.size();
+        }
+
+        Flow &flow = flows[index];
+        flow.codel.enqueue(std::move(packet));
+        backlogPackets += 1;
+
+        if (flow.list == ListMembership::None) {
+            flow.list = ListMembership::New;
+            flow.deficit = static_cast<int64_t>(quantum);
+            newFlows.push_back(index);
+        }
+    }
+
+    std::optional<QueuedPacket> FQCoDelScheduler::dequeue(uint64_t now) {
+        auto countDrop = [this](QueuedPacket &packet) {
+            backlogPackets -= 1;
+            onDrop(packet);
+        };
+
+        while (true) {
+            std::deque<uint32_t> *list;
+
+            if (!newFlows.empty()) {
+                list = &newFlows;
+            } else if (!oldFlows.empty()) {
+                list = &oldFlows;
+            } else {
+                return std::nullopt;
+            }
+
+            const uint32_t index = list->front();
+            Flow &flow = flows[index];
+
+            if (flow.deficit <= 0) {
+                flow.deficit += static_cast<int64_t>(quantum);
+                list->pop_front();
+                flow.list = ListMembership::Old;
+                oldFlows.push_back(index);
+                continue;
+            }
+
+            std::optional<QueuedPacket> packet = flow.codel.dequeue(now, countDrop);
+
+            if (!packet.has_value()) {
+                list->pop_front();
+
+                // An emptied new flow goes to the back of the old list once, so it can't
+                // jump the queue again just by briefly going idle
+                if (list == &newFlows && !oldFlows.empty()) {
+                    flow.list = ListMembership::Old;
+                    oldFlows.push_back(index);
+                } else {
+                    flow.list = ListMembership::None;
+                }
+                continue;
+            }
+
+            backlogPackets -= 1;
+            flow.deficit -= static_cast<int64_t>(packet->buf.size());
+
+            return packet;
+        }
+    }
+
+    std::optional<QueuedPacket> FQCoDelScheduler::dropFromFattestFlow() {
+        Flow *fattest = nullptr;
+
+        for (Flow &flow : flows) {
+            if (!flow.codel.empty() && (fattest == nullptr || flow.codel.bytes() > fattest->codel.bytes())) {
+                fattest = &flow;
+            }
+        }
+
+        if (fattest == nullptr) {
+            return std::nullopt;
+        }
+
+        backlogPackets -= 1;
+
+        return fattest->codel.dropHead();
+    }
+
+    uint32_t FQCoDelScheduler::flowHash(const uint8_t *packet, size_t length, uint32_t perturbation) {
+        uint64_t h = 0xcbf29ce484222325ull ^ perturbation;
+
+        auto mix = [&h](const uint8_t *p, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                h ^= p[i];
+                h *= 0x100000001b3ull;
+            }
+        };
+
+        if (length < 1) {
+            return static_cast<uint32_t>(h);
+        }
+
+        const uint8_t version = packet[0] >> 4;
+        size_t transportOffset = 0;
+        uint8_t protocol = 0;
+        bool hasPorts = false;
+
+        if (version == 4 && length >= 20) {
+            const size_t ihl = (packet[0] & 0x0F) * 4;
+            const bool isFragment = ((packet[6] & 0x3F) | packet[7]) != 0;
+            protocol = packet[9];
+            mix(packet + 9, 1);
+            mix(packet + 12, 8);
+            transportOffset = ihl;
+            hasPorts = !isFragment;
+        } else if (version == 6 && length >= 40) {
+            protocol = packet[6];
+            mix(packet + 6, 1);
+            mix(packet + 8, 32);
+            transportOffset = 40;
+            hasPorts = true;
+        } else {
+            mix(packet, length < 20 ? length : 20);
+            return static_cast<uint32_t>(h ^ (h >> 32));
+        }
+
+        // TCP, UDP and UDP-Lite carry their ports in the first four bytes
+        if (hasPorts && (protocol == 6 || protocol == 17 || protocol == 136) && length >= transportOffset + 4) {
+            mix(packet + transportOffset, 4);
+        }
+
+        return static_cast<uint32_t>(h ^ (h >> 32));
+    }
+}
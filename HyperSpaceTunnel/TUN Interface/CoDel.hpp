@@ -0,0 +1,112 @@
+//
+//  CoDel.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "TUNWriteQueuePolicy.hpp"
+
+namespace hs {
+    /**
+     * A single CoDel controlled FIFO, as specified by RFC 8289.
+     *
+     * Packets are stamped when they are injected, and the sojourn time is
+     * measured when they leave this queue for the utun fd.
+     */
+    class CoDelQueue final {
+    public:
+        using DropCallBack = std::function<void(QueuedPacket&)>;
+
+        CoDelQueue(uint64_t targetNanos,
+                   uint64_t intervalNanos,
+                   size_t maxPacketBytes);
+
+        void enqueue(QueuedPacket &&packet);
+        std::optional<QueuedPacket> dequeue(uint64_t now, const DropCallBack &onDrop);
+
+        // Removes the packet at the head without running the control law
+        std::optional<QueuedPacket> dropHead();
+
+        bool empty() const { return queue.empty(); }
+        size_t bytes() const { return backlogBytes; }
+
+    private:
+        struct DoDequeueResult {
+            std::optional<QueuedPacket> packet;
+            bool okToDrop = false;
+        };
+
+        DoDequeueResult doDequeue(uint64_t now);
+        uint64_t controlLaw(uint64_t t, uint32_t count) const;
+
+        std::deque<QueuedPacket> queue;
+        size_t backlogBytes = 0;
+
+        uint64_t target;
+        uint64_t interval;
+        size_t maxPacket;
+
+        uint64_t firstAboveTime = 0;
+        uint64_t dropNext = 0;
+        uint32_t count = 0;
+        uint32_t lastCount = 0;
+        bool dropping = false;
+    };
+
+    /**
+     * Flow queueing in front of per-flow CoDel, as specified by RFC 8290.
+     *
+     * Packets are hashed by their 5-tuple into one of flowCount queues,
+     * and the queues are served deficit round robin with new flows ahead
+     * of old ones, so sparse interactive flows skip the standing queue
+     * built by bulk ones. With flowCount == 1 this is plain CoDel.
+     */
+    class FQCoDelScheduler final {
+    public:
+        FQCoDelScheduler(size_t flowCount,
+                         size_t quantum,
+                         uint64_t targetNanos,
+                         uint64_t intervalNanos,
+                         CoDelQueue::DropCallBack onDrop);
+
+        void enqueue(QueuedPacket &&packet);
+        std::optional<QueuedPacket> dequeue(uint64_t now);
+
+        // Removes the head packet of the flow with the largest backlog, for the caller to discard
+        std::optional<QueuedPacket> dropFromFattestFlow();
+
+        bool empty() const { return backlogPackets == 0; }
+
+        static uint32_t flowHash(const uint8_t *packet, size_t length, uint32_t perturbation);
+
+    private:
+        enum class ListMembership : uint8_t { None, New, Old };
+
+        struct Flow {
+            CoDelQueue codel;
+            int64_t deficit = 0;
+            ListMembership list = ListMembership::None;
+        };
+
+        std::vector<Flow> flows;
+        std::deque<uint32_t> newFlows;
+        std::deque<uint32_t> oldFlows;
+        size_t quantum;
+        size_t backlogPackets = 0;
+        uint32_t perturbation;
+        CoDelQueue::DropCallBack onDrop;
+    };
+}
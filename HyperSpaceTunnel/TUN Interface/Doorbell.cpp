@@ -0,0 +1,70 @@
+//
+//  Doorbell.cpp
+//  HyperSpaceTunnel
+//
+
+#include "Doorbell.hpp"
+#include "TUNLog.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+namespace hs {
+
+    std::unique_ptr<Doorbell> Doorbell::create() {
+#if defined(__linux__)
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            HS_LOG("Failed to create doorbell eventfd: %{public}s", strerror(errno));
+            return nullptr;
+        }
+        return std::unique_ptr<Doorbell>(new Doorbell(fd, fd));
+#else
+        int fds[2];
+        if (pipe(fds) < 0) {
+            HS_LOG("Failed to create doorbell pipe: %{public}s", strerror(errno));
+            return nullptr;
+        }
+        // A full pipe already wakes the loop, so a ring that would block can be dropped
+        for (int fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        return std::unique_ptr<Doorbell>(new Doorbell(fds[0], fds[1]));
+#endif
+    }
+
+    Doorbell::Doorbell(int readFD, int writeFD)
+        : readFD(readFD)
+        , writeFD(writeFD) {
+    }
+
+    Doorbell::~Doorbell() {
+        ::close(readFD);
+        if (writeFD != readFD) {
+            ::close(writeFD);
+        }
+    }
+
+    void Doorbell::ring() {
+        // What an eventfd adds to its count, and eight bytes more to drain for a pipe
+        uint64_t one = 1;
+        if (write(writeFD, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            HS_LOG("Failed to ring doorbell: %{public}s", strerror(errno));
+        }
+    }
+
+    void Doorbell::clear() {
+        // An eventfd reads back its whole count at once, a pipe whatever rings have piled up
+        uint8_t rung[64];
+        while (read(readFD, rung, sizeof(rung)) == static_cast<ssize_t>(sizeof(rung))) {
+        }
+    }
+}
@@ -0,0 +1,49 @@
+//
+//  Doorbell.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <memory>
+
+namespace hs {
+    /**
+     * An fd another thread can make readable to wake an event loop
+     * watching it, without touching the loop itself: an eventfd on Linux
+     * and a pipe elsewhere, so any EventLoop backend can watch it like
+     * the rest of its fds.
+     *
+     * Rings between clears coalesce into one readable event. Deciding
+     * when a ring is needed at all is up to the caller.
+     */
+    class Doorbell final {
+    public:
+        static std::unique_ptr<Doorbell> create();
+        ~Doorbell();
+
+        Doorbell(const Doorbell&) = delete;
+        Doorbell& operator=(const Doorbell&) = delete;
+
+        // The end to watch, readable once rung until cleared
+        int fd() const { return readFD; }
+
+        // Safe from any thread
+        void ring();
+
+        // Watching thread only, once it's woken
+        void clear();
+
+    private:
+        Doorbell(int readFD, int writeFD);
+
+        int readFD;
+        // The same fd as readFD for an eventfd
+        int writeFD;
+    };
+}
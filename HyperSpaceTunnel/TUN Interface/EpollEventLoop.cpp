@@ -0,0 +1,160 @@
+//
+//  EpollEventLoop.cpp
+//  HyperSpaceTunnel
+//
+
+#include "EpollEventLoop.hpp"
+
+#if defined(__linux__)
+
+#include "TUNLog.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace hs {
+
+    std::unique_ptr<EpollEventLoop> EpollEventLoop::create() {
+        int epollFD = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFD < 0) {
+            HS_LOG("Failed to create epoll instance: %{public}s", strerror(errno));
+            return nullptr;
+        }
+
+        int timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        int wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (timerFD < 0 || wakeFD < 0) {
+            HS_LOG("Failed to create epoll timer or wake fd: %{public}s", strerror(errno));
+            ::close(epollFD);
+            if (timerFD >= 0) ::close(timerFD);
+            if (wakeFD >= 0) ::close(wakeFD);
+            return nullptr;
+        }
+
+        return std::unique_ptr<EpollEventLoop>(new EpollEventLoop(epollFD, timerFD, wakeFD));
+    }
+
+    EpollEventLoop::EpollEventLoop(int epollFD, int timerFD, int wakeFD)
+        : epollFD(epollFD)
+        , timerFD(timerFD)
+        , wakeFD(wakeFD) {
+        // Told apart from watches by where they point
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = &this->timerFD;
+        epoll_ctl(epollFD, EPOLL_CTL_ADD, timerFD, &event);
+
+        event.data.ptr = &this->wakeFD;
+        epoll_ctl(epollFD, EPOLL_CTL_ADD, wakeFD, &event);
+    }
+
+    EpollEventLoop::~EpollEventLoop() {
+        ::close(epollFD);
+        ::close(timerFD);
+        ::close(wakeFD);
+    }
+
+    bool EpollEventLoop::add(int fd, Handler onReadable, Handler onWritable, void *context) {
+        auto watch = std::make_unique<Watch>();
+        watch->fd = fd;
+        watch->onReadable = onReadable;
+        watch->onWritable = onWritable;
+        watch->context = context;
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = watch.get();
+        if (epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &event) < 0) {
+            HS_LOG("Failed to add fd %d to epoll: %{public}s", fd, strerror(errno));
+            return false;
+        }
+
+        watches.push_back(std::move(watch));
+        return true;
+    }
+
+    void EpollEventLoop::remove(int fd) {
+        epoll_ctl(epollFD, EPOLL_CTL_DEL, fd, nullptr);
+        erase(fd);
+    }
+
+    void EpollEventLoop::updateWriteInterest(Watch &watch, bool enabled) {
+        struct epoll_event event = {};
+        event.events = enabled ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        event.data.ptr = &watch;
+        epoll_ctl(epollFD, EPOLL_CTL_MOD, watch.fd, &event);
+    }
+
+    void EpollEventLoop::scheduleTimer(std::chrono::nanoseconds delay, Handler onTimer, void *context) {
+        timerHandler = onTimer;
+        timerContext = context;
+        timerArmed = true;
+
+        // A zero it_value disarms a timerfd, so the soonest it can fire is a nanosecond out
+        const int64_t nanos = delay.count() > 0 ? delay.count() : 1;
+        struct itimerspec spec = {};
+        spec.it_value.tv_sec = static_cast<time_t>(nanos / 1000000000);
+        spec.it_value.tv_nsec = static_cast<long>(nanos % 1000000000);
+        timerfd_settime(timerFD, 0, &spec, nullptr);
+    }
+
+    void EpollEventLoop::run() {
+        struct epoll_event events[maxEvents];
+
+        while (!stopped.load(std::memory_order_acquire)) {
+            int count = epoll_wait(epollFD, events, maxEvents, -1);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                HS_LOG("epoll_wait failed: %{public}s", strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < count && !stopped.load(std::memory_order_relaxed); ++i) {
+                void *target = events[i].data.ptr;
+
+                if (target == &wakeFD) {
+                    uint64_t value;
+                    while (read(wakeFD, &value, sizeof(value)) > 0) {
+                    }
+                    continue;
+                }
+
+                if (target == &timerFD) {
+                    uint64_t expirations;
+                    if (read(timerFD, &expirations, sizeof(expirations)) > 0 && timerArmed) {
+                        timerArmed = false;
+                        timerHandler(-1, timerContext);
+                    }
+                    continue;
+                }
+
+                auto *watch = static_cast<Watch*>(target);
+
+                // Errors and hangups are left for the read to find
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    watch->onReadable(watch->fd, watch->context);
+                }
+                if ((events[i].events & EPOLLOUT) && watch->writing.load(std::memory_order_relaxed)) {
+                    watch->onWritable(watch->fd, watch->context);
+                }
+            }
+        }
+    }
+
+    void EpollEventLoop::stop() {
+        stopped.store(true, std::memory_order_release);
+
+        uint64_t one = 1;
+        if (write(wakeFD, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            HS_LOG("Failed to wake epoll loop: %{public}s", strerror(errno));
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,54 @@
+//
+//  EpollEventLoop.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <memory>
+
+#include "EventLoop.hpp"
+
+namespace hs {
+    /**
+     * An EventLoop straight on epoll, level triggered like libevent's.
+     * The timer is a timerfd and stop() rings an eventfd, both watched
+     * alongside the rest. epoll_ctl is safe from any thread, so changing
+     * write interest needs no lock of the loop's own.
+     */
+    class EpollEventLoop final : public EventLoop {
+    public:
+        static std::unique_ptr<EpollEventLoop> create();
+        ~EpollEventLoop() override;
+
+        bool add(int fd, Handler onReadable, Handler onWritable, void *context) override;
+        void remove(int fd) override;
+        void scheduleTimer(std::chrono::nanoseconds delay, Handler onTimer, void *context) override;
+        void run() override;
+        void stop() override;
+        const char *name() const override { return "epoll"; }
+
+    protected:
+        void updateWriteInterest(Watch &watch, bool enabled) override;
+
+    private:
+        EpollEventLoop(int epollFD, int timerFD, int wakeFD);
+
+        static constexpr size_t maxEvents = 64;
+
+        int epollFD;
+        int timerFD;
+        int wakeFD;
+        std::atomic<bool> stopped = false;
+    };
+}
+
+#endif
@@ -0,0 +1,73 @@
+//
+//  EventLoop.cpp
+//  HyperSpaceTunnel
+//
+
+#include "EventLoop.hpp"
+#include "LibEventLoop.hpp"
+#include "EpollEventLoop.hpp"
+#include "KqueueEventLoop.hpp"
+#include "IoUringEventLoop.hpp"
+
+#include <algorithm>
+
+namespace hs {
+
+    std::unique_ptr<EventLoop> EventLoop::create(EventLoopBackend backend) {
+        switch (backend) {
+            case EventLoopBackend::LibEvent:
+                return LibEventLoop::create();
+            case EventLoopBackend::Native:
+#if defined(__linux__)
+                return EpollEventLoop::create();
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+                return KqueueEventLoop::create();
+#else
+                return nullptr;
+#endif
+            case EventLoopBackend::IoUring:
+#if defined(__linux__)
+                return IoUringEventLoop::create();
+#else
+                return nullptr;
+#endif
+        }
+        return nullptr;
+    }
+
+    EventLoopBackend EventLoop::defaultBackend() {
+#if defined(__linux__)
+        return EventLoopBackend::Native;
+#else
+        return EventLoopBackend::LibEvent;
+#endif
+    }
+
+    void EventLoop::setWriteInterest(int fd, bool enabled) {
+        Watch *watch = find(fd);
+        if (watch == nullptr || watch->writing.load() == enabled) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(watch->interestMutex);
+        if (watch->writing.load() != enabled) {
+            updateWriteInterest(*watch, enabled);
+            watch->writing.store(enabled);
+        }
+    }
+
+    EventLoop::Watch *EventLoop::find(int fd) const {
+        for (const std::unique_ptr<Watch> &watch : watches) {
+            if (watch->fd == fd) {
+                return watch.get();
+            }
+        }
+        return nullptr;
+    }
+
+    void EventLoop::erase(int fd) {
+        watches.erase(std::remove_if(watches.begin(), watches.end(), [fd](const std::unique_ptr<Watch> &watch) {
+            return watch->fd == fd;
+        }), watches.end());
+    }
+}
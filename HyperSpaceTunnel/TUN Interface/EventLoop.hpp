@@ -0,0 +1,117 @@
+//
+//  EventLoop.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace hs {
+    enum class EventLoopBackend {
+        // libevent, with its pthread locking so other threads can change what it waits on
+        LibEvent,
+        // epoll on Linux or kqueue on Apple platforms, called directly
+        Native,
+        // io_uring on Linux, with the TUN fd read and written through completions rather than readiness
+        IoUring
+    };
+
+    /**
+     * The readiness loop a TUNInterface thread runs: a few fds, each read
+     * whenever it's readable and written while it has something queued,
+     * plus a one-shot timer.
+     *
+     * Handlers run on the thread that called run(). Apart from
+     * setWriteInterest() and stop(), which any thread may call, an
+     * EventLoop belongs to that thread, or to whoever sets it up before
+     * run() and tears it down after.
+     */
+    class EventLoop {
+    public:
+        // Called with the fd that became ready, or -1 for the timer, and the context it was given
+        using Handler = void (*)(int fd, void *context);
+
+        /**
+         * A loop using backend, or nullptr if it couldn't be created or
+         * isn't available on this platform.
+         */
+        static std::unique_ptr<EventLoop> create(EventLoopBackend backend = defaultBackend());
+
+        // The backend with the least overhead per event on this platform
+        static EventLoopBackend defaultBackend();
+
+        EventLoop() = default;
+        virtual ~EventLoop() = default;
+
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        /**
+         * Starts watching fd, which must be non-blocking. onReadable is
+         * called whenever it's readable, and onWritable whenever it's
+         * writable while write interest is on, which it starts off.
+         */
+        virtual bool add(int fd, Handler onReadable, Handler onWritable, void *context) = 0;
+
+        virtual void remove(int fd) = 0;
+
+        /**
+         * Turns calls to fd's onWritable on or off. Safe from any thread,
+         * and only a load when the interest is already as asked.
+         */
+        void setWriteInterest(int fd, bool enabled);
+
+        /**
+         * Calls onTimer once, delay from now. A timer already pending is
+         * replaced.
+         */
+        virtual void scheduleTimer(std::chrono::nanoseconds delay, Handler onTimer, void *context) = 0;
+
+        bool timerPending() const { return timerArmed; }
+
+        // Dispatches events on the calling thread until stop() is called
+        virtual void run() = 0;
+
+        // Safe from any thread. run() returns once the handler it may be in has
+        virtual void stop() = 0;
+
+        virtual const char *name() const = 0;
+
+    protected:
+        struct Watch {
+            virtual ~Watch() = default;
+
+            int fd = -1;
+            Handler onReadable = nullptr;
+            Handler onWritable = nullptr;
+            void *context = nullptr;
+
+            // Serializes changes to the backend's write interest, so it always ends up matching writing
+            std::mutex interestMutex;
+            std::atomic<bool> writing = false;
+        };
+
+        Watch *find(int fd) const;
+        void erase(int fd);
+
+        // Makes the backend wait, or stop waiting, for watch to become writable
+        virtual void updateWriteInterest(Watch &watch, bool enabled) = 0;
+
+        std::vector<std::unique_ptr<Watch>> watches;
+
+        // Loop thread only
+        Handler timerHandler = nullptr;
+        void *timerContext = nullptr;
+        bool timerArmed = false;
+    };
+}
@@ -0,0 +1,306 @@
+//
+//  GRO.cpp
+//  HyperSpaceTunnel
+//
+
+#include "GRO.hpp"
+#include "Checksum.hpp"
+#include "Offload.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace hs {
+
+    static constexpr uint8_t protocolTCP = 6;
+
+    static constexpr uint8_t tcpPSH = 0x08;
+    static constexpr uint8_t tcpACK = 0x10;
+
+    static uint16_t read16(const uint8_t *p) {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    static void write16(uint8_t *p, uint16_t value) {
+        p[0] = static_cast<uint8_t>(value >> 8);
+        p[1] = static_cast<uint8_t>(value);
+    }
+
+    static uint32_t read32(const uint8_t *p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+               (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    // A TCP segment as GRO sees it, pointing into the packet it was parsed from
+    struct GROTable::Segment {
+        PacketBuf &packet;
+        uint8_t version = 0;
+        size_t ipHeader = 0;
+        size_t headers = 0;
+        size_t payload = 0;
+        uint32_t sequence = 0;
+        uint8_t flags = 0;
+        // Data that could start or continue a merge, whose TCP checksum holds
+        bool mergeable = false;
+        uint32_t payloadSum = 0;
+
+        explicit Segment(PacketBuf &packet)
+            : packet(packet) {
+        }
+
+        const uint8_t *ip() const { return packet.data(); }
+        const uint8_t *tcp() const { return packet.data() + ipHeader; }
+
+        // Fills in the segment, or returns false for anything that isn't a whole, unfragmented
+        // TCP packet with no IPv4 options or IPv6 extension headers
+        bool parse() {
+            const uint8_t *p = packet.data();
+            const size_t length = packet.size();
+
+            if (length < 20) {
+                return false;
+            }
+
+            version = p[0] >> 4;
+            if (version == 4) {
+                if (p[0] != 0x45 || p[9] != protocolTCP || read16(p + 2) != length || ((p[6] & 0x3F) | p[7]) != 0) {
+                    return false;
+                }
+                ipHeader = 20;
+            } else if (version == 6) {
+                if (length < 40 || p[6] != protocolTCP || static_cast<size_t>(read16(p + 4)) + 40 != length) {
+                    return false;
+                }
+                ipHeader = 40;
+            } else {
+                return false;
+            }
+
+            if (length < ipHeader + 20) {
+                return false;
+            }
+
+            const size_t tcpHeader = static_cast<size_t>(p[ipHeader + 12] >> 4) * 4;
+            if (tcpHeader < 20 || ipHeader + tcpHeader > length) {
+                return false;
+            }
+
+            headers = ipHeader + tcpHeader;
+            payload = length - headers;
+            sequence = read32(p + ipHeader + 4);
+            flags = p[ipHeader + 13];
+
+            // A corrupt segment goes on as it came for the stack to drop, rather than have a merged
+            // packet's fresh checksum vouch for it
+            mergeable = payload > 0 && (flags & ~tcpPSH) == tcpACK && !packet.hasOffload() && verify();
+            return true;
+        }
+
+        // Checks the TCP checksum, keeping the payload's share of the sum for the merged packet's
+        bool verify() {
+            const uint8_t *p = packet.data();
+            const size_t tcpLength = packet.size() - ipHeader;
+
+            payloadSum = checksum::add(p + headers, payload, 0);
+            const uint32_t sum = checksum::add(tcp(), headers - ipHeader,
+                                               offload::pseudoHeaderSum(p, protocolTCP, tcpLength));
+            return checksum::fold(static_cast<uint64_t>(sum) + payloadSum) == 0xFFFF;
+        }
+    };
+
+    GROTable::GROTable(const GROConfig &config)
+        : settings(config) {
+        settings.maxSize = std::min<size_t>(settings.maxSize, 65535);
+        settings.maxFlows = std::max<size_t>(settings.maxFlows, 1);
+        flows.reserve(settings.maxFlows);
+    }
+
+    void GROTable::receive(PacketBuf &&packet, uint64_t now, PacketBatch &out) {
+        Segment segment(packet);
+
+        if (!segment.parse()) {
+            out.push_back(std::move(packet));
+            return;
+        }
+
+        for (size_t i = 0; i < flows.size(); ++i) {
+            if (!sameFlow(flows[i], segment)) {
+                continue;
+            }
+
+            if (canMerge(flows[i], segment)) {
+                merge(flows[i], segment);
+
+                // Nothing more can follow a push or a short segment, or fit past the size limit
+                Flow &flow = flows[i];
+                if ((segment.flags & tcpPSH) || segment.payload < flow.segmentSize ||
+                    flow.packet.size() + flow.segmentSize > settings.maxSize) {
+                    release(i, out);
+                }
+                return;
+            }
+
+            // Whatever the flow had goes first, so it stays in order
+            release(i, out);
+            break;
+        }
+
+        hold(segment, now, out);
+    }
+
+    void GROTable::flush(PacketBatch &out) {
+        while (!flows.empty()) {
+            release(0, out);
+        }
+    }
+
+    void GROTable::flushExpired(uint64_t now, PacketBatch &out) {
+        const uint64_t timeout = static_cast<uint64_t>(settings.flushTimeout.count());
+
+        // Flows are held in arrival order, so the expired ones are at the front
+        while (!flows.empty() && flows.front().heldSince + timeout <= now) {
+            release(0, out);
+        }
+    }
+
+    std::optional<uint64_t> GROTable::nextFlushAt() const {
+        if (flows.empty()) {
+            return std::nullopt;
+        }
+        return flows.front().heldSince + static_cast<uint64_t>(settings.flushTimeout.count());
+    }
+
+    GROStats GROTable::stats() const {
+        GROStats s;
+        s.merged = merged.load(std::memory_order_relaxed);
+        s.superPackets = superPackets.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    bool GROTable::sameFlow(const Flow &flow, const Segment &segment) {
+        const uint8_t *ip = flow.packet.data();
+
+        if ((ip[0] >> 4) != segment.version) {
+            return false;
+        }
+
+        // Source and destination addresses, then source and destination ports
+        const bool addresses = segment.version == 4
+            ? memcmp(ip + 12, segment.ip() + 12, 8) == 0
+            : memcmp(ip + 8, segment.ip() + 8, 32) == 0;
+        return addresses && memcmp(ip + flow.ipHeader, segment.tcp(), 4) == 0;
+    }
+
+    bool GROTable::canMerge(const Flow &flow, const Segment &segment) const {
+        if (!segment.mergeable ||
+            segment.headers != flow.headers ||
+            segment.sequence != flow.nextSequence ||
+            segment.payload > flow.segmentSize ||
+            flow.packet.size() + segment.payload > settings.maxSize) {
+            return false;
+        }
+
+        const uint8_t *ip = flow.packet.data();
+        const uint8_t *tcp = ip + flow.ipHeader;
+
+        // The merged packet can only have one of each: TOS and TTL, or traffic class, flow label
+        // and hop limit, and the don't fragment bit
+        if (segment.version == 4) {
+            if (ip[1] != segment.ip()[1] || ip[8] != segment.ip()[8] || (ip[6] & 0x40) != (segment.ip()[6] & 0x40)) {
+                return false;
+            }
+        } else if (memcmp(ip, segment.ip(), 4) != 0 || ip[7] != segment.ip()[7]) {
+            return false;
+        }
+
+        // The same acknowledgment number and options, timestamps included
+        return memcmp(tcp + 8, segment.tcp() + 8, 4) == 0 &&
+               memcmp(tcp + 20, segment.tcp() + 20, flow.headers - flow.ipHeader - 20) == 0;
+    }
+
+    void GROTable::merge(Flow &flow, const Segment &segment) {
+        // The first merge moves the packet into a buffer that can take the rest
+        if (flow.packet.isShared() || flow.packet.tailroom() < settings.maxSize - flow.packet.size()) {
+            PacketBuf larger = PacketBuf::allocate(settings.maxSize, 0);
+            memcpy(larger.put(flow.packet.size()), flow.packet.data(), flow.packet.size());
+            flow.packet = std::move(larger);
+        }
+
+        // Payload that lands at an odd offset adds into the sum byte swapped
+        const size_t offset = flow.packet.size() - flow.headers;
+        memcpy(flow.packet.put(segment.payload), segment.packet.data() + segment.headers, segment.payload);
+        const uint16_t sum = checksum::fold(segment.payloadSum);
+        flow.payloadSum += offset % 2 == 0 ? sum : static_cast<uint16_t>((sum << 8) | (sum >> 8));
+
+        // The latest window, and a push if this segment carried one
+        uint8_t *tcp = flow.packet.data() + flow.ipHeader;
+        tcp[13] |= segment.flags & tcpPSH;
+        memcpy(tcp + 14, segment.tcp() + 14, 2);
+
+        flow.nextSequence += static_cast<uint32_t>(segment.payload);
+        flow.segments += 1;
+        merged.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void GROTable::hold(Segment &segment, uint64_t now, PacketBatch &out) {
+        // A push has nothing to wait for
+        if (!segment.mergeable || (segment.flags & tcpPSH)) {
+            out.push_back(std::move(segment.packet));
+            return;
+        }
+
+        if (flows.size() >= settings.maxFlows) {
+            release(0, out);
+        }
+
+        Flow flow;
+        flow.ipHeader = segment.ipHeader;
+        flow.headers = segment.headers;
+        flow.nextSequence = segment.sequence + static_cast<uint32_t>(segment.payload);
+        flow.segmentSize = segment.payload;
+        flow.payloadSum = segment.payloadSum;
+        flow.segments = 1;
+        flow.heldSince = now;
+        flow.packet = std::move(segment.packet);
+        flows.push_back(std::move(flow));
+    }
+
+    void GROTable::release(size_t index, PacketBatch &out) {
+        finish(flows[index]);
+        out.push_back(std::move(flows[index].packet));
+        flows.erase(flows.begin() + static_cast<std::ptrdiff_t>(index));
+    }
+
+    void GROTable::finish(Flow &flow) {
+        if (flow.segments < 2) {
+            return;
+        }
+
+        PacketBuf &packet = flow.packet;
+        uint8_t *ip = packet.data();
+        const size_t length = packet.size();
+        const bool v4 = (ip[0] >> 4) == 4;
+
+        if (v4) {
+            // Only the total length changed, so the header checksum is patched as the kernel does, which
+            // also leaves a bad one bad rather than vouching for a header nobody checked
+            const uint16_t oldLength = read16(ip + 2);
+            write16(ip + 2, static_cast<uint16_t>(length));
+            write16(ip + 10, checksum::update16(read16(ip + 10), oldLength, static_cast<uint16_t>(length)));
+        } else {
+            write16(ip + 4, static_cast<uint16_t>(length - 40));
+        }
+
+        // Every payload was summed when its checksum was verified, so only the headers are summed again
+        uint8_t *tcp = ip + flow.ipHeader;
+        const size_t tcpLength = length - flow.ipHeader;
+        write16(tcp + 16, 0);
+        const uint32_t headerSum = checksum::add(tcp, flow.headers - flow.ipHeader,
+                                                 offload::pseudoHeaderSum(ip, protocolTCP, tcpLength));
+        write16(tcp + 16, checksum::finish(headerSum + flow.payloadSum));
+
+        packet.setSegmentation(v4 ? PacketBuf::GSOType::TCPv4 : PacketBuf::GSOType::TCPv6,
+                               static_cast<uint16_t>(flow.segmentSize));
+        superPackets.fetch_add(1, std::memory_order_relaxed);
+    }
+}
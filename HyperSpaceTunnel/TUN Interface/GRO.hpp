@@ -0,0 +1,122 @@
+//
+//  GRO.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "PacketBuf.hpp"
+#include "PacketSink.hpp"
+
+namespace hs {
+    struct GROConfig {
+        bool enabled = false;
+        // The largest IP packet coalescing may build. The default is the most one UDP datagram
+        // to the external app can carry, and nothing above 65535 can be expressed in IP
+        size_t maxSize = 65507;
+        // How long a flow may be held waiting for more segments. Zero holds nothing past the
+        // read event its segments arrived in
+        std::chrono::nanoseconds flushTimeout = std::chrono::nanoseconds(0);
+        // Flows held at once. A new flow past this flushes the oldest
+        size_t maxFlows = 8;
+    };
+
+    /**
+     * A point in time copy of a GROTable's counters.
+     */
+    struct GROStats {
+        // Segments whose payload was appended to an earlier packet of their flow
+        uint64_t merged = 0;
+        // Packets delivered with at least one segment merged into them
+        uint64_t superPackets = 0;
+    };
+
+    /**
+     * Software generic receive offload for TCP, in the manner of the Linux
+     * tcp_gro_receive: consecutive in-order segments of a flow are merged
+     * into one larger packet, so whatever consumes the packets read from
+     * the TUN handles one packet per burst rather than one per MSS.
+     *
+     * Only plain data segments merge: ACK with optionally PSH, identical
+     * TCP options and IP header fields, the next expected sequence number,
+     * and no larger than the flow's first segment. Each must also pass its
+     * TCP checksum, as the kernel's GRO only merges verified segments, so
+     * the merged packet's checksum never covers up a corrupt one. A PSH, a
+     * short segment or the size limit ends the merge and releases the
+     * packet. Anything else releases whatever its flow had held first, so
+     * a flow stays in order. Released packets are complete, with their IP
+     * length and all checksums recomputed, and record the original segment
+     * size as segmentation offload metadata.
+     *
+     * Owned by the TUN thread. stats() may be called from any thread.
+     */
+    class GROTable final {
+    public:
+        explicit GROTable(const GROConfig &config);
+
+        GROTable(const GROTable&) = delete;
+        GROTable& operator=(const GROTable&) = delete;
+
+        const GROConfig &config() const { return settings; }
+
+        /**
+         * Takes a packet read from the device at now, in steady_clock
+         * nanoseconds. Whatever is ready to go on, the packet itself or
+         * held packets it ended, is appended to out.
+         */
+        void receive(PacketBuf &&packet, uint64_t now, PacketBatch &out);
+
+        // Appends every held packet to out
+        void flush(PacketBatch &out);
+
+        // Appends the packets held for flushTimeout or longer by now to out
+        void flushExpired(uint64_t now, PacketBatch &out);
+
+        // When the oldest held packet is due out, if any is held
+        std::optional<uint64_t> nextFlushAt() const;
+
+        bool empty() const { return flows.empty(); }
+
+        GROStats stats() const;
+
+    private:
+        struct Segment;
+
+        struct Flow {
+            PacketBuf packet;
+            size_t ipHeader = 0;
+            size_t headers = 0;
+            uint32_t nextSequence = 0;
+            size_t segmentSize = 0;
+            // The sum of every payload merged so far, as placed in packet
+            uint64_t payloadSum = 0;
+            size_t segments = 0;
+            uint64_t heldSince = 0;
+        };
+
+        static bool sameFlow(const Flow &flow, const Segment &segment);
+        bool canMerge(const Flow &flow, const Segment &segment) const;
+        void merge(Flow &flow, const Segment &segment);
+        void hold(Segment &segment, uint64_t now, PacketBatch &out);
+        void release(size_t index, PacketBatch &out);
+        void finish(Flow &flow);
+
+        GROConfig settings;
+        std::vector<Flow> flows;
+
+        std::atomic<uint64_t> merged = 0;
+        std::atomic<uint64_t> superPackets = 0;
+    };
+}
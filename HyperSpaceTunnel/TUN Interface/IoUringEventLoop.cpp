@@ -0,0 +1,636 @@
+//
+//  IoUringEventLoop.cpp
+//  HyperSpaceTunnel
+//
+
+#include "IoUringEventLoop.hpp"
+
+#if defined(__linux__)
+
+#include "TUNLog.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace hs {
+
+    // IORING_OP_READ_MULTISHOT, from Linux 6.7, which older kernel headers don't name yet
+    static constexpr uint8_t opReadMultishot = 49;
+
+    // The provided-buffer groups the packet fd reads into, a ring or, failing that, buffers handed over by request
+    static constexpr uint16_t bufferGroup = 0;
+    static constexpr uint16_t legacyBufferGroup = 1;
+
+    static constexpr uint64_t payloadMask = (uint64_t(1) << 56) - 1;
+
+    static int ioUringSetup(unsigned entries, struct io_uring_params *params) {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+    static int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned count) {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+    }
+
+    std::unique_ptr<IoUringEventLoop> IoUringEventLoop::create(unsigned entries) {
+        // Task work deferred to io_uring_enter, which only the loop thread calls anyway
+        struct io_uring_params params = {};
+        params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+
+        int ringFD = ioUringSetup(entries, &params);
+        if (ringFD < 0 && errno == EINVAL) {
+            // Kernels before 6.1
+            params = {};
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = entries * 4;
+            ringFD = ioUringSetup(entries, &params);
+        }
+        if (ringFD < 0) {
+            HS_LOG("Failed to create io_uring: %{public}s", strerror(errno));
+            return nullptr;
+        }
+
+        int wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeFD < 0) {
+            HS_LOG("Failed to create io_uring wake fd: %{public}s", strerror(errno));
+            ::close(ringFD);
+            return nullptr;
+        }
+
+        auto loop = std::unique_ptr<IoUringEventLoop>(new IoUringEventLoop(ringFD, wakeFD));
+        if (!loop->mapRings(params)) {
+            return nullptr;
+        }
+
+        loop->armWake();
+        return loop;
+    }
+
+    IoUringEventLoop::IoUringEventLoop(int ringFD, int wakeFD)
+        : ringFD(ringFD)
+        , wakeFD(wakeFD) {
+    }
+
+    IoUringEventLoop::~IoUringEventLoop() {
+        // Closing the ring cancels whatever is still in flight
+        ::close(ringFD);
+        ::close(wakeFD);
+
+        if (sqes) munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing) munmap(sqRing, sqRingSize);
+        if (bufferRing) munmap(bufferRing, bufferRingSize);
+    }
+
+    bool IoUringEventLoop::mapRings(const struct io_uring_params &params) {
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+        // Since 5.4 both rings come from the one mapping
+        const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            sqRing = nullptr;
+            HS_LOG("Failed to map io_uring submission ring: %{public}s", strerror(errno));
+            return false;
+        }
+
+        if (single) {
+            cqRing = sqRing;
+        } else {
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED) {
+                cqRing = nullptr;
+                HS_LOG("Failed to map io_uring completion ring: %{public}s", strerror(errno));
+                return false;
+            }
+        }
+
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        void *entries = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_SQES);
+        if (entries == MAP_FAILED) {
+            HS_LOG("Failed to map io_uring submission entries: %{public}s", strerror(errno));
+            return false;
+        }
+        sqes = static_cast<struct io_uring_sqe*>(entries);
+
+        auto *sq = static_cast<uint8_t*>(sqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqEntries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+        sqLocalTail = *sqTail;
+
+        // Submission slots are used in order, so the indirection array never changes
+        auto *array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        for (unsigned i = 0; i < sqEntries; ++i) {
+            array[i] = i;
+        }
+
+        auto *cq = static_cast<uint8_t*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    static uint64_t userData(uint8_t op, uint64_t payload) {
+        return (static_cast<uint64_t>(op) << 56) | (payload & payloadMask);
+    }
+
+    struct io_uring_sqe *IoUringEventLoop::nextSqe() {
+        if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+            // Full, so hand what's there to the kernel to make room
+            enter(0);
+            if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+                return nullptr;
+            }
+        }
+
+        struct io_uring_sqe *sqe = &sqes[sqLocalTail & sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqLocalTail += 1;
+        return sqe;
+    }
+
+    void IoUringEventLoop::enter(unsigned minComplete) {
+        __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+        const unsigned toSubmit = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+        // Always asking for events, since with deferred task work that's what posts completions
+        if (ioUringEnter(ringFD, toSubmit, minComplete, IORING_ENTER_GETEVENTS) < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME) {
+                HS_LOG("io_uring_enter failed: %{public}s", strerror(errno));
+            }
+        }
+    }
+
+    bool IoUringEventLoop::add(int fd, Handler onReadable, Handler onWritable, void *context) {
+        auto watch = std::make_unique<IoUringWatch>();
+        watch->fd = fd;
+        watch->onReadable = onReadable;
+        watch->onWritable = onWritable;
+        watch->context = context;
+
+        armPollIn(*watch);
+        watches.push_back(std::move(watch));
+        return true;
+    }
+
+    void IoUringEventLoop::remove(int fd) {
+        // Only once run() has returned, since polls still in flight point at the watch
+        if (packetWatch && packetWatch->fd == fd) {
+            packetWatch = nullptr;
+        }
+        erase(fd);
+    }
+
+    void IoUringEventLoop::updateWriteInterest(Watch &watch, bool enabled) {
+        if (!enabled) {
+            return;
+        }
+
+        // Stored ahead of EventLoop so a loop about to sleep either sees it or gets woken
+        watch.writing.store(true);
+        if (sleeping.load()) {
+            uint64_t one = 1;
+            if (write(wakeFD, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                HS_LOG("Failed to wake io_uring loop: %{public}s", strerror(errno));
+            }
+        }
+    }
+
+    void IoUringEventLoop::scheduleTimer(std::chrono::nanoseconds delay, Handler onTimer, void *context) {
+        struct io_uring_sqe *sqe = nextSqe();
+        if (!sqe) {
+            HS_LOG("No io_uring submission slot for timer");
+            return;
+        }
+
+        timerHandler = onTimer;
+        timerContext = context;
+        timerArmed = true;
+        timerGeneration += 1;
+
+        const int64_t nanos = delay.count() > 0 ? delay.count() : 0;
+        timerSpec.tv_sec = nanos / 1000000000;
+        timerSpec.tv_nsec = nanos % 1000000000;
+
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uintptr_t>(&timerSpec);
+        sqe->len = 1;
+        sqe->user_data = userData(static_cast<uint8_t>(Op::Timer), timerGeneration);
+    }
+
+    void IoUringEventLoop::armWake() {
+        if (struct io_uring_sqe *sqe = nextSqe()) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = wakeFD;
+            sqe->poll32_events = POLLIN;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->user_data = userData(static_cast<uint8_t>(Op::Wake), 0);
+        }
+    }
+
+    void IoUringEventLoop::armPollIn(IoUringWatch &watch) {
+        if (struct io_uring_sqe *sqe = nextSqe()) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = watch.fd;
+            sqe->poll32_events = POLLIN;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->user_data = userData(static_cast<uint8_t>(Op::PollIn), reinterpret_cast<uintptr_t>(&watch));
+            watch.pollingIn = true;
+        }
+    }
+
+    void IoUringEventLoop::armPollOut(IoUringWatch &watch) {
+        if (struct io_uring_sqe *sqe = nextSqe()) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = watch.fd;
+            sqe->poll32_events = POLLOUT;
+            sqe->user_data = userData(static_cast<uint8_t>(Op::PollOut), reinterpret_cast<uintptr_t>(&watch));
+            watch.pollingOut = true;
+        }
+    }
+
+    bool IoUringEventLoop::startPacketIO(int fd,
+                                         PacketBufferPool &readPool,
+                                         size_t bufferCount,
+                                         std::vector<PacketBufferPool*> writePools,
+                                         const PacketHandlers &handlers) {
+        if (packetWatch) {
+            return false;
+        }
+
+        // The buffer ring is a power of two entries, and bids are 16 bits
+        unsigned count = 1;
+        while (count < bufferCount && count < 32768) {
+            count <<= 1;
+        }
+
+        bufferRingSize = count * sizeof(struct io_uring_buf);
+        void *ring = mmap(nullptr, bufferRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (ring == MAP_FAILED) {
+            HS_LOG("Failed to map provided buffer ring: %{public}s", strerror(errno));
+            return false;
+        }
+        bufferRing = static_cast<struct io_uring_buf_ring*>(ring);
+
+        struct io_uring_buf_reg reg = {};
+        reg.ring_addr = reinterpret_cast<uintptr_t>(bufferRing);
+        reg.ring_entries = count;
+        reg.bgid = bufferGroup;
+        if (ioUringRegister(ringFD, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            HS_LOG("Failed to register provided buffer ring: %{public}s", strerror(errno));
+            munmap(bufferRing, bufferRingSize);
+            bufferRing = nullptr;
+            return false;
+        }
+
+        this->handlers = handlers;
+        this->readPool = &readPool;
+        bufferMask = count - 1;
+        provided.resize(count);
+        for (unsigned bid = 0; bid < count; ++bid) {
+            provideBuffer(static_cast<uint16_t>(bid));
+        }
+
+        writesInFlight.resize(sqEntries);
+        freeWriteSlots.clear();
+        for (uint32_t slot = sqEntries; slot > 0; --slot) {
+            freeWriteSlots.push_back(slot - 1);
+        }
+
+        // A sparse table, filled in slab by slab as the pools grow
+        struct io_uring_rsrc_register table = {};
+        table.nr = maxRegisteredRegions;
+        table.flags = IORING_RSRC_REGISTER_SPARSE;
+        fixedBuffers = ioUringRegister(ringFD, IORING_REGISTER_BUFFERS2, &table, sizeof(table)) == 0;
+        if (!fixedBuffers) {
+            HS_LOG("Writing without registered buffers: %{public}s", strerror(errno));
+        }
+
+        this->writePools = std::move(writePools);
+        writePoolSlabs.assign(this->writePools.size(), 0);
+        registerWriteBuffers();
+
+        auto watch = std::make_unique<IoUringWatch>();
+        watch->fd = fd;
+        watch->onWritable = handlers.onWritable;
+        watch->context = handlers.context;
+        watch->packetIO = true;
+        packetWatch = watch.get();
+        watches.push_back(std::move(watch));
+
+        armRead();
+        return true;
+    }
+
+    void IoUringEventLoop::provideBuffer(uint16_t bid) {
+        PacketBuf &buf = provided[bid];
+        buf = PacketBuf::allocate(*readPool, 0);
+
+        if (legacyBuffers) {
+            if (struct io_uring_sqe *sqe = nextSqe()) {
+                sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+                sqe->fd = 1;
+                sqe->addr = reinterpret_cast<uintptr_t>(buf.tail());
+                sqe->len = static_cast<uint32_t>(buf.tailroom());
+                sqe->buf_group = legacyBufferGroup;
+                sqe->off = bid;
+                sqe->user_data = userData(static_cast<uint8_t>(Op::Provide), bid);
+            }
+            return;
+        }
+
+        // Field by field, since the first entry's reserved word is the ring's tail
+        struct io_uring_buf *entry = &bufferRing->bufs[bufferTail & bufferMask];
+        entry->addr = reinterpret_cast<uintptr_t>(buf.tail());
+        entry->len = static_cast<uint32_t>(buf.tailroom());
+        entry->bid = bid;
+
+        bufferTail += 1;
+        __atomic_store_n(&bufferRing->tail, bufferTail, __ATOMIC_RELEASE);
+    }
+
+    void IoUringEventLoop::armRead() {
+        struct io_uring_sqe *sqe = nextSqe();
+        if (!sqe) {
+            return;
+        }
+
+        // The length comes from whichever buffer the kernel picks
+        sqe->opcode = multishotRead ? opReadMultishot : static_cast<uint8_t>(IORING_OP_READ);
+        sqe->fd = packetWatch->fd;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = legacyBuffers ? legacyBufferGroup : bufferGroup;
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->user_data = userData(static_cast<uint8_t>(Op::Read), 0);
+        reading = true;
+    }
+
+    void IoUringEventLoop::registerWriteBuffers() {
+        if (!fixedBuffers) {
+            return;
+        }
+
+        std::vector<struct iovec> added;
+        for (size_t i = 0; i < writePools.size(); ++i) {
+            if (writePools[i]->slabCount() == writePoolSlabs[i]) {
+                continue;
+            }
+
+            std::vector<PacketBufferPool::Region> regions = writePools[i]->slabRegions();
+            for (size_t r = writePoolSlabs[i]; r < regions.size(); ++r) {
+                if (registered.size() + added.size() == maxRegisteredRegions) {
+                    break;
+                }
+                added.push_back({regions[r].base, regions[r].length});
+            }
+            writePoolSlabs[i] = regions.size();
+        }
+
+        if (added.empty()) {
+            return;
+        }
+
+        struct io_uring_rsrc_update2 update = {};
+        update.offset = static_cast<uint32_t>(registered.size());
+        update.data = reinterpret_cast<uintptr_t>(added.data());
+        update.nr = static_cast<uint32_t>(added.size());
+        if (ioUringRegister(ringFD, IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update)) < 0) {
+            // Most likely RLIMIT_MEMLOCK, since registering pins the pages
+            HS_LOG("Failed to register write buffers, writing without them: %{public}s", strerror(errno));
+            fixedBuffers = false;
+            return;
+        }
+
+        for (const struct iovec &iov : added) {
+            registered.push_back({static_cast<const uint8_t*>(iov.iov_base), iov.iov_len,
+                                  static_cast<unsigned>(registered.size())});
+        }
+        std::sort(registered.begin(), registered.end(), [](const Registered &a, const Registered &b) {
+            return a.base < b.base;
+        });
+    }
+
+    int IoUringEventLoop::fixedBufferIndex(const uint8_t *data, size_t length) {
+        for (int attempt = 0; attempt < 2 && fixedBuffers; ++attempt) {
+            auto it = std::upper_bound(registered.begin(), registered.end(), data, [](const uint8_t *p, const Registered &r) {
+                return p < r.base;
+            });
+            if (it != registered.begin()) {
+                const Registered &region = *(it - 1);
+                if (data + length <= region.base + region.length) {
+                    return static_cast<int>(region.index);
+                }
+            }
+
+            // A miss usually means a slab allocated since the last look
+            registerWriteBuffers();
+        }
+        return -1;
+    }
+
+    void IoUringEventLoop::queueWrite(PacketBuf &&packet) {
+        struct io_uring_sqe *sqe = freeWriteSlots.empty() ? nullptr : nextSqe();
+        if (!sqe) {
+            handlers.onWritten(std::move(packet), -EBUSY, handlers.context);
+            return;
+        }
+
+        const uint32_t slot = freeWriteSlots.back();
+        freeWriteSlots.pop_back();
+
+        const int index = fixedBufferIndex(packet.data(), packet.size());
+        sqe->opcode = index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = packetWatch->fd;
+        sqe->addr = reinterpret_cast<uintptr_t>(packet.data());
+        sqe->len = static_cast<uint32_t>(packet.size());
+        sqe->off = static_cast<uint64_t>(-1);
+        if (index >= 0) {
+            sqe->buf_index = static_cast<uint16_t>(index);
+        }
+        sqe->user_data = userData(static_cast<uint8_t>(Op::Write), slot);
+
+        // Kept alive until the kernel is done with the bytes
+        writesInFlight[slot] = std::move(packet);
+    }
+
+    bool IoUringEventLoop::wantsWrites() const {
+        for (const std::unique_ptr<Watch> &w : watches) {
+            const auto &watch = static_cast<const IoUringWatch&>(*w);
+            if (!watch.writing.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            if (watch.packetIO ? canQueueWrite() : !watch.pollingOut) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void IoUringEventLoop::complete(const struct io_uring_cqe &cqe) {
+        const auto op = static_cast<Op>(cqe.user_data >> 56);
+        const uint64_t payload = cqe.user_data & payloadMask;
+        const bool more = cqe.flags & IORING_CQE_F_MORE;
+
+        switch (op) {
+            case Op::Wake: {
+                uint64_t value;
+                while (read(wakeFD, &value, sizeof(value)) > 0) {
+                }
+                if (!more) {
+                    armWake();
+                }
+                break;
+            }
+            case Op::Timer:
+                if (payload == timerGeneration && timerArmed) {
+                    timerArmed = false;
+                    timerHandler(-1, timerContext);
+                }
+                break;
+            case Op::PollIn: {
+                auto *watch = reinterpret_cast<IoUringWatch*>(static_cast<uintptr_t>(payload));
+                if (!more) {
+                    watch->pollingIn = false;
+                }
+                // Errors and hangups are left for the read to find
+                if (cqe.res > 0 && (cqe.res & (POLLIN | POLLERR | POLLHUP))) {
+                    watch->onReadable(watch->fd, watch->context);
+                }
+                if (!watch->pollingIn) {
+                    armPollIn(*watch);
+                }
+                break;
+            }
+            case Op::PollOut: {
+                auto *watch = reinterpret_cast<IoUringWatch*>(static_cast<uintptr_t>(payload));
+                watch->pollingOut = false;
+                if (cqe.res > 0 && watch->writing.load(std::memory_order_relaxed)) {
+                    watch->onWritable(watch->fd, watch->context);
+                }
+                break;
+            }
+            case Op::Read:
+                if (cqe.flags & IORING_CQE_F_BUFFER) {
+                    const auto bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                    PacketBuf packet = std::move(provided[bid]);
+                    provideBuffer(bid);
+
+                    ringWorks = true;
+                    if (cqe.res > 0) {
+                        packet.put(static_cast<size_t>(cqe.res));
+                        readsThisPass = true;
+                        handlers.onRead(std::move(packet), handlers.context);
+                    }
+                }
+
+                if (!more) {
+                    reading = false;
+                    if ((cqe.res == -ENOBUFS || cqe.res == -EFAULT) && !ringWorks && !legacyBuffers) {
+                        // Every buffer is still ours, so the kernel isn't reading the ring properly. Depending
+                        // on the ring, that comes back as running out of buffers or as a fault on one
+                        HS_LOG("Kernel takes no buffers from the ring, providing them by request");
+                        legacyBuffers = true;
+                        for (size_t bid = 0; bid < provided.size(); ++bid) {
+                            provideBuffer(static_cast<uint16_t>(bid));
+                        }
+                    } else if (cqe.res == -EINVAL && multishotRead) {
+                        HS_LOG("Multishot reads unsupported, falling back to a read per request");
+                        multishotRead = false;
+                    } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -EAGAIN &&
+                               cqe.res != -EINTR && cqe.res != -ECANCELED) {
+                        HS_LOG("Read error from io_uring: %{public}s", strerror(-cqe.res));
+                        readFailed = true;
+                    }
+                }
+                break;
+            case Op::Provide:
+                if (cqe.res < 0) {
+                    HS_LOG("Failed to provide read buffer: %{public}s", strerror(-cqe.res));
+                }
+                break;
+            case Op::Write: {
+                PacketBuf packet = std::move(writesInFlight[payload]);
+                freeWriteSlots.push_back(static_cast<uint32_t>(payload));
+                handlers.onWritten(std::move(packet), cqe.res, handlers.context);
+                break;
+            }
+        }
+    }
+
+    void IoUringEventLoop::run() {
+        while (!stopped.load(std::memory_order_acquire)) {
+            // Announce sleeping before the last look, so a thread turning write interest on either is seen or wakes us
+            bool busy = wantsWrites();
+            if (!busy) {
+                sleeping.store(true);
+                busy = wantsWrites() || stopped.load();
+            }
+            enter(busy ? 0 : 1);
+            sleeping.store(false, std::memory_order_relaxed);
+
+            unsigned head = *cqHead;
+            while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) && !stopped.load(std::memory_order_relaxed)) {
+                // Copied out and consumed first, since handlers may submit and wait again
+                const struct io_uring_cqe cqe = cqes[head & cqMask];
+                head += 1;
+                __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+                complete(cqe);
+            }
+
+            if (readsThisPass) {
+                readsThisPass = false;
+                handlers.onReadsDone(handlers.context);
+            }
+
+            if (packetWatch && !reading && !readFailed) {
+                armRead();
+            }
+
+            for (const std::unique_ptr<Watch> &w : watches) {
+                auto &watch = static_cast<IoUringWatch&>(*w);
+                if (!watch.writing.load(std::memory_order_relaxed)) {
+                    continue;
+                }
+                if (watch.packetIO) {
+                    if (canQueueWrite()) {
+                        watch.onWritable(watch.fd, watch.context);
+                    }
+                } else if (!watch.pollingOut) {
+                    armPollOut(watch);
+                }
+            }
+        }
+    }
+
+    void IoUringEventLoop::stop() {
+        stopped.store(true, std::memory_order_release);
+
+        uint64_t one = 1;
+        if (write(wakeFD, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            HS_LOG("Failed to wake io_uring loop: %{public}s", strerror(errno));
+        }
+    }
+}
+
+#endif
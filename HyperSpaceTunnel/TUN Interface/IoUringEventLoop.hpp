@@ -0,0 +1,198 @@
+//
+//  IoUringEventLoop.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <linux/io_uring.h>
+
+#include "EventLoop.hpp"
+#include "PacketBuf.hpp"
+#include "PacketBufferPool.hpp"
+
+namespace hs {
+    /**
+     * An EventLoop on an io_uring, driven with raw syscalls. Watches are
+     * multishot polls, the timer is a timeout request and stop() rings
+     * an eventfd the ring polls, so it can stand in for the epoll loop.
+     *
+     * Its point is startPacketIO(), which moves one fd off readiness and
+     * onto completions. A multishot read keeps that fd read into a ring
+     * of provided buffers until they run out, handing each packet over
+     * as it lands, and writes are queued as requests that go in together
+     * at the next pass of the loop, from buffers registered with the
+     * kernel when they come from a pool slab it has been told about. A
+     * busy fd then costs one io_uring_enter per pass rather than a read
+     * or write per packet.
+     *
+     * The ring is set up single issuer, so only the loop thread submits.
+     * Other threads turning write interest on only flag it, and ring the
+     * eventfd if the loop is asleep.
+     */
+    class IoUringEventLoop final : public EventLoop {
+    public:
+        struct PacketHandlers {
+            // A packet read into a provided buffer, which is now the handler's
+            void (*onRead)(PacketBuf &&packet, void *context) = nullptr;
+            // Every read completion from one pass of the loop has been handed over
+            void (*onReadsDone)(void *context) = nullptr;
+            // A write finished, with the byte count or -errno write would have given
+            void (*onWritten)(PacketBuf &&packet, int result, void *context) = nullptr;
+            // Called each pass while write interest is on and there's room to queue writes
+            Handler onWritable = nullptr;
+            void *context = nullptr;
+        };
+
+        static std::unique_ptr<IoUringEventLoop> create(unsigned entries = 256);
+        ~IoUringEventLoop() override;
+
+        bool add(int fd, Handler onReadable, Handler onWritable, void *context) override;
+        void remove(int fd) override;
+        void scheduleTimer(std::chrono::nanoseconds delay, Handler onTimer, void *context) override;
+        void run() override;
+        void stop() override;
+        const char *name() const override { return "io_uring"; }
+
+        /**
+         * Starts reading fd into bufferCount buffers from readPool, and
+         * takes writes to it with queueWrite(). Write interest on fd works
+         * as with add(), except that onWritable is called whenever there's
+         * room rather than when the fd polls writable, since the write
+         * requests wait in the kernel for that instead.
+         *
+         * Buffers in the slabs of writePools are registered as they're
+         * allocated, so writes from them skip mapping the pages in each
+         * time. Loop thread, or before run().
+         */
+        bool startPacketIO(int fd,
+                           PacketBufferPool &readPool,
+                           size_t bufferCount,
+                           std::vector<PacketBufferPool*> writePools,
+                           const PacketHandlers &handlers);
+
+        // Whether queueWrite() would take another packet now
+        bool canQueueWrite() const { return !freeWriteSlots.empty(); }
+
+        /**
+         * Queues a write of packet to the packet fd, which goes to the
+         * kernel at the end of this pass and comes back to onWritten.
+         * Loop thread only, and only while canQueueWrite().
+         */
+        void queueWrite(PacketBuf &&packet);
+
+    protected:
+        void updateWriteInterest(Watch &watch, bool enabled) override;
+
+    private:
+        IoUringEventLoop(int ringFD, int wakeFD);
+
+        bool mapRings(const struct io_uring_params &params);
+
+        struct IoUringWatch : Watch {
+            bool packetIO = false;
+            bool pollingIn = false;
+            bool pollingOut = false;
+        };
+
+        // What a completion is for, in the top byte of its user_data
+        enum class Op : uint8_t {
+            Wake = 1,
+            Timer,
+            PollIn,
+            PollOut,
+            Read,
+            Write,
+            Provide
+        };
+
+        struct io_uring_sqe *nextSqe();
+        // Hands the kernel what's queued and waits for at least minComplete completions
+        void enter(unsigned minComplete);
+        void complete(const struct io_uring_cqe &cqe);
+
+        void armWake();
+        void armPollIn(IoUringWatch &watch);
+        void armPollOut(IoUringWatch &watch);
+        void armRead();
+        void provideBuffer(uint16_t bid);
+        void registerWriteBuffers();
+        // The registered buffer slot holding [data, data + length), or -1
+        int fixedBufferIndex(const uint8_t *data, size_t length);
+        // Whether a watch wants onWritable or a writability poll this pass, so the loop mustn't sleep
+        bool wantsWrites() const;
+
+        static constexpr size_t maxRegisteredRegions = 256;
+
+        int ringFD;
+        int wakeFD;
+        std::atomic<bool> stopped = false;
+        std::atomic<bool> sleeping = false;
+
+        // The mapped submission and completion rings
+        void *sqRing = nullptr;
+        size_t sqRingSize = 0;
+        void *cqRing = nullptr;
+        size_t cqRingSize = 0;
+        struct io_uring_sqe *sqes = nullptr;
+        size_t sqesSize = 0;
+        unsigned *sqHead = nullptr;
+        unsigned *sqTail = nullptr;
+        unsigned sqMask = 0;
+        unsigned sqEntries = 0;
+        unsigned sqLocalTail = 0;
+        unsigned *cqHead = nullptr;
+        unsigned *cqTail = nullptr;
+        unsigned cqMask = 0;
+        struct io_uring_cqe *cqes = nullptr;
+
+        // The timeout request in flight carries the generation it was armed for, so a replaced one is ignored
+        struct __kernel_timespec timerSpec = {};
+        uint64_t timerGeneration = 0;
+
+        // Packet I/O, all loop thread
+        IoUringWatch *packetWatch = nullptr;
+        PacketHandlers handlers;
+        PacketBufferPool *readPool = nullptr;
+        struct io_uring_buf_ring *bufferRing = nullptr;
+        size_t bufferRingSize = 0;
+        unsigned bufferMask = 0;
+        uint16_t bufferTail = 0;
+        std::vector<PacketBuf> provided;
+        bool multishotRead = true;
+        // Set once a read has taken a buffer from the ring. Until then running dry means the kernel
+        // won't use it, and buffers go to it one request at a time instead
+        bool ringWorks = false;
+        bool legacyBuffers = false;
+        bool reading = false;
+        bool readFailed = false;
+        bool readsThisPass = false;
+
+        std::vector<PacketBuf> writesInFlight;
+        std::vector<uint32_t> freeWriteSlots;
+
+        // Registered buffer slots in use, each a pool slab, sorted by base for lookup
+        struct Registered {
+            const uint8_t *base;
+            size_t length;
+            unsigned index;
+        };
+        std::vector<PacketBufferPool*> writePools;
+        std::vector<size_t> writePoolSlabs;
+        std::vector<Registered> registered;
+        bool fixedBuffers = false;
+    };
+}
+
+#endif
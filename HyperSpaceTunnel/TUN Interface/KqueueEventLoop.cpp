@@ -0,0 +1,142 @@
+//
+//  KqueueEventLoop.cpp
+//  HyperSpaceTunnel
+//
+
+#include "KqueueEventLoop.hpp"
+
+#if defined(__APPLE__) || defined(__FreeBSD__)
+
+#include "TUNLog.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace hs {
+
+    std::unique_ptr<KqueueEventLoop> KqueueEventLoop::create() {
+        int kqueueFD = kqueue();
+        if (kqueueFD < 0) {
+            HS_LOG("Failed to create kqueue: %{public}s", strerror(errno));
+            return nullptr;
+        }
+
+        struct kevent wake;
+        EV_SET(&wake, wakeIdent, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, nullptr);
+        if (kevent(kqueueFD, &wake, 1, nullptr, 0, nullptr) < 0) {
+            HS_LOG("Failed to add kqueue wake event: %{public}s", strerror(errno));
+            ::close(kqueueFD);
+            return nullptr;
+        }
+
+        return std::unique_ptr<KqueueEventLoop>(new KqueueEventLoop(kqueueFD));
+    }
+
+    KqueueEventLoop::KqueueEventLoop(int kqueueFD)
+        : kqueueFD(kqueueFD) {
+    }
+
+    KqueueEventLoop::~KqueueEventLoop() {
+        ::close(kqueueFD);
+    }
+
+    bool KqueueEventLoop::add(int fd, Handler onReadable, Handler onWritable, void *context) {
+        auto watch = std::make_unique<Watch>();
+        watch->fd = fd;
+        watch->onReadable = onReadable;
+        watch->onWritable = onWritable;
+        watch->context = context;
+
+        // The write filter is registered disabled, and enabled with write interest
+        struct kevent changes[2];
+        EV_SET(&changes[0], fd, EVFILT_READ, EV_ADD, 0, 0, watch.get());
+        EV_SET(&changes[1], fd, EVFILT_WRITE, EV_ADD | EV_DISABLE, 0, 0, watch.get());
+        if (kevent(kqueueFD, changes, 2, nullptr, 0, nullptr) < 0) {
+            HS_LOG("Failed to add fd %d to kqueue: %{public}s", fd, strerror(errno));
+            return false;
+        }
+
+        watches.push_back(std::move(watch));
+        return true;
+    }
+
+    void KqueueEventLoop::remove(int fd) {
+        struct kevent changes[2];
+        EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+        EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+        kevent(kqueueFD, changes, 2, nullptr, 0, nullptr);
+        erase(fd);
+    }
+
+    void KqueueEventLoop::updateWriteInterest(Watch &watch, bool enabled) {
+        struct kevent change;
+        EV_SET(&change, watch.fd, EVFILT_WRITE, enabled ? EV_ENABLE : EV_DISABLE, 0, 0, &watch);
+        kevent(kqueueFD, &change, 1, nullptr, 0, nullptr);
+    }
+
+    void KqueueEventLoop::scheduleTimer(std::chrono::nanoseconds delay, Handler onTimer, void *context) {
+        timerHandler = onTimer;
+        timerContext = context;
+        timerArmed = true;
+
+        // Re-adding the same ident replaces a pending timer
+        struct kevent change;
+        EV_SET(&change, timerIdent, EVFILT_TIMER, EV_ADD | EV_ONESHOT, NOTE_NSECONDS,
+               delay.count() > 0 ? delay.count() : 0, nullptr);
+        kevent(kqueueFD, &change, 1, nullptr, 0, nullptr);
+    }
+
+    void KqueueEventLoop::run() {
+        struct kevent events[maxEvents];
+
+        while (!stopped.load(std::memory_order_acquire)) {
+            int count = kevent(kqueueFD, nullptr, 0, events, maxEvents, nullptr);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                HS_LOG("kevent failed: %{public}s", strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < count && !stopped.load(std::memory_order_relaxed); ++i) {
+                const struct kevent &event = events[i];
+
+                if (event.filter == EVFILT_USER) {
+                    continue;
+                }
+
+                if (event.filter == EVFILT_TIMER) {
+                    if (timerArmed) {
+                        timerArmed = false;
+                        timerHandler(-1, timerContext);
+                    }
+                    continue;
+                }
+
+                auto *watch = static_cast<Watch*>(event.udata);
+
+                // EOF and errors are left for the read to find
+                if (event.filter == EVFILT_READ) {
+                    watch->onReadable(watch->fd, watch->context);
+                } else if (event.filter == EVFILT_WRITE && watch->writing.load(std::memory_order_relaxed)) {
+                    watch->onWritable(watch->fd, watch->context);
+                }
+            }
+        }
+    }
+
+    void KqueueEventLoop::stop() {
+        stopped.store(true, std::memory_order_release);
+
+        struct kevent trigger;
+        EV_SET(&trigger, wakeIdent, EVFILT_USER, 0, NOTE_TRIGGER, 0, nullptr);
+        kevent(kqueueFD, &trigger, 1, nullptr, 0, nullptr);
+    }
+}
+
+#endif
@@ -0,0 +1,55 @@
+//
+//  KqueueEventLoop.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#if defined(__APPLE__) || defined(__FreeBSD__)
+
+#include <atomic>
+#include <memory>
+
+#include "EventLoop.hpp"
+
+namespace hs {
+    /**
+     * An EventLoop straight on kqueue. Each fd has a read filter and a
+     * write filter that's enabled and disabled with write interest; the
+     * timer is an EVFILT_TIMER and stop() triggers an EVFILT_USER event.
+     * kevent is safe from any thread, so changing write interest needs no
+     * lock of the loop's own.
+     */
+    class KqueueEventLoop final : public EventLoop {
+    public:
+        static std::unique_ptr<KqueueEventLoop> create();
+        ~KqueueEventLoop() override;
+
+        bool add(int fd, Handler onReadable, Handler onWritable, void *context) override;
+        void remove(int fd) override;
+        void scheduleTimer(std::chrono::nanoseconds delay, Handler onTimer, void *context) override;
+        void run() override;
+        void stop() override;
+        const char *name() const override { return "kqueue"; }
+
+    protected:
+        void updateWriteInterest(Watch &watch, bool enabled) override;
+
+    private:
+        explicit KqueueEventLoop(int kqueueFD);
+
+        static constexpr size_t maxEvents = 64;
+        static constexpr uintptr_t timerIdent = 1;
+        static constexpr uintptr_t wakeIdent = 2;
+
+        int kqueueFD;
+        std::atomic<bool> stopped = false;
+    };
+}
+
+#endif
@@ -0,0 +1,148 @@
+//
+//  LibEventLoop.cpp
+//  HyperSpaceTunnel
+//
+
+#include "LibEventLoop.hpp"
+#include "TUNLog.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <event2/thread.h>
+
+namespace hs {
+
+    std::unique_ptr<LibEventLoop> LibEventLoop::create() {
+        evthread_use_pthreads();
+
+        struct event_base *base = event_base_new();
+        if (!base) {
+            HS_LOG("Failed to create event base, %{public}s: ", strerror(errno));
+            return nullptr;
+        }
+
+        // Activated by stop(), it breaks the loop from inside, where a break can't be lost
+        struct event *wakeEvent = event_new(base, -1, 0, LibEventLoop::onWake, base);
+        if (!wakeEvent) {
+            HS_LOG("Failed to create wake event, %{public}s: ", strerror(errno));
+            event_base_free(base);
+            return nullptr;
+        }
+
+        return std::unique_ptr<LibEventLoop>(new LibEventLoop(base, wakeEvent));
+    }
+
+    LibEventLoop::LibEventLoop(struct event_base *base, struct event *wakeEvent)
+        : base(base)
+        , wakeEvent(wakeEvent) {
+    }
+
+    LibEventLoop::~LibEventLoop() {
+        // Events have to go before their base
+        watches.clear();
+
+        if (timerEvent) {
+            event_free(timerEvent);
+            timerEvent = nullptr;
+        }
+
+        event_free(wakeEvent);
+        event_base_free(base);
+    }
+
+    LibEventLoop::LibEventWatch::~LibEventWatch() {
+        if (readEvent) {
+            event_free(readEvent);
+        }
+        if (writeEvent) {
+            event_free(writeEvent);
+        }
+    }
+
+    bool LibEventLoop::add(int fd, Handler onReadable, Handler onWritable, void *context) {
+        auto watch = std::make_unique<LibEventWatch>();
+        watch->fd = fd;
+        watch->onReadable = onReadable;
+        watch->onWritable = onWritable;
+        watch->context = context;
+
+        watch->readEvent = event_new(base, fd, EV_READ | EV_PERSIST, LibEventLoop::onReadable, watch.get());
+        if (!watch->readEvent) {
+            HS_LOG("Failed to create read event, %{public}s: ", strerror(errno));
+            return false;
+        }
+
+        // Added and deleted as write interest changes
+        watch->writeEvent = event_new(base, fd, EV_WRITE | EV_PERSIST, LibEventLoop::onWritable, watch.get());
+        if (!watch->writeEvent) {
+            HS_LOG("Failed to create write event, %{public}s: ", strerror(errno));
+            return false;
+        }
+
+        event_add(watch->readEvent, nullptr);
+        watches.push_back(std::move(watch));
+        return true;
+    }
+
+    void LibEventLoop::remove(int fd) {
+        erase(fd);
+    }
+
+    void LibEventLoop::updateWriteInterest(Watch &watch, bool enabled) {
+        auto &w = static_cast<LibEventWatch&>(watch);
+        if (enabled) {
+            event_add(w.writeEvent, nullptr);
+        } else {
+            event_del(w.writeEvent);
+        }
+    }
+
+    void LibEventLoop::scheduleTimer(std::chrono::nanoseconds delay, Handler onTimer, void *context) {
+        if (!timerEvent) {
+            timerEvent = evtimer_new(base, LibEventLoop::onTimer, this);
+            if (!timerEvent) {
+                HS_LOG("Failed to create timer event, %{public}s: ", strerror(errno));
+                return;
+            }
+        }
+
+        timerHandler = onTimer;
+        timerContext = context;
+        timerArmed = true;
+
+        const uint64_t nanos = delay.count() > 0 ? static_cast<uint64_t>(delay.count()) : 0;
+        struct timeval timeout;
+        timeout.tv_sec = static_cast<time_t>(nanos / 1000000000);
+        timeout.tv_usec = static_cast<suseconds_t>((nanos % 1000000000) / 1000);
+        evtimer_add(timerEvent, &timeout);
+    }
+
+    void LibEventLoop::run() {
+        event_base_dispatch(base);
+    }
+
+    void LibEventLoop::stop() {
+        // event_base_loopbreak() before the loop starts is forgotten once it does, an active event isn't
+        event_active(wakeEvent, 0, 0);
+    }
+
+    void LibEventLoop::onWake(evutil_socket_t, short, void *arg) {
+        event_base_loopbreak(static_cast<struct event_base*>(arg));
+    }
+
+    void LibEventLoop::onReadable(evutil_socket_t fd, short, void *arg) {
+        auto *watch = static_cast<LibEventWatch*>(arg);
+        watch->onReadable(fd, watch->context);
+    }
+
+    void LibEventLoop::onWritable(evutil_socket_t fd, short, void *arg) {
+        auto *watch = static_cast<LibEventWatch*>(arg);
+        watch->onWritable(fd, watch->context);
+    }
+
+    void LibEventLoop::onTimer(evutil_socket_t, short, void *arg) {
+        auto *loop = static_cast<LibEventLoop*>(arg);
+        loop->timerArmed = false;
+        loop->timerHandler(-1, loop->timerContext);
+    }
+}
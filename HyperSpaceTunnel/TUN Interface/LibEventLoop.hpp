@@ -0,0 +1,59 @@
+//
+//  LibEventLoop.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <memory>
+
+#include <event2/event.h>
+
+#include "EventLoop.hpp"
+
+namespace hs {
+    /**
+     * An EventLoop on a libevent event_base. libevent's pthread locking is
+     * turned on, since stop() activates the wake event from another thread,
+     * so every event pays for a lock.
+     */
+    class LibEventLoop final : public EventLoop {
+    public:
+        static std::unique_ptr<LibEventLoop> create();
+        ~LibEventLoop() override;
+
+        bool add(int fd, Handler onReadable, Handler onWritable, void *context) override;
+        void remove(int fd) override;
+        void scheduleTimer(std::chrono::nanoseconds delay, Handler onTimer, void *context) override;
+        void run() override;
+        void stop() override;
+        const char *name() const override { return "libevent"; }
+
+    protected:
+        void updateWriteInterest(Watch &watch, bool enabled) override;
+
+    private:
+        struct LibEventWatch final : Watch {
+            ~LibEventWatch() override;
+
+            struct event *readEvent = nullptr;
+            struct event *writeEvent = nullptr;
+        };
+
+        LibEventLoop(struct event_base *base, struct event *wakeEvent);
+
+        static void onReadable(evutil_socket_t fd, short events, void *arg);
+        static void onWritable(evutil_socket_t fd, short events, void *arg);
+        static void onTimer(evutil_socket_t fd, short events, void *arg);
+        static void onWake(evutil_socket_t fd, short events, void *arg);
+
+        struct event_base *base;
+        struct event *wakeEvent;
+        struct event *timerEvent = nullptr;
+    };
+}
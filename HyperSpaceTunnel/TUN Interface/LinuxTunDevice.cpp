@@ -0,0 +1,134 @@
+//
+//  LinuxTunDevice.cpp
+//  HyperSpaceTunnel
+//
+
+#include "LinuxTunDevice.hpp"
+
+#if defined(__linux__)
+
+#include "Offload.hpp"
+#include "TUNLog.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace hs {
+
+    std::unique_ptr<LinuxTunDevice> LinuxTunDevice::open(const std::string &name,
+                                                         const LinuxTunOptions &options) {
+        return openQueue(name, options, false);
+    }
+
+    std::vector<std::unique_ptr<LinuxTunDevice>> LinuxTunDevice::openMultiQueue(const std::string &name,
+                                                                               size_t queueCount,
+                                                                               const LinuxTunOptions &options) {
+        std::vector<std::unique_ptr<LinuxTunDevice>> queues;
+
+        // Every queue after the first attaches to the interface the first one created
+        std::string interfaceName = name;
+        for (size_t i = 0; i < queueCount; ++i) {
+            std::unique_ptr<LinuxTunDevice> queue = openQueue(interfaceName, options, true);
+            if (!queue) {
+                queues.clear();
+                break;
+            }
+            interfaceName = queue->name();
+            queues.push_back(std::move(queue));
+        }
+
+        return queues;
+    }
+
+    std::unique_ptr<LinuxTunDevice> LinuxTunDevice::openQueue(const std::string &name,
+                                                              const LinuxTunOptions &options,
+                                                              bool multiQueue) {
+        int fd = ::open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            HS_LOG("Failed to open /dev/net/tun: %{public}s", strerror(errno));
+            return nullptr;
+        }
+
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+        if (multiQueue) {
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+        }
+        if (options.virtioNetHeader) {
+            ifr.ifr_flags |= IFF_VNET_HDR;
+        }
+        strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+            HS_LOG("TUNSETIFF failed for %{public}s: %{public}s", name.c_str(), strerror(errno));
+            ::close(fd);
+            return nullptr;
+        }
+
+        bool udpSegmentation = false;
+        if (options.virtioNetHeader) {
+            int headerSize = sizeof(offload::VirtioNetHeader);
+            if (ioctl(fd, TUNSETVNETHDRSZ, &headerSize) < 0) {
+                HS_LOG("TUNSETVNETHDRSZ failed: %{public}s", strerror(errno));
+                ::close(fd);
+                return nullptr;
+            }
+
+            // Without these the kernel still uses the header, but only ever sends MTU-sized packets
+            unsigned int offloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+#if defined(TUN_F_USO4) && defined(TUN_F_USO6)
+            // Older kernels refuse the whole set if it has UDP, so it's asked for first and dropped if refused
+            udpSegmentation = ioctl(fd, TUNSETOFFLOAD, offloads | TUN_F_USO4 | TUN_F_USO6) == 0;
+#endif
+            if (!udpSegmentation && ioctl(fd, TUNSETOFFLOAD, offloads) < 0) {
+                HS_LOG("TUNSETOFFLOAD failed, continuing without segmentation offload: %{public}s", strerror(errno));
+            }
+        }
+
+        std::unique_ptr<LinuxTunDevice> device(new LinuxTunDevice(fd, ifr.ifr_name, options));
+        device->udpSegmentation = udpSegmentation;
+        return device;
+    }
+
+    LinuxTunDevice::LinuxTunDevice(int fd, std::string name, const LinuxTunOptions &options)
+        : tunFD(fd)
+        , interfaceName(std::move(name))
+        , options(options) {
+    }
+
+    size_t LinuxTunDevice::headerLength() const {
+        return options.virtioNetHeader ? sizeof(offload::VirtioNetHeader) : 0;
+    }
+
+    void LinuxTunDevice::writeHeader(PacketBuf &packet, uint8_t *header) const {
+        if (options.virtioNetHeader) {
+            offload::writeVirtioHeader(packet, header);
+        }
+    }
+
+    bool LinuxTunDevice::readHeader(PacketBuf &packet) const {
+        if (options.virtioNetHeader) {
+            return offload::readVirtioHeader(packet);
+        }
+        return true;
+    }
+
+    LinuxTunDevice::~LinuxTunDevice() {
+        close();
+    }
+
+    void LinuxTunDevice::close() {
+        if (tunFD >= 0) {
+            ::close(tunFD);
+            tunFD = -1;
+        }
+    }
+}
+
+#endif
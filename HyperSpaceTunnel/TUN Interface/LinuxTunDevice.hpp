@@ -0,0 +1,85 @@
+//
+//  LinuxTunDevice.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TunDevice.hpp"
+
+namespace hs {
+    struct LinuxTunOptions {
+        /**
+         * Opens the device with IFF_VNET_HDR and turns on checksum and TCP
+         * segmentation offload, so the kernel passes whole 64 KB TCP
+         * super-packets in both directions instead of MTU-sized ones, and
+         * UDP segmentation offload where the kernel has it.
+         */
+        bool virtioNetHeader = false;
+    };
+
+    /**
+     * A Linux TUN interface opened from /dev/net/tun with IFF_TUN and
+     * IFF_NO_PI, so the fd carries bare IP packets with no header, or just
+     * a virtio-net header in offload mode.
+     *
+     * Bringing the interface up and addressing it is left to the caller,
+     * for example with ip(8), as is CAP_NET_ADMIN.
+     */
+    class LinuxTunDevice final : public TunDevice {
+    public:
+        // An empty name lets the kernel pick one. Returns nullptr on failure
+        static std::unique_ptr<LinuxTunDevice> open(const std::string &name = "",
+                                                    const LinuxTunOptions &options = LinuxTunOptions());
+
+        /**
+         * Opens queueCount queues of one IFF_MULTI_QUEUE interface. The
+         * kernel spreads the packets it routes to the interface across the
+         * queues by flow. Returns an empty vector on failure.
+         */
+        static std::vector<std::unique_ptr<LinuxTunDevice>> openMultiQueue(const std::string &name,
+                                                                           size_t queueCount,
+                                                                           const LinuxTunOptions &options = LinuxTunOptions());
+        ~LinuxTunDevice() override;
+
+        LinuxTunDevice(const LinuxTunDevice&) = delete;
+        LinuxTunDevice& operator=(const LinuxTunDevice&) = delete;
+
+        int fd() const override { return tunFD; }
+        size_t headerLength() const override;
+        void writeHeader(PacketBuf &packet, uint8_t *header) const override;
+        bool readHeader(PacketBuf &packet) const override;
+        bool segmentsLargePackets() const override { return options.virtioNetHeader; }
+        bool segmentsUDPPackets() const override { return udpSegmentation; }
+        void close() override;
+
+        // The interface name the kernel assigned
+        const std::string &name() const { return interfaceName; }
+
+    private:
+        LinuxTunDevice(int fd, std::string name, const LinuxTunOptions &options);
+
+        static std::unique_ptr<LinuxTunDevice> openQueue(const std::string &name,
+                                                         const LinuxTunOptions &options,
+                                                         bool multiQueue);
+
+        int tunFD;
+        std::string interfaceName;
+        LinuxTunOptions options;
+        // Whether the kernel took UDP segmentation offload, which needs Linux 6.2
+        bool udpSegmentation = false;
+    };
+}
+
+#endif
@@ -0,0 +1,163 @@
+//
+//  MultiQueueTUNInterface.cpp
+//  HyperSpaceTunnel
+//
+
+#include "MultiQueueTUNInterface.hpp"
+
+#include <random>
+
+namespace hs {
+
+    MultiQueueTUNInterface::MultiQueueTUNInterface(std::vector<std::unique_ptr<TunDevice>> devices,
+                                                   WriteQueueConfig writeQueueConfig)
+        : perturbation(std::random_device()()) {
+        queues.reserve(devices.size());
+        for (std::unique_ptr<TunDevice> &device : devices) {
+            queues.push_back(std::make_unique<TUNInterface>(std::move(device), writeQueueConfig));
+        }
+    }
+
+    void MultiQueueTUNInterface::start() {
+        for (std::unique_ptr<TUNInterface> &queue : queues) {
+            queue->start();
+        }
+    }
+
+    void MultiQueueTUNInterface::stop() {
+        for (std::unique_ptr<TUNInterface> &queue : queues) {
+            queue->stop();
+        }
+    }
+
+    void MultiQueueTUNInterface::setOutgoingPacketCallBack(TUNInterface::OutgoingPacketCallBack callBack) {
+        for (std::unique_ptr<TUNInterface> &queue : queues) {
+            queue->setOutgoingPacketCallBack(callBack);
+        }
+    }
+
+    void MultiQueueTUNInterface::setPacketSink(std::shared_ptr<PacketSink> packetSink) {
+        for (std::unique_ptr<TUNInterface> &queue : queues) {
+            queue->setPacketSink(packetSink);
+        }
+    }
+
+    void MultiQueueTUNInterface::setEventLoopBackend(EventLoopBackend backend) {
+        for (std::unique_ptr<TUNInterface> &queue : queues) {
+            queue->setEventLoopBackend(backend);
+        }
+    }
+
+    void MultiQueueTUNInterface::setGRO(const GROConfig &config) {
+        // Each queue's thread gets its own table
+        for (std::unique_ptr<TUNInterface> &queue : queues) {
+            queue->setGRO(config);
+        }
+    }
+
+    void MultiQueueTUNInterface::setBusyPoll(const BusyPollConfig &config) {
+        // Each queue's thread spins, and adapts, on its own
+        for (std::unique_ptr<TUNInterface> &queue : queues) {
+            queue->setBusyPoll(config);
+        }
+    }
+
+    void MultiQueueTUNInterface::setBackpressure(const BackpressureConfig &config, std::function<void(bool paused)> callBack) {
+        backpressureCallBack = std::move(callBack);
+        
+        // One thread feeds every queue, so it waits for the slowest
+        for (std::unique_ptr<TUNInterface> &queue : queues) {
+            queue->setBackpressure(config, [this](bool paused) {
+                std::lock_guard<std::mutex> lock(backpressureMutex);
+                if ((paused ? pausedQueues++ == 0 : --pausedQueues == 0) && backpressureCallBack) {
+                    backpressureCallBack(paused);
+                }
+            });
+        }
+    }
+
+    size_t MultiQueueTUNInterface::queueFor(const uint8_t *packet, size_t length) const {
+        if (queues.size() == 1) {
+            return 0;
+        }
+        return FQCoDelScheduler::flowHash(packet, length, perturbation) % queues.size();
+    }
+
+    void MultiQueueTUNInterface::enqueueWrite(const uint8_t *data, size_t length) {
+        if (length == 0 || queues.empty()) return;
+
+        queues[queueFor(data, length)]->enqueueWrite(data, length);
+    }
+
+    void MultiQueueTUNInterface::enqueueWrite(PacketBuf &&packet) {
+        if (packet.empty() || queues.empty()) return;
+
+        const size_t index = queueFor(packet.data(), packet.size());
+        queues[index]->enqueueWrite(std::move(packet));
+    }
+
+    void MultiQueueTUNInterface::enqueueWrite(PacketBuf &&packet, size_t segmentSize) {
+        if (packet.empty() || queues.empty()) return;
+
+        const size_t index = queueFor(packet.data(), packet.size());
+        queues[index]->enqueueWrite(std::move(packet), segmentSize);
+    }
+
+    WriteQueueStats MultiQueueTUNInterface::writeQueueStats() const {
+        WriteQueueStats total;
+        LatencyHistogram::Counts latency = {};
+        for (const std::unique_ptr<TUNInterface> &queue : queues) {
+            WriteQueueStats s = queue->writeQueueStats();
+            queue->writeQueueCounters.writeLatency.addTo(latency);
+            total.enqueued += s.enqueued;
+            total.written += s.written;
+            total.writeErrors += s.writeErrors;
+            total.droppedTail += s.droppedTail;
+            total.droppedBudget += s.droppedBudget;
+            total.droppedHead += s.droppedHead;
+            total.droppedAQM += s.droppedAQM;
+            total.segmentedPackets += s.segmentedPackets;
+            total.segmentsCreated += s.segmentsCreated;
+            total.queuedPackets += s.queuedPackets;
+            total.queuedBytes += s.queuedBytes;
+            total.highWaterPackets += s.highWaterPackets;
+            total.highWaterBytes += s.highWaterBytes;
+            total.ingressPauses += s.ingressPauses;
+            total.wakeups += s.wakeups;
+        }
+        total.writeLatencyP50 = LatencyHistogram::percentile(latency, 0.50);
+        total.writeLatencyP99 = LatencyHistogram::percentile(latency, 0.99);
+        return total;
+    }
+
+    BusyPollStats MultiQueueTUNInterface::busyPollStats() const {
+        BusyPollStats total;
+        for (const std::unique_ptr<TUNInterface> &queue : queues) {
+            BusyPollStats s = queue->busyPollStats();
+            total.spins += s.spins;
+            total.productiveSpins += s.productiveSpins;
+            total.switchesToBlocking += s.switchesToBlocking;
+            total.switchesToSpinning += s.switchesToSpinning;
+            total.spinning = total.spinning || s.spinning;
+        }
+        return total;
+    }
+
+    ReadStats MultiQueueTUNInterface::readStats() const {
+        ReadStats total;
+        for (const std::unique_ptr<TUNInterface> &queue : queues) {
+            ReadStats s = queue->readStats();
+            total.readEvents += s.readEvents;
+            total.packetsRead += s.packetsRead;
+            total.bytesRead += s.bytesRead;
+            total.largePackets += s.largePackets;
+            total.truncatedPackets += s.truncatedPackets;
+            total.badHeaders += s.badHeaders;
+            total.superPackets += s.superPackets;
+            total.softwareSegments += s.softwareSegments;
+            total.groMerged += s.groMerged;
+            total.groPackets += s.groPackets;
+        }
+        return total;
+    }
+}
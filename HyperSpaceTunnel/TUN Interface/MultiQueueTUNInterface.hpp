@@ -0,0 +1,81 @@
+//
+//  MultiQueueTUNInterface.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "TUNInterface.hpp"
+
+namespace hs {
+    /**
+     * One TUNInterface per queue of a multi-queue TUN device, each with its
+     * own thread and event loop, so tunnel traffic can use as many cores as
+     * there are queues.
+     *
+     * The kernel already spreads the packets it routes into the device
+     * across the queues. Packets injected here are steered the same way, by
+     * a hash of their 5-tuple, so a flow always goes through one queue and
+     * stays in order. Each queue's write ring is single producer, so
+     * enqueueWrite must still be called from one thread, and never from
+     * one of the queues' own threads.
+     */
+    class MultiQueueTUNInterface final {
+    public:
+        explicit MultiQueueTUNInterface(std::vector<std::unique_ptr<TunDevice>> queues,
+                                        WriteQueueConfig writeQueueConfig = WriteQueueConfig());
+
+        MultiQueueTUNInterface(const MultiQueueTUNInterface&) = delete;
+        MultiQueueTUNInterface& operator=(const MultiQueueTUNInterface&) = delete;
+
+        void start();
+        void stop();
+
+        // Applies to every queue. Call backs and sinks run on each queue's own thread
+        void setOutgoingPacketCallBack(TUNInterface::OutgoingPacketCallBack callBack);
+        void setPacketSink(std::shared_ptr<PacketSink> packetSink);
+        // Must be called before start()
+        void setGRO(const GROConfig &config);
+        void setEventLoopBackend(EventLoopBackend backend);
+        void setBusyPoll(const BusyPollConfig &config);
+        // Each queue has the watermarks. callBack is told to pause while any queue is over its high one
+        void setBackpressure(const BackpressureConfig &config, std::function<void(bool paused)> callBack);
+
+        void enqueueWrite(const uint8_t *data, size_t length);
+        void enqueueWrite(PacketBuf &&packet);
+        // A super-packet of segmentSize byte segments, see TUNInterface::enqueueWrite
+        void enqueueWrite(PacketBuf &&packet, size_t segmentSize);
+
+        size_t queueCount() const { return queues.size(); }
+        TUNInterface &queue(size_t index) { return *queues[index]; }
+
+        // Sums across queues. The high water marks are the sums of each queue's own,
+        // and the latency percentiles are over every queue's writes together
+        WriteQueueStats writeQueueStats() const;
+        ReadStats readStats() const;
+        // Spinning is whether any queue is
+        BusyPollStats busyPollStats() const;
+
+    private:
+        size_t queueFor(const uint8_t *packet, size_t length) const;
+
+        std::vector<std::unique_ptr<TUNInterface>> queues;
+        uint32_t perturbation;
+
+        // Queues over their high watermark, counted as their call backs come in from their own threads
+        std::mutex backpressureMutex;
+        size_t pausedQueues = 0;
+        std::function<void(bool paused)> backpressureCallBack;
+    };
+}
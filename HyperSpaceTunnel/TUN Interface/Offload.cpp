@@ -0,0 +1,360 @@
+//
+//  Offload.cpp
+//  HyperSpaceTunnel
+//
+
+#include "Offload.hpp"
+#include "Checksum.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace hs::offload {
+
+    static constexpr uint8_t protocolTCP = 6;
+    static constexpr uint8_t protocolUDP = 17;
+
+    static uint16_t read16(const uint8_t *p) {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    static void write16(uint8_t *p, uint16_t value) {
+        p[0] = static_cast<uint8_t>(value >> 8);
+        p[1] = static_cast<uint8_t>(value);
+    }
+
+    static uint32_t read32(const uint8_t *p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+               (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    static void write32(uint8_t *p, uint32_t value) {
+        p[0] = static_cast<uint8_t>(value >> 24);
+        p[1] = static_cast<uint8_t>(value >> 16);
+        p[2] = static_cast<uint8_t>(value >> 8);
+        p[3] = static_cast<uint8_t>(value);
+    }
+
+    uint32_t pseudoHeaderSum(const uint8_t *ip, uint8_t protocol, size_t transportLength) {
+        uint32_t sum = 0;
+
+        if ((ip[0] >> 4) == 4) {
+            sum = checksum::add(ip + 12, 8, 0);
+        } else {
+            sum = checksum::add(ip + 8, 32, 0);
+            sum += static_cast<uint32_t>(transportLength >> 16);
+        }
+
+        sum += protocol;
+        sum += static_cast<uint32_t>(transportLength & 0xFFFF);
+        return sum;
+    }
+
+    // Where the transport header starts, preferring what the kernel told us
+    static size_t transportOffset(const PacketBuf &packet) {
+        if (packet.offload().checksumPartial) {
+            return packet.checksumStart();
+        }
+        const uint8_t *ip = packet.data();
+        return (ip[0] >> 4) == 4 ? static_cast<size_t>(ip[0] & 0x0F) * 4 : 40;
+    }
+
+    // How long the IP header of a whole TCP or UDP packet is, with no IPv4 fragmentation or IPv6
+    // extension headers in the way, or 0 for anything else
+    static size_t plainIPHeaderLength(const uint8_t *ip, size_t length, uint8_t &protocol) {
+        if (length >= 20 && (ip[0] >> 4) == 4 && ((ip[6] & 0x3F) | ip[7]) == 0) {
+            protocol = ip[9];
+            const size_t ipLength = static_cast<size_t>(ip[0] & 0x0F) * 4;
+            return ipLength >= 20 ? ipLength : 0;
+        }
+        if (length >= 40 && (ip[0] >> 4) == 6) {
+            protocol = ip[6];
+            return 40;
+        }
+        return 0;
+    }
+
+    static bool isTCP(PacketBuf::GSOType type) {
+        return type == PacketBuf::GSOType::TCPv4 || type == PacketBuf::GSOType::TCPv6;
+    }
+
+    bool readVirtioHeader(PacketBuf &packet) {
+        if (packet.size() < sizeof(VirtioNetHeader)) {
+            return false;
+        }
+
+        VirtioNetHeader header;
+        memcpy(&header, packet.data(), sizeof(header));
+        packet.pull(sizeof(header));
+        packet.clearOffload();
+
+        if (header.flags & virtioNeedsChecksum) {
+            if (static_cast<size_t>(header.checksumStart) + header.checksumOffset + 2 > packet.size()) {
+                return false;
+            }
+            packet.setChecksumPartial(header.checksumStart, header.checksumOffset);
+        }
+
+        switch (header.gsoType & ~virtioGSOECN) {
+            case virtioGSONone:
+                return true;
+            case virtioGSOTCPv4:
+                packet.setSegmentation(PacketBuf::GSOType::TCPv4, header.gsoSize);
+                break;
+            case virtioGSOTCPv6:
+                packet.setSegmentation(PacketBuf::GSOType::TCPv6, header.gsoSize);
+                break;
+            case virtioGSOUDPL4:
+                packet.setSegmentation(PacketBuf::GSOType::UDP, header.gsoSize);
+                break;
+            default:
+                return false;
+        }
+
+        return header.gsoSize > 0;
+    }
+
+    void writeVirtioHeader(PacketBuf &packet, uint8_t *header) {
+        VirtioNetHeader h;
+        memset(&h, 0, sizeof(h));
+
+        const PacketBuf::GSOType gsoType = packet.offload().gsoType;
+        if (gsoType != PacketBuf::GSOType::None && !packet.offload().checksumPartial) {
+            // The kernel sums from checksumStart onto what's in the field, so it has to hold
+            // just the pseudo header
+            packet.unshare();
+            const size_t ipLength = transportOffset(packet);
+            const size_t transportLength = packet.size() - ipLength;
+            uint8_t *th = packet.data() + ipLength;
+            if (isTCP(gsoType)) {
+                write16(th + 16, checksum::fold(pseudoHeaderSum(packet.data(), protocolTCP, transportLength)));
+                packet.setChecksumPartial(ipLength, 16);
+            } else {
+                // The length of the whole run, which the kernel adjusts per datagram along with the checksum
+                write16(th + 4, static_cast<uint16_t>(transportLength));
+                write16(th + 6, checksum::fold(pseudoHeaderSum(packet.data(), protocolUDP, transportLength)));
+                packet.setChecksumPartial(ipLength, 6);
+            }
+        }
+
+        if (packet.hasOffload()) {
+            const PacketBuf::Offload &o = packet.offload();
+
+            if (o.checksumPartial) {
+                h.flags = virtioNeedsChecksum;
+                h.checksumStart = static_cast<uint16_t>(packet.checksumStart());
+                h.checksumOffset = o.checksumOffset;
+            }
+
+            const size_t transport = transportOffset(packet);
+            switch (o.gsoType) {
+                case PacketBuf::GSOType::None:
+                    h.gsoType = virtioGSONone;
+                    break;
+                case PacketBuf::GSOType::TCPv4:
+                case PacketBuf::GSOType::TCPv6:
+                    h.gsoType = o.gsoType == PacketBuf::GSOType::TCPv4 ? virtioGSOTCPv4 : virtioGSOTCPv6;
+                    h.gsoSize = o.gsoSize;
+                    h.headerLength = static_cast<uint16_t>(transport + (packet.data()[transport + 12] >> 4) * 4);
+                    break;
+                case PacketBuf::GSOType::UDP:
+                    h.gsoType = virtioGSOUDPL4;
+                    h.gsoSize = o.gsoSize;
+                    h.headerLength = static_cast<uint16_t>(transport + 8);
+                    break;
+            }
+        }
+
+        memcpy(header, &h, sizeof(h));
+    }
+
+    void completeChecksum(PacketBuf &packet) {
+        if (!packet.offload().checksumPartial) {
+            return;
+        }
+
+        packet.unshare();
+
+        const size_t start = packet.checksumStart();
+        uint8_t *field = packet.data() + start + packet.offload().checksumOffset;
+
+        // The field already holds the pseudo header sum, so the range covers everything
+        uint16_t value = checksum::finish(checksum::add(packet.data() + start, packet.size() - start, 0));
+        if (value == 0 && packet.offload().checksumOffset == 6) {
+            // UDP sends a computed zero as all ones, zero means no checksum
+            value = 0xFFFF;
+        }
+        write16(field, value);
+
+        PacketBuf::Offload o = packet.offload();
+        packet.clearOffload();
+        if (o.gsoType != PacketBuf::GSOType::None) {
+            packet.setSegmentation(o.gsoType, o.gsoSize);
+        }
+    }
+
+    size_t segment(PacketBuf &&superPacket, PacketBatch &out) {
+        const PacketBuf::Offload o = superPacket.offload();
+        const uint8_t *ip = superPacket.data();
+        const bool v4 = (ip[0] >> 4) == 4;
+        const size_t transport = transportOffset(superPacket);
+        const bool tcp = isTCP(o.gsoType);
+        const size_t transportHeader = tcp ? static_cast<size_t>(ip[transport + 12] >> 4) * 4 : 8;
+        const size_t headers = transport + transportHeader;
+
+        if (o.gsoType == PacketBuf::GSOType::None || o.gsoSize == 0 || superPacket.size() <= headers + o.gsoSize) {
+            completeChecksum(superPacket);
+            superPacket.clearOffload();
+            out.push_back(std::move(superPacket));
+            return 1;
+        }
+
+        const size_t payload = superPacket.size() - headers;
+        const uint8_t *th = ip + transport;
+        const uint32_t sequence = tcp ? read32(th + 4) : 0;
+        const uint16_t ipID = v4 ? read16(ip + 4) : 0;
+        const uint8_t protocol = tcp ? protocolTCP : protocolUDP;
+        const size_t checksumOffset = tcp ? 16 : 6;
+
+        // Everything the segments share is summed once. Per segment only the fields that differ and
+        // the payload are added: the IPv4 total length and ID, the transport length, and the TCP
+        // sequence number and flags
+        uint64_t ipBase = 0;
+        if (v4) {
+            ipBase = checksum::add(ip, 2, 0);
+            ipBase += checksum::add(ip + 6, 4, 0);
+            ipBase += checksum::add(ip + 12, transport - 12, 0);
+        }
+
+        uint64_t transportBase = pseudoHeaderSum(ip, protocol, 0);
+        transportBase += checksum::add(th, 4, 0);
+        if (tcp) {
+            transportBase += checksum::add(th + 8, 4, 0);
+            transportBase += checksum::add(th + 14, 2, 0);
+            transportBase += checksum::add(th + 18, transportHeader - 18, 0);
+        }
+
+        size_t count = 0;
+
+        for (size_t offset = 0; offset < payload; offset += o.gsoSize) {
+            const size_t n = std::min<size_t>(o.gsoSize, payload - offset);
+            const bool first = offset == 0;
+            const bool last = offset + n == payload;
+            const uint8_t *chunk = ip + headers + offset;
+
+            PacketBuf segment = PacketBuf::allocate(headers + n);
+            memcpy(segment.put(headers), ip, headers);
+            memcpy(segment.put(n), chunk, n);
+
+            uint8_t *sip = segment.data();
+            uint8_t *st = sip + transport;
+
+            if (v4) {
+                const uint16_t totalLength = static_cast<uint16_t>(headers + n);
+                const uint16_t id = static_cast<uint16_t>(ipID + count);
+                write16(sip + 2, totalLength);
+                write16(sip + 4, id);
+                write16(sip + 10, checksum::finish(ipBase + totalLength + id));
+            } else {
+                write16(sip + 4, static_cast<uint16_t>(headers + n - 40));
+            }
+
+            // The segment's transport header and payload start at even offsets, so the payload sums alone
+            const size_t segmentLength = transportHeader + n;
+            uint64_t sum = transportBase + segmentLength + checksum::add(chunk, n, 0);
+
+            if (tcp) {
+                const uint32_t segmentSequence = sequence + static_cast<uint32_t>(offset);
+                write32(st + 4, segmentSequence);
+                if (!last) {
+                    // FIN and PSH only on the last segment
+                    st[13] &= static_cast<uint8_t>(~0x09);
+                }
+                if (!first) {
+                    // CWR only on the first
+                    st[13] &= static_cast<uint8_t>(~0x80);
+                }
+                sum += (segmentSequence >> 16) + (segmentSequence & 0xFFFF) + read16(st + 12);
+            } else {
+                // Once in the header and once in the pseudo header
+                write16(st + 4, static_cast<uint16_t>(segmentLength));
+                sum += segmentLength;
+            }
+
+            uint16_t value = checksum::finish(sum);
+            if (!tcp && value == 0) {
+                value = 0xFFFF;
+            }
+            write16(st + checksumOffset, value);
+
+            out.push_back(std::move(segment));
+            count += 1;
+        }
+
+        return count;
+    }
+
+    bool markForSegmentation(PacketBuf &packet, size_t mtu) {
+        if (packet.size() <= mtu || packet.hasOffload()) {
+            return false;
+        }
+
+        uint8_t protocol = 0;
+        const size_t ipLength = plainIPHeaderLength(packet.data(), packet.size(), protocol);
+        if (ipLength == 0 || protocol != protocolTCP || packet.size() < ipLength + 20) {
+            return false;
+        }
+
+        const size_t headers = ipLength + static_cast<size_t>(packet.data()[ipLength + 12] >> 4) * 4;
+        if (headers >= mtu || headers > packet.size()) {
+            return false;
+        }
+
+        packet.setSegmentation((packet.data()[0] >> 4) == 4 ? PacketBuf::GSOType::TCPv4 : PacketBuf::GSOType::TCPv6,
+                               static_cast<uint16_t>(mtu - headers));
+        return true;
+    }
+
+    bool markSuperPacket(PacketBuf &packet, size_t segmentSize) {
+        if (segmentSize == 0 || segmentSize > 0xFFFF || packet.hasOffload()) {
+            return false;
+        }
+
+        uint8_t protocol = 0;
+        const uint8_t *ip = packet.data();
+        const size_t ipLength = plainIPHeaderLength(ip, packet.size(), protocol);
+        if (ipLength == 0) {
+            return false;
+        }
+
+        size_t headers = 0;
+        PacketBuf::GSOType type = PacketBuf::GSOType::None;
+        if (protocol == protocolTCP && packet.size() >= ipLength + 20) {
+            headers = ipLength + static_cast<size_t>(ip[ipLength + 12] >> 4) * 4;
+            type = (ip[0] >> 4) == 4 ? PacketBuf::GSOType::TCPv4 : PacketBuf::GSOType::TCPv6;
+        } else if (protocol == protocolUDP && packet.size() >= ipLength + 8) {
+            headers = ipLength + 8;
+            type = PacketBuf::GSOType::UDP;
+        } else {
+            return false;
+        }
+
+        if (packet.size() <= headers + segmentSize) {
+            return false;
+        }
+
+        packet.setSegmentation(type, static_cast<uint16_t>(segmentSize));
+        return true;
+    }
+
+    size_t segmentToMTU(PacketBuf &&packet, size_t mtu, PacketBatch &out) {
+        markForSegmentation(packet, mtu);
+
+        if (packet.offload().gsoType == PacketBuf::GSOType::None) {
+            // Small enough already, or nothing to cut at a segment boundary
+            out.push_back(std::move(packet));
+            return 1;
+        }
+        return segment(std::move(packet), out);
+    }
+}
@@ -0,0 +1,102 @@
+//
+//  Offload.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "PacketBuf.hpp"
+#include "PacketSink.hpp"
+
+namespace hs::offload {
+    /**
+     * The legacy virtio-net header a TUN device opened with IFF_VNET_HDR
+     * puts in front of every packet, in host byte order.
+     */
+    struct VirtioNetHeader {
+        uint8_t flags;
+        uint8_t gsoType;
+        uint16_t headerLength;
+        uint16_t gsoSize;
+        uint16_t checksumStart;
+        uint16_t checksumOffset;
+    };
+    static_assert(sizeof(VirtioNetHeader) == 10, "virtio_net_hdr is 10 bytes");
+
+    constexpr uint8_t virtioNeedsChecksum = 0x01;
+
+    constexpr uint8_t virtioGSONone = 0;
+    constexpr uint8_t virtioGSOTCPv4 = 1;
+    constexpr uint8_t virtioGSOTCPv6 = 4;
+    constexpr uint8_t virtioGSOUDPL4 = 5;
+    constexpr uint8_t virtioGSOECN = 0x80;
+
+    /**
+     * Strips the virtio-net header from the front of a packet just read,
+     * recording its segmentation and checksum metadata on the packet.
+     * Returns false for a header this code doesn't understand.
+     */
+    bool readVirtioHeader(PacketBuf &packet);
+
+    /**
+     * Fills in the virtio-net header for a packet about to be written,
+     * from its offload metadata. A TCP super-packet without a partial
+     * checksum gets one, since the kernel needs it to segment: its
+     * checksum field is rewritten to the pseudo-header sum.
+     */
+    void writeVirtioHeader(PacketBuf &packet, uint8_t *header);
+
+    /**
+     * Finishes a partial transport checksum in place.
+     */
+    void completeChecksum(PacketBuf &packet);
+
+    /**
+     * Cuts a TCP or UDP super-packet into segments of its gsoSize, each
+     * with its own IP and transport headers and complete checksums, and
+     * appends them to out. Returns the number of packets appended.
+     */
+    size_t segment(PacketBuf &&superPacket, PacketBatch &out);
+
+    /**
+     * Marks a TCP packet longer than mtu, with no offload metadata yet,
+     * as a super-packet of segments that fit it, for segment() or the
+     * kernel to cut. Returns whether it was marked.
+     *
+     * Anything else is left alone. A UDP datagram in particular has no
+     * segment size to cut at: it goes out whole, for the kernel to
+     * fragment or refuse, rather than as several unrelated datagrams.
+     * Only its builder can say it is a run of datagrams, with
+     * markSuperPacket().
+     */
+    bool markForSegmentation(PacketBuf &packet, size_t mtu);
+
+    /**
+     * Marks a TCP or UDP packet, with no offload metadata yet, as a
+     * super-packet of segmentSize payload bytes per segment, the last
+     * possibly shorter. For UDP each segment becomes its own datagram.
+     * Returns whether it was marked: not if it already fits in one
+     * segment or isn't a plain TCP or UDP packet.
+     */
+    bool markSuperPacket(PacketBuf &packet, size_t segmentSize);
+
+    /**
+     * Cuts a TCP packet longer than mtu into segments that fit it, as the
+     * kernel would for a GSO super-packet. A packet that already carries
+     * GSO metadata is cut at its own gsoSize. Anything else, or a packet
+     * that already fits, is appended to out unchanged. Returns the number
+     * of packets appended.
+     */
+    size_t segmentToMTU(PacketBuf &&packet, size_t mtu, PacketBatch &out);
+
+    // The sum of the IPv4 or IPv6 pseudo header for a transport segment of transportLength bytes
+    uint32_t pseudoHeaderSum(const uint8_t *ip, uint8_t protocol, size_t transportLength);
+}
@@ -0,0 +1,45 @@
+//
+//  PacketSink.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <vector>
+
+#include "PacketBuf.hpp"
+
+namespace hs {
+    // The packets from one read of the TUN fd, each holding an IP packet
+    using PacketBatch = std::vector<PacketBuf>;
+
+    /**
+     * Where TUNInterface sends the packets it reads, on the TUN thread.
+     *
+     * Implementations carry packets on to the data plane directly, without
+     * going through the ObjC or Swift layers. They must not block, since
+     * that stalls writes to the TUN fd too. A sink shared by the queues of
+     * a MultiQueueTUNInterface is called from each queue's thread.
+     */
+    class PacketSink {
+    public:
+        virtual ~PacketSink() = default;
+
+        // May move or copy packets out of the batch to keep them past the call
+        virtual void send(PacketBatch &packets) = 0;
+
+        /**
+         * Whether the sink takes super-packets and partial checksums as the
+         * kernel hands them over, carried in each PacketBuf's offload
+         * metadata. If not, TUNInterface segments and checksums them first.
+         */
+        virtual bool acceptsOffloads() const {
+            return false;
+        }
+    };
+}
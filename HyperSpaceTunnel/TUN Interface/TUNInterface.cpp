@@ -6,197 +6,949 @@
 //
 
 #include "TUNInterface.hpp"
+#include "Checksum.hpp"
+#include "IoUringEventLoop.hpp"
+#include "Offload.hpp"
 #include "Thread.hpp"
+#include "TUNLog.hpp"
 
-#include <os/log.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
 #include <netinet/tcp.h>
-#include <event2/thread.h>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <sys/uio.h>
 
 namespace hs {
 
-    TUNInterface::TUNInterface(int32_t tunFD) {
-        this->tunFD = tunFD;
+    // The limit itself is kept on the queued count, the ring only has to hold that many. DropHead sheds
+    // from the consumer side, so leave the producer room to keep pushing until the TUN thread catches up
+    static size_t ringCapacityFor(const WriteQueueConfig &config) {
+        return config.policy == WriteQueuePolicy::DropHead ? config.maxPackets * 2 : config.maxPackets;
     }
 
-    void TUNInterface::start() {
-        auto thread = new Thread("TUNInterface " + std::to_string(tunFD), [&]() {
-            // Set buffer sizes to 128 KB before handing off to LibEvent
-            int bufferSize = 128 * 1024;
+    TUNInterface::TUNInterface(int32_t tunFD,
+                               WriteQueueConfig writeQueueConfig)
+        : TUNInterface(std::make_unique<UtunDevice>(tunFD), writeQueueConfig) {
+    }
 
-            if (setsockopt(tunFD, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize)) < 0) {
-                os_log(OS_LOG_DEFAULT, "Failed to set receive buffer size: %{public}s", strerror(errno));
-            }
+    TUNInterface::TUNInterface(std::unique_ptr<TunDevice> device,
+                               WriteQueueConfig writeQueueConfig)
+        : writeQueueConfig(writeQueueConfig)
+        , writeQueue(ringCapacityFor(writeQueueConfig))
+        , writeSpaceAvailable(0)
+        , threadExited(0)
+        , device(std::move(device)) {
+        this->tunFD = this->device->fd();
+        readBatch.reserve(readBatchLimit);
+        
+        if (writeQueueConfig.aqm != ActiveQueueManagement::None) {
+            size_t flows = writeQueueConfig.aqm == ActiveQueueManagement::FQCoDel ? writeQueueConfig.fqFlows : 1;
+            scheduler = std::make_unique<FQCoDelScheduler>(flows,
+                                                           writeQueueConfig.fqQuantum,
+                                                           writeQueueConfig.codelTarget.count(),
+                                                           writeQueueConfig.codelInterval.count(),
+                                                           [this](QueuedPacket &packet) {
+                writeQueueCounters.droppedAQM.fetch_add(1, std::memory_order_relaxed);
+                finishedWith(packet);
+            });
+        }
+    }
 
-            if (setsockopt(tunFD, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize)) < 0) {
-                os_log(OS_LOG_DEFAULT, "Failed to set send buffer size: %{public}s", strerror(errno));
-            }
+    TUNInterface::~TUNInterface() {
+        if (threadStarted) {
+            stop();
+        }
+    }
+
+    // The interface whose event loop this thread is running, if any
+    static thread_local const TUNInterface *dispatching = nullptr;
+
+    static uint64_t nowNanos() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void TUNInterface::start() {
+        threadStarted = true;
+        auto thread = new Thread("TUNInterface " + std::to_string(tunFD), [this]() {
+            runEventLoop();
             
-            // Set non-blocking mode
-            evutil_make_socket_nonblocking(tunFD);
+            // The last thing the thread does with the interface, stop() may destroy it from here
+            threadExited.signal();
+        });
+        thread->start();
+    }
+
+    void TUNInterface::runEventLoop() {
+        // Buffer sizes, non-blocking mode and the like, before handing off to the event loop
+        device->prepare();
+        
+        std::unique_ptr<EventLoop> eventLoop = EventLoop::create(loopBackend);
+        if (!eventLoop) {
+            HS_LOG("Failed to create event loop");
+            return;
+        }
+        if (!doorbell) {
+            HS_LOG("No doorbell to wake the TUN thread with");
+            return;
+        }
+        
+        if (!watchDevice(*eventLoop) ||
+            !eventLoop->add(doorbell->fd(), TUNInterface::onDoorbell, nullptr, this)) {
+            return;
+        }
+        
+        // Anything queued before goes now, and from here the next packet queued rings the doorbell
+        loop.store(eventLoop.get());
+        writesDrained(tunFD);
+        
+        // A stop() that came before there was a loop for it to stop leaves only this to tell
+        if (!stopping) {
+            HS_LOG("Beginning to dispatch read/write events with %{public}s...", eventLoop->name());
+            dispatching = this;
+            eventLoop->run();
+            dispatching = nullptr;
+        }
+        
+        // This code only is reached once the event loop is stopped
+        HS_LOG("Event loop exited, cleaning up...");
+        
+        {
+            std::lock_guard<std::mutex> lock(loopMutex);
+            loop.store(nullptr, std::memory_order_release);
+        }
+        ring = nullptr;
+        doorbellArmed = false;
+        eventLoop->remove(doorbell->fd());
+        eventLoop->remove(tunFD);
+        eventLoop.reset();
+        
+        device->close();
+        tunFD = -1;
+        
+        HS_LOG("TUN thread cleanup complete");
+    }
+
+    bool TUNInterface::watchDevice(EventLoop &eventLoop) {
+#if defined(__linux__)
+        if (loopBackend == EventLoopBackend::IoUring) {
+            auto &uring = static_cast<IoUringEventLoop&>(eventLoop);
             
-            evthread_use_pthreads();
+            IoUringEventLoop::PacketHandlers handlers;
+            handlers.onRead = TUNInterface::onRingRead;
+            handlers.onReadsDone = TUNInterface::onRingReadsDone;
+            handlers.onWritten = TUNInterface::onRingWritten;
+            handlers.onWritable = TUNInterface::onRingWritable;
+            handlers.context = this;
             
-            // Create event base
-            base = event_base_new();
-            if (!base) {
-                os_log(OS_LOG_DEFAULT, "Failed to create event base, %{public}s: ", strerror(errno));
-                return;
+            // A completion can't run on into a spill buffer, so a device that hands over
+            // super-packets reads straight into large buffers, fewer of them
+            const bool large = device->segmentsLargePackets();
+            if (!uring.startPacketIO(tunFD,
+                                     large ? PacketBufferPool::large() : readPool,
+                                     large ? ringLargeReadBuffers : ringReadBuffers,
+                                     {&PacketBufferPool::small(), &PacketBufferPool::large()},
+                                     handlers)) {
+                return false;
             }
             
-            // Create read event
-            readEvent = event_new(base, tunFD, EV_READ | EV_PERSIST, TUNInterface::onRead, this);
-            if (!readEvent) {
-                os_log(OS_LOG_DEFAULT, "Failed to create read event, %{public}s: ", strerror(errno));
-                return;
+            ring = &uring;
+            return true;
+        }
+#endif
+        return eventLoop.add(tunFD, TUNInterface::onRead, TUNInterface::onWrite, this);
+    }
+
+    void TUNInterface::stop() {
+        HS_LOG("Requested to stop TUN interface");
+        stopping = true;
+        writeSpaceAvailable.signal();
+        {
+            // Held so the TUN thread can't destroy the loop while it's being stopped
+            std::lock_guard<std::mutex> lock(loopMutex);
+            if (EventLoop *eventLoop = loop.load()) {
+                eventLoop->stop();
             }
-            event_add(readEvent, nullptr);
-            
-            // Create write event (disabled until needed)
-            writeEvent = event_new(base, tunFD, EV_WRITE | EV_PERSIST, TUNInterface::onWrite, this);
-            if (!writeEvent) {
-                os_log(OS_LOG_DEFAULT, "Failed to create write event, %{public}s: ", strerror(errno));
+        }
+        
+        // From a handler on the TUN thread, the loop exits once the handler returns
+        if (dispatching != this && threadStarted.exchange(false)) {
+            threadExited.wait();
+        }
+    }
+
+    void TUNInterface::setEventLoopBackend(EventLoopBackend backend) {
+        loopBackend = backend;
+    }
+
+    void TUNInterface::setOutgoingPacketCallBack(OutgoingPacketCallBack callBack){
+        auto shared = callBack ? std::make_shared<const OutgoingPacketCallBack>(std::move(callBack)) : nullptr;
+        std::lock_guard<std::mutex> lock(callBackMutex);
+        this->callBack = std::move(shared);
+    }
+
+    void TUNInterface::setPacketSink(std::shared_ptr<PacketSink> packetSink) {
+        std::lock_guard<std::mutex> lock(callBackMutex);
+        this->packetSink = std::move(packetSink);
+    }
+
+    void TUNInterface::sendOutgoingPackets(PacketBatch &packets) {
+        std::shared_ptr<PacketSink> sink;
+        std::shared_ptr<const OutgoingPacketCallBack> cb;
+        {
+            std::lock_guard<std::mutex> lock(callBackMutex);
+            sink = packetSink;
+            cb = callBack;
+        }
+        if (sink) {
+            sink->send(packets);
+        } else if (cb) {
+            (*cb)(packets);
+        }
+    }
+
+    bool TUNInterface::consumerAcceptsOffloads() {
+        std::lock_guard<std::mutex> lock(callBackMutex);
+        return packetSink && packetSink->acceptsOffloads();
+    }
+
+    // The length an IP packet's header claims for it, or 0 if it can't be told
+    static size_t ipPacketLength(const uint8_t *packet, size_t length) {
+        if (length >= 20 && (packet[0] >> 4) == 4) {
+            return (static_cast<size_t>(packet[2]) << 8) | packet[3];
+        }
+        
+        // A zero payload length is an IPv6 jumbogram, whose length is in a hop-by-hop option
+        if (length >= 40 && (packet[0] >> 4) == 6) {
+            size_t payloadLength = (static_cast<size_t>(packet[4]) << 8) | packet[5];
+            return payloadLength == 0 ? 0 : payloadLength + 40;
+        }
+        
+        return 0;
+    }
+
+    TUNInterface::ReadPass TUNInterface::beginReadPass() {
+        ReadPass pass;
+        pass.acceptsOffloads = consumerAcceptsOffloads();
+        pass.now = gro ? nowNanos() : 0;
+        return pass;
+    }
+
+    void TUNInterface::receive(PacketBuf &&packet, ReadPass &pass) {
+        if (packet.size() <= device->headerLength()) {
+            return;
+        }
+        
+        // Strip the device header, and take in whatever offload metadata it carried
+        if (!device->readHeader(packet)) {
+            if (badHeaders.fetch_add(1, std::memory_order_relaxed) == 0) {
+                HS_LOG("Dropping packet read from TUN with a header we can't handle");
+            }
+            return;
+        }
+        
+        size_t payloadLen = packet.size();
+        if (ipPacketLength(packet.data(), payloadLen) > payloadLen) {
+            if (truncatedPackets.fetch_add(1, std::memory_order_relaxed) == 0) {
+                HS_LOG("Dropping truncated packet read from TUN, %zu bytes", payloadLen);
+            }
+            return;
+        }
+        
+        pass.packets += 1;
+        pass.bytes += payloadLen;
+        
+        // Straight into the batch, or through GRO, which may hold the packet back to merge it
+        auto deliver = [&](PacketBuf &&packet) {
+            if (gro) {
+                gro->receive(std::move(packet), pass.now, readBatch);
+            } else {
+                readBatch.push_back(std::move(packet));
+            }
+        };
+        
+        if (packet.hasOffload() && !pass.acceptsOffloads) {
+            if (packet.offload().gsoType != PacketBuf::GSOType::None) {
+                superPackets.fetch_add(1, std::memory_order_relaxed);
+                softwareSegments.fetch_add(offload::segment(std::move(packet), segmentBatch),
+                                           std::memory_order_relaxed);
+                for (PacketBuf &segment : segmentBatch) {
+                    deliver(std::move(segment));
+                }
+                segmentBatch.clear();
                 return;
             }
+            offload::completeChecksum(packet);
+        }
+        
+        deliver(std::move(packet));
+    }
+
+    void TUNInterface::endReadPass(ReadPass &pass) {
+        // A pass that found nothing is a busy poll coming up empty, not an event
+        if (pass.packets > 0) {
+            readEvents.fetch_add(1, std::memory_order_relaxed);
+        }
+        packetsRead.fetch_add(pass.packets, std::memory_order_relaxed);
+        bytesRead.fetch_add(pass.bytes, std::memory_order_relaxed);
+        
+        if (gro) {
+            flushGRO(pass.now);
+        }
+        
+        if (!readBatch.empty()) {
+            sendOutgoingPackets(readBatch);
+            readBatch.clear();
+        }
+    }
+
+    void TUNInterface::onRead(int fd, void *arg) {
+        auto* tunInterface = static_cast<TUNInterface*>(arg);
+        const uint64_t wokeAt = tunInterface->busyPoll.enabled ? nowNanos() : 0;
+        
+        tunInterface->drainReads(fd);
+        tunInterface->pollBusily(fd, wokeAt);
+    }
+
+    size_t TUNInterface::drainReads(int fd) {
+        ReadPass pass = beginReadPass();
+        
+        // Drain the fd until it would block, or until the batch is full so writes and other events get a turn
+        while (pass.packets < readBatchLimit) {
+            // Comes from this thread's cache, and goes back to it if the read finds nothing
+            PacketBuf packet = PacketBuf::allocate(readPool, 0);
             
-            os_log(OS_LOG_DEFAULT, "Beginning to dispatch read/write events...");
-            event_base_dispatch(base);
+            if (!spillBuffer) {
+                spillBuffer = PacketBuf::allocate(PacketBufferPool::large(), 0);
+            }
+            PacketBuf &spill = spillBuffer;
             
-            // This code only is reached once the event_base_dispatch loop is broken
-            os_log(OS_LOG_DEFAULT, "Event loop exited, cleaning up...");
+            // Anything past the small buffer lands in the spill buffer at the same offset,
+            // so a jumbo packet only needs its first small buffer's worth copied across
+            struct iovec iov[2];
+            iov[0].iov_base = packet.tail();
+            iov[0].iov_len = packet.tailroom();
+            iov[1].iov_base = spill.tail() + packet.tailroom();
+            iov[1].iov_len = spill.tailroom() - packet.tailroom();
             
-            if (readEvent) {
-                event_free(readEvent);
-                readEvent = nullptr;
-            }
+            ssize_t len = readv(fd, iov, 2);
             
-            if (writeEvent) {
-                event_free(writeEvent);
-                writeEvent = nullptr;
+            if (len < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    HS_LOG("Read error from TUN: %{public}s", strerror(errno));
+                }
+                break;
             }
             
-            if (base) {
-                event_base_free(base);
-                base = nullptr;
+            if (len == 0) {
+                break;
             }
             
-            if (tunFD >= 0) {
-                close(tunFD);
-                tunFD = -1;
+            if (static_cast<size_t>(len) > packet.tailroom()) {
+                memcpy(spill.tail(), packet.tail(), packet.tailroom());
+                packet = std::move(spill);
+                largePackets.fetch_add(1, std::memory_order_relaxed);
             }
             
-            os_log(OS_LOG_DEFAULT, "TUN thread cleanup complete");
-        });
-        thread->start();
-    }
-
-    void TUNInterface::stop() {
-        os_log(OS_LOG_DEFAULT, "Requested to stop TUN interface");
-        if (base) {
-            event_base_loopbreak(base);
+            packet.put(static_cast<size_t>(len));
+            receive(std::move(packet), pass);
         }
+        
+        endReadPass(pass);
+        return pass.packets;
     }
 
-    void TUNInterface::setOutgoingPacketCallBack(OutgoingPacketCallBack callBack){
-        std::lock_guard<std::mutex> lock(callBackMutex);
-        this->callBack = std::move(callBack);
+    void TUNInterface::setGRO(const GROConfig &config) {
+        gro = config.enabled ? std::make_unique<GROTable>(config) : nullptr;
     }
 
-    void TUNInterface::sendOutgoingPacket(const std::vector<uint8_t> &packet) {
-        OutgoingPacketCallBack cb;
-        {
-            std::lock_guard<std::mutex> lock(callBackMutex);
-            cb = callBack;
+    void TUNInterface::flushGRO(uint64_t now) {
+        // TUN thread only
+        if (gro->config().flushTimeout.count() == 0) {
+            gro->flush(readBatch);
+            return;
+        }
+        
+        gro->flushExpired(now, readBatch);
+        
+        // Come back for whatever is still held once the oldest of it is due
+        std::optional<uint64_t> due = gro->nextFlushAt();
+        EventLoop *eventLoop = loop.load(std::memory_order_relaxed);
+        if (due && eventLoop && !eventLoop->timerPending()) {
+            const uint64_t wait = *due > now ? *due - now : 0;
+            eventLoop->scheduleTimer(std::chrono::nanoseconds(wait), TUNInterface::onGROFlush, this);
         }
-        if (cb) cb(packet);
     }
 
-    void TUNInterface::onRead(evutil_socket_t fd,
-                                     short events,
-                                     void *arg) {
+    void TUNInterface::onGROFlush(int, void *arg) {
         auto* tunInterface = static_cast<TUNInterface*>(arg);
-        std::vector<uint8_t> packet(2000);
-        ssize_t len = read(fd, packet.data(), packet.size());
+        auto &batch = tunInterface->readBatch;
+        
+        tunInterface->flushGRO(nowNanos());
         
-        if (len > 4) {
-            const uint8_t* payload = packet.data() + 4;
-            size_t payloadLen = static_cast<size_t>(len - 4);
-            std::vector<uint8_t> rawPacket(payload, payload + payloadLen);
-            tunInterface->sendOutgoingPacket(rawPacket);
+        if (!batch.empty()) {
+            tunInterface->sendOutgoingPackets(batch);
+            batch.clear();
+        }
+    }
+
+    ReadStats TUNInterface::readStats() const {
+        ReadStats s;
+        s.readEvents = readEvents.load(std::memory_order_relaxed);
+        s.packetsRead = packetsRead.load(std::memory_order_relaxed);
+        s.bytesRead = bytesRead.load(std::memory_order_relaxed);
+        s.largePackets = largePackets.load(std::memory_order_relaxed);
+        s.truncatedPackets = truncatedPackets.load(std::memory_order_relaxed);
+        s.badHeaders = badHeaders.load(std::memory_order_relaxed);
+        s.superPackets = superPackets.load(std::memory_order_relaxed);
+        s.softwareSegments = softwareSegments.load(std::memory_order_relaxed);
+        if (gro) {
+            GROStats g = gro->stats();
+            s.groMerged = g.merged;
+            s.groPackets = g.superPackets;
         }
+        return s;
     }
 
     void TUNInterface::enqueueWrite(const std::vector<uint8_t>& packet) {
+        enqueueWrite(packet.data(), packet.size());
+    }
+
+    void TUNInterface::enqueueWrite(const uint8_t *data, size_t length) {
+        if (length == 0) return;
+        
+        // The one copy, for a payload the caller still owns. It leaves headroom for the device header.
+        enqueuePacket(PacketBuf::copyOf(data, length));
+    }
+
+    void TUNInterface::enqueueWrite(PacketBuf &&packet) {
         if (packet.empty()) return;
         
-        // Add 4-byte TUN header on macOS/iOS
-        std::vector<uint8_t> packetWithHeader;
-        packetWithHeader.reserve(4 + packet.size());
-        packetWithHeader.insert(packetWithHeader.end(), {0x00, 0x00, 0x00, 0x02});
-        packetWithHeader.insert(packetWithHeader.end(), packet.begin(), packet.end());
+        enqueuePacket(std::move(packet));
+    }
+
+    void TUNInterface::enqueueWrite(const uint8_t *data, size_t length, size_t segmentSize) {
+        if (length == 0) return;
+        
+        enqueueWrite(PacketBuf::copyOf(data, length), segmentSize);
+    }
+
+    void TUNInterface::enqueueWrite(PacketBuf &&packet, size_t segmentSize) {
+        if (packet.empty()) return;
+        
+        offload::markSuperPacket(packet, segmentSize);
+        enqueuePacket(std::move(packet));
+    }
+
+    void TUNInterface::enqueuePacket(PacketBuf &&buf) {
+        assert(dispatching != this && "enqueueWrite called from the TUN thread");
+        
+        const bool marked = buf.offload().gsoType != PacketBuf::GSOType::None;
+        if (!marked && (writeQueueConfig.mtu == 0 || buf.size() <= writeQueueConfig.mtu)) {
+            queuePacket(std::move(buf));
+            return;
+        }
         
-        writeQueue.put(packetWithHeader);
+        // Only TCP is marked against the MTU, UDP only by its builder. Anything else goes out whole on every device
+        if (!marked) {
+            offload::markForSegmentation(buf, writeQueueConfig.mtu);
+        }
+        const PacketBuf::GSOType type = buf.offload().gsoType;
+        if (type == PacketBuf::GSOType::None ||
+            (type == PacketBuf::GSOType::UDP ? device->segmentsUDPPackets() : device->segmentsLargePackets())) {
+            queuePacket(std::move(buf));
+            return;
+        }
         
-        if (writeEvent && !event_pending(writeEvent, EV_WRITE, nullptr)) {
-            event_add(writeEvent, nullptr);
+        size_t segments = offload::segment(std::move(buf), segmentedWrites);
+        if (segments > 1) {
+            writeQueueCounters.segmentedPackets.fetch_add(1, std::memory_order_relaxed);
+            writeQueueCounters.segmentsCreated.fetch_add(segments, std::memory_order_relaxed);
         }
+        
+        for (PacketBuf &segment : segmentedWrites) {
+            queuePacket(std::move(segment));
+        }
+        segmentedWrites.clear();
     }
 
-    void TUNInterface::onWrite(evutil_socket_t fd,
-                                      short events,
-                                      void *arg) {
-        auto* self = static_cast<TUNInterface*>(arg);
+    void TUNInterface::queuePacket(PacketBuf &&buf) {
+        QueuedPacket packet;
+        packet.buf = std::move(buf);
+        packet.enqueuedAt = nowNanos();
         
-        while (!self->writeQueue.empty()) {
-            auto optPacket = self->writeQueue.take();
-            if (optPacket.has_value()) {
-                std::vector<uint8_t> packet = optPacket.value();
-                ssize_t written = write(fd, packet.data(), packet.size());
-                if (written < 0) {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        // Can't write now, try later
-                        os_log(OS_LOG_DEFAULT, "Can't write now, trying again");
-                        self->writeQueue.putFirst(packet);
+        if (!pushWithPolicy(packet)) {
+            return;
+        }
+        
+        if (backpressure.highWatermark > 0 && !ingressPaused.load(std::memory_order_relaxed) &&
+            writeQueueCounters.queuedPackets.load(std::memory_order_relaxed) >= backpressure.highWatermark) {
+            updateBackpressure(true);
+        }
+        
+        // Only the packet that finds the doorbell armed rings it. Ordered after the push,
+        // so either this sees it armed or the TUN thread sees the packet once it has armed it
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        
+        // A stalled fd gets no write events, so shedding can't wait for one
+        if (writeQueueConfig.policy == WriteQueuePolicy::DropHead &&
+            writeQueueCounters.queuedPackets.load(std::memory_order_relaxed) > writeQueueConfig.maxPackets &&
+            !shedPending.load(std::memory_order_relaxed) && !shedPending.exchange(true)) {
+            doorbell->ring();
+        }
+        
+        if (doorbellArmed.load(std::memory_order_relaxed) && doorbellArmed.exchange(false)) {
+            doorbell->ring();
+            writeQueueCounters.wakeups.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool TUNInterface::pushWithPolicy(QueuedPacket &packet) {
+        const size_t bytes = packet.buf.size();
+        
+        switch (writeQueueConfig.policy) {
+            case WriteQueuePolicy::ByteBudget:
+                if (writeQueueCounters.queuedBytes.load(std::memory_order_relaxed) + bytes > writeQueueConfig.maxBytes) {
+                    writeQueueCounters.droppedBudget.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                // Bytes are the budget, but with AQM the ring no longer caps the count, so maxPackets has to
+                if (queueIsFull()) {
+                    writeQueueCounters.droppedTail.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                break;
+            case WriteQueuePolicy::Block:
+                while (!stopping && queueIsFull()) {
+                    writerBlocked = true;
+                    
+                    // Recheck after announcing ourselves so a drain in between isn't missed
+                    if (!queueIsFull()) {
                         break;
                     }
-                    os_log(OS_LOG_DEFAULT, "Write error to TUN");
+                    writeSpaceAvailable.wait_for(std::chrono::milliseconds(10));
+                }
+                break;
+            case WriteQueuePolicy::DropTail:
+                if (queueIsFull()) {
+                    writeQueueCounters.droppedTail.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                break;
+            case WriteQueuePolicy::DropHead:
+                // Always goes in, the TUN thread sheds the oldest to make up for it
+                break;
+        }
+        
+        writeQueueCounters.reserve(bytes);
+        
+        if (!writeQueue.try_push(std::move(packet))) {
+            writeQueueCounters.removed(bytes);
+            writeQueueCounters.droppedTail.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        
+        writeQueueCounters.commit();
+        return true;
+    }
+
+    bool TUNInterface::queueIsFull() const {
+        // Counts every packet not yet written, wherever it is on the way to the fd, which with AQM
+        // is mostly in the scheduler rather than the ring
+        return writeQueueCounters.queuedPackets.load(std::memory_order_relaxed) >= writeQueueConfig.maxPackets;
+    }
+
+    WriteQueueStats TUNInterface::writeQueueStats() const {
+        return writeQueueCounters.snapshot();
+    }
+
+    void TUNInterface::finishedWith(const QueuedPacket &packet) {
+        finishedWith(packet.buf.size());
+    }
+
+    void TUNInterface::finishedWith(size_t bytes) {
+        writeQueueCounters.removed(bytes);
+        
+        if (writerBlocked.load(std::memory_order_relaxed) && writerBlocked.exchange(false)) {
+            writeSpaceAvailable.signal();
+        }
+        
+        if (ingressPaused.load(std::memory_order_relaxed) &&
+            writeQueueCounters.queuedPackets.load(std::memory_order_relaxed) <= backpressure.lowWatermark) {
+            updateBackpressure(false);
+        }
+    }
+
+    void TUNInterface::updateBackpressure(bool pause) {
+        std::lock_guard<std::mutex> lock(backpressureMutex);
+        
+        // Each side looked without the lock, so the other may have moved the queue back since. Checking
+        // again here keeps a pause and a resume from reaching the call back in the wrong order
+        const uint64_t queued = writeQueueCounters.queuedPackets.load(std::memory_order_relaxed);
+        if (ingressPaused.load(std::memory_order_relaxed) == pause ||
+            (pause ? queued < backpressure.highWatermark : queued > backpressure.lowWatermark)) {
+            return;
+        }
+        
+        ingressPaused.store(pause, std::memory_order_relaxed);
+        if (pause) {
+            writeQueueCounters.ingressPauses.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (backpressureCallBack) {
+            backpressureCallBack(pause);
+        }
+    }
+
+    bool TUNInterface::refillWriteBatch() {
+        // TUN thread only
+        writeBatch.clear();
+        writeBatchIndex = 0;
+        
+        if (!scheduler) {
+            return writeQueue.pop_bulk(std::back_inserter(writeBatch), writeBatchSize) > 0;
+        }
+        
+        // Hand everything injected so far to the AQM stage so it sees every flow's backlog
+        while (std::optional<QueuedPacket> packet = writeQueue.try_pop()) {
+            scheduler->enqueue(std::move(*packet));
+        }
+        
+        // One at a time, so CoDel measures sojourn time right before the write
+        std::optional<QueuedPacket> packet = scheduler->dequeue(nowNanos());
+        if (!packet.has_value()) {
+            return false;
+        }
+        
+        writeBatch.push_back(std::move(*packet));
+        return true;
+    }
+
+    void TUNInterface::recordWriteLatency(const QueuedPacket &packet, uint64_t issuedAt) {
+        writeQueueCounters.writeLatency.record(issuedAt > packet.enqueuedAt ? issuedAt - packet.enqueuedAt : 0);
+    }
+
+    void TUNInterface::shedHead() {
+        // TUN thread only. Drops the oldest packets, whether already batched or still queued.
+        // Taking the request back before looking means a packet queued after this rings again
+        shedPending.store(false, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        
+        while (writeQueueCounters.queuedPackets.load(std::memory_order_relaxed) > writeQueueConfig.maxPackets) {
+            if (scheduler) {
+                while (std::optional<QueuedPacket> packet = writeQueue.try_pop()) {
+                    scheduler->enqueue(std::move(*packet));
+                }
+                
+                // With flow queueing the head of the fattest flow goes first, as in RFC 8290
+                if (std::optional<QueuedPacket> packet = scheduler->dropFromFattestFlow()) {
+                    finishedWith(*packet);
+                    writeQueueCounters.droppedHead.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+            }
+            
+            if (writeBatchIndex == writeBatch.size() && !refillWriteBatch()) {
+                return;
+            }
+            
+            finishedWith(writeBatch[writeBatchIndex]);
+            writeBatchIndex += 1;
+            writeQueueCounters.droppedHead.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void TUNInterface::onWrite(int fd, void *arg) {
+        auto* self = static_cast<TUNInterface*>(arg);
+        const uint64_t wokeAt = self->busyPoll.enabled ? nowNanos() : 0;
+        
+        self->drainWrites(fd);
+        self->pollBusily(fd, wokeAt);
+    }
+
+    size_t TUNInterface::drainWrites(int fd) {
+        size_t issued = 0;
+        writeStalled = false;
+        
+        if (writeQueueConfig.policy == WriteQueuePolicy::DropHead) {
+            shedHead();
+        }
+        
+        while (true) {
+            if (writeBatchIndex == writeBatch.size() && !refillWriteBatch()) {
+                break;
+            }
+            
+            QueuedPacket &packet = writeBatch[writeBatchIndex];
+            PacketBuf &buf = packet.buf;
+            const size_t header = device->headerLength();
+            ssize_t written;
+            
+            if (header == 0) {
+                written = write(fd, buf.data(), buf.size());
+            } else {
+                // Fill the header in before deciding where it goes, since the device may rewrite the packet
+                uint8_t headerBytes[16];
+                device->writeHeader(buf, headerBytes);
+                
+                if (buf.headroom() >= header && !buf.isShared()) {
+                    // Put the header in the headroom and write one contiguous packet
+                    memcpy(buf.push(header), headerBytes, header);
+                    written = write(fd, buf.data(), buf.size());
+                    buf.pull(header);
+                } else {
+                    // No room, or the bytes are someone else's too, so gather the header from the stack
+                    struct iovec iov[2];
+                    iov[0].iov_base = headerBytes;
+                    iov[0].iov_len = header;
+                    iov[1].iov_base = buf.data();
+                    iov[1].iov_len = buf.size();
+                    written = writev(fd, iov, 2);
+                }
+            }
+            
+            if (written < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // Can't write now, so wait for the fd to be writable. The unwritten packets stay in writeBatch.
+                    HS_LOG("Can't write now, trying again");
+                    writeStalled = true;
+                    if (EventLoop *eventLoop = loop.load(std::memory_order_relaxed)) {
+                        eventLoop->setWriteInterest(fd, true);
+                    }
+                    return issued;
                 }
+                HS_LOG("Write error to TUN");
+                writeQueueCounters.writeErrors.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                writeQueueCounters.written.fetch_add(1, std::memory_order_relaxed);
+            }
+            // Read per write, since a packet can sit in writeBatch through any number of EAGAINs
+            recordWriteLatency(packet, nowNanos());
+            finishedWith(packet);
+            writeBatchIndex += 1;
+            issued += 1;
+        }
+        
+        writesDrained(fd);
+        return issued;
+    }
+
+    void TUNInterface::pollBusily(int fd, uint64_t wokeAt) {
+        // TUN thread only
+        if (!busyPoll.enabled || stopping) {
+            return;
+        }
+        
+        const uint64_t budget = static_cast<uint64_t>(busyPoll.budget.count());
+        const size_t threshold = busyPoll.adaptiveThreshold;
+        
+        if (!spinning.load(std::memory_order_relaxed)) {
+            // Blocking for now. Spin again once wakeups keep coming sooner than a spin would have waited
+            shortWakeups = wokeAt - blockedAt < budget ? shortWakeups + 1 : 0;
+            if (shortWakeups < threshold) {
+                blockedAt = nowNanos();
+                return;
+            }
+            shortWakeups = 0;
+            spinning.store(true, std::memory_order_relaxed);
+            switchesToSpinning.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        busySpins.fetch_add(1, std::memory_order_relaxed);
+        
+        // The spin watches the queue itself, so there's no need for the injecting thread to ring meanwhile
+        doorbellArmed = false;
+        pollingWrites = true;
+        
+        // The wakeup drained its own reads, but writes found before the first empty poll may be the
+        // replies to them, so only later writes show spinning paid off
+        bool settled = false;
+        bool productive = false;
+        uint64_t now = nowNanos();
+        uint64_t deadline = now + budget;
+        
+        // Leftovers from a write that would have blocked wait for the loop to see the fd writable
+        while (!stopping) {
+            const size_t reads = drainReads(fd);
+            size_t writes = 0;
+            if (!writeQueue.empty() || (scheduler && !scheduler->empty())) {
+                writes = drainWrites(fd);
             }
+            
+            now = nowNanos();
+            if (reads > 0 || writes > 0) {
+                productive = productive || reads > 0 || settled;
+                deadline = now + budget;
+                continue;
+            }
+            settled = true;
+            
+            // GRO's flush timer can't fire meanwhile, but each read pass flushes what's due
+            if (now >= deadline) {
+                break;
+            }
+            detail::cpuRelax();
+        }
+        
+        pollingWrites = false;
+        if (writeBatchIndex == writeBatch.size() && writeQueue.empty() && (!scheduler || scheduler->empty())) {
+            writesDrained(fd);
+        } else if (EventLoop *eventLoop = loop.load(std::memory_order_relaxed)) {
+            // Queued after the last poll, while the doorbell was disarmed, so nothing else would write it
+            eventLoop->setWriteInterest(fd, true);
         }
         
-        // If queue is empty, disable the write event
-        if (self->writeQueue.empty() && self->writeEvent) {
-            event_del(self->writeEvent);
+        if (productive) {
+            productiveSpins.fetch_add(1, std::memory_order_relaxed);
+            idleSpins = 0;
+        } else if (threshold > 0 && ++idleSpins >= threshold) {
+            // Traffic has gone idle, so stop burning the core on it
+            idleSpins = 0;
+            spinning.store(false, std::memory_order_relaxed);
+            switchesToBlocking.fetch_add(1, std::memory_order_relaxed);
         }
+        
+        blockedAt = now;
     }
 
-    uint16_t TUNInterface::computeIPChecksum(const uint8_t *data, size_t length) {
-        uint32_t sum = 0;
-        const uint16_t* words = reinterpret_cast<const uint16_t*>(data);
+    void TUNInterface::setBusyPoll(const BusyPollConfig &config) {
+        busyPoll = config;
+        spinning.store(config.enabled, std::memory_order_relaxed);
+    }
+
+    void TUNInterface::setBackpressure(const BackpressureConfig &config, std::function<void(bool paused)> callBack) {
+        backpressure = config;
+        backpressureCallBack = std::move(callBack);
+    }
+
+    BusyPollStats TUNInterface::busyPollStats() const {
+        BusyPollStats s;
+        s.spins = busySpins.load(std::memory_order_relaxed);
+        s.productiveSpins = productiveSpins.load(std::memory_order_relaxed);
+        s.switchesToBlocking = switchesToBlocking.load(std::memory_order_relaxed);
+        s.switchesToSpinning = switchesToSpinning.load(std::memory_order_relaxed);
+        s.spinning = spinning.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void TUNInterface::writesDrained(int fd) {
+        EventLoop *eventLoop = loop.load(std::memory_order_relaxed);
+        if (eventLoop == nullptr || pollingWrites) {
+            return;
+        }
+        
+        // If queue is empty, stop waiting for the fd to be writable and wait on the doorbell instead
+        eventLoop->setWriteInterest(fd, false);
+        doorbellArmed.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        
+        // A producer may have queued a packet just before it could see the doorbell armed. If it
+        // hasn't rung it since, take the doorbell back and write the packet without it
+        if ((!writeQueue.empty() || (scheduler && !scheduler->empty())) && doorbellArmed.exchange(false)) {
+            eventLoop->setWriteInterest(fd, true);
+        }
+    }
+
+    void TUNInterface::onDoorbell(int, void *arg) {
+        auto* self = static_cast<TUNInterface*>(arg);
+        self->doorbell->clear();
+        
+        // The ring takes writes each pass while write interest is on
+        if (self->ring) {
+            self->ring->setWriteInterest(self->tunFD, true);
+            return;
+        }
+        
+        // A stalled fd is retried by its write event, ringing here only means there is head to shed
+        if (self->writeStalled) {
+            if (self->writeQueueConfig.policy == WriteQueuePolicy::DropHead) {
+                self->shedHead();
+            }
+            return;
+        }
+        
+        // The fd is all but always writable, so write now rather than wait on an event to say so
+        onWrite(self->tunFD, arg);
+    }
 
-        while (length > 1) {
-            sum += *words++;
-            length -= 2;
+    void TUNInterface::onRingRead(PacketBuf &&packet, void *arg) {
+        auto* self = static_cast<TUNInterface*>(arg);
+        
+        // A pass spans every read completion the loop reaps at once
+        if (!self->ringPass) {
+            self->ringPass = self->beginReadPass();
+        }
+        self->receive(std::move(packet), *self->ringPass);
+    }
+
+    void TUNInterface::onRingReadsDone(void *arg) {
+        auto* self = static_cast<TUNInterface*>(arg);
+        
+        if (self->ringPass) {
+            self->endReadPass(*self->ringPass);
+            self->ringPass.reset();
         }
+    }
 
-        if (length == 1) {
-            sum += static_cast<uint16_t>(*reinterpret_cast<const uint8_t*>(words) << 8);
+    void TUNInterface::onRingWritable(int fd, void *arg) {
+        auto* self = static_cast<TUNInterface*>(arg);
+        const size_t header = self->device->headerLength();
+        
+        if (self->writeQueueConfig.policy == WriteQueuePolicy::DropHead) {
+            self->shedHead();
+        }
+        
+        while (self->ring->canQueueWrite()) {
+            if (self->writeBatchIndex == self->writeBatch.size() && !self->refillWriteBatch()) {
+                self->writesDrained(fd);
+                return;
+            }
+            
+            // Accounted for once the write completes
+            self->recordWriteLatency(self->writeBatch[self->writeBatchIndex], nowNanos());
+            PacketBuf buf = std::move(self->writeBatch[self->writeBatchIndex].buf);
+            self->writeBatchIndex += 1;
+            
+            if (header > 0) {
+                uint8_t headerBytes[16];
+                self->device->writeHeader(buf, headerBytes);
+                
+                // The write goes out of one contiguous buffer, so the header needs headroom that's ours
+                if (buf.headroom() < header || buf.isShared()) {
+                    buf = PacketBuf::copyOf(buf.data(), buf.size());
+                }
+                memcpy(buf.push(header), headerBytes, header);
+            }
+            
+            self->ring->queueWrite(std::move(buf));
         }
+    }
 
-        while (sum >> 16) {
-            sum = (sum & 0xFFFF) + (sum >> 16);
+    void TUNInterface::onRingWritten(PacketBuf &&packet, int result, void *arg) {
+        auto* self = static_cast<TUNInterface*>(arg);
+        
+        if (result < 0) {
+            HS_LOG("Write error to TUN: %{public}s", strerror(-result));
+            self->writeQueueCounters.writeErrors.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            self->writeQueueCounters.written.fetch_add(1, std::memory_order_relaxed);
         }
+        self->finishedWith(packet.size() - self->device->headerLength());
+    }
 
-        return static_cast<uint16_t>(~sum);
+    uint16_t TUNInterface::computeIPChecksum(const uint8_t *data, size_t length) {
+        // In memory order, ready to be copied straight into the header
+        return htons(checksum::finish(checksum::add(data, length, 0)));
     }
 
     void TUNInterface::printPacketDump(const uint8_t *data,
                                               size_t length,
                                               const std::string &label) {
         if (!label.empty()) {
-            os_log(OS_LOG_DEFAULT, "---- %{public}s (len: %zu) ----", label.c_str(), length);
+            HS_LOG("---- %{public}s (len: %zu) ----", label.c_str(), length);
         }
         
         char line[128];
@@ -223,10 +975,10 @@ namespace hs {
                 }
             }
             
-            os_log(OS_LOG_DEFAULT, "%{public}s", line);
+            HS_LOG("%{public}s", line);
         }
         
-        os_log(OS_LOG_DEFAULT, "----------------------------");
+        HS_LOG("----------------------------");
     }
 }
 
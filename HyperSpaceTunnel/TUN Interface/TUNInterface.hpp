@@ -10,14 +10,30 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 
-#include <event2/event.h>
-#include "LinkedBlockingDeque.hpp"
+#include "EventLoop.hpp"
+#include "PacketBuf.hpp"
+#include "PacketBufferPool.hpp"
+#include "PacketSink.hpp"
+#include "SPSCRingBuffer.hpp"
+#include "Semaphore.hpp"
+#include "TunDevice.hpp"
+#include "TUNWriteQueuePolicy.hpp"
+#include "CoDel.hpp"
+#include "Doorbell.hpp"
+#include "GRO.hpp"
 
 namespace hs {
+    class IoUringEventLoop;
+
     struct icmphdr {
         uint8_t  type;
         uint8_t  code;
@@ -26,41 +42,266 @@ namespace hs {
         uint16_t sequence;
     };
 
+    /**
+     * A point in time copy of the read path counters.
+     */
+    struct ReadStats {
+        uint64_t readEvents = 0;
+        uint64_t packetsRead = 0;
+        uint64_t bytesRead = 0;
+        // Packets too big for a small buffer that spilled into a large one
+        uint64_t largePackets = 0;
+        // Packets whose IP length claimed more bytes than the read returned, dropped
+        uint64_t truncatedPackets = 0;
+        // Packets whose device header couldn't be parsed, dropped
+        uint64_t badHeaders = 0;
+        // Segmentation offload super-packets cut up because the consumer can't take them whole
+        uint64_t superPackets = 0;
+        // The packets those were cut into
+        uint64_t softwareSegments = 0;
+        // Segments GRO merged into an earlier packet of their flow
+        uint64_t groMerged = 0;
+        // The packets GRO merged them into
+        uint64_t groPackets = 0;
+    };
+
+    /**
+     * Spinning on the TUN fd and the write queue after each event, rather
+     * than going straight back to block in the event loop, trades a core
+     * for the wakeup latency. For the readiness backends: with io_uring
+     * the reads complete without the thread polling the fd.
+     */
+    struct BusyPollConfig {
+        bool enabled = false;
+        // How long the TUN thread keeps spinning after it last found something to do
+        std::chrono::nanoseconds budget = std::chrono::microseconds(50);
+        // Go back to blocking after this many spins in a row find nothing, and spin again once this many
+        // wakeups in a row come within budget of the thread blocking. 0 spins after every event regardless
+        size_t adaptiveThreshold = 4;
+    };
+
+    struct BusyPollStats {
+        // Spins after an event, and those that found more to do before the budget ran out
+        uint64_t spins = 0;
+        uint64_t productiveSpins = 0;
+        // Times the adaptive heuristic went back to blocking with traffic idle, and back to spinning
+        uint64_t switchesToBlocking = 0;
+        uint64_t switchesToSpinning = 0;
+        // Whether the thread spins after events right now
+        bool spinning = false;
+    };
+
     class TUNInterface final {
 
     public:
-        ~TUNInterface() = default;
-        explicit TUNInterface(int32_t tunFD);
+        // Stops the TUN thread first if it's still running
+        ~TUNInterface();
+        // A utun fd from NetworkExtension
+        explicit TUNInterface(int32_t tunFD,
+                              WriteQueueConfig writeQueueConfig = WriteQueueConfig());
+        explicit TUNInterface(std::unique_ptr<TunDevice> device,
+                              WriteQueueConfig writeQueueConfig = WriteQueueConfig());
         
-        LinkedBlockingDeque<std::vector<uint8_t>> writeQueue;
+        const WriteQueueConfig writeQueueConfig;
+        WriteQueueCounters writeQueueCounters;
+
+        // Filled by the data plane (single producer), drained by the TUN thread (single consumer). There
+        // must be exactly one injecting thread, and it can't be the TUN thread: a handler injecting would be
+        // a second producer, and under Block would wait on itself to make room
+        SPSCRingBuffer<QueuedPacket> writeQueue;
+
+        // TUN thread only: the AQM stage packets pass through on their way to the fd, if enabled
+        std::unique_ptr<FQCoDelScheduler> scheduler;
+
+        // Used by WriteQueuePolicy::Block to wake an injecting thread waiting for room
+        std::atomic<bool> writerBlocked = false;
+        Semaphore writeSpaceAvailable;
+        std::atomic<bool> stopping = false;
+        // Set by start(). The stop() that takes it back waits for threadExited, which the TUN thread
+        // signals once it's done with the interface, so the interface can be destroyed after
+        std::atomic<bool> threadStarted = false;
+        Semaphore threadExited;
+
+        // Set before start(). Called by whichever thread moves the queue across a watermark, under backpressureMutex
+        BackpressureConfig backpressure;
+        std::function<void(bool paused)> backpressureCallBack;
+        std::mutex backpressureMutex;
+        std::atomic<bool> ingressPaused = false;
+
+        // The TUN thread arms the doorbell once it has nothing left to write, and the next packet queued
+        // disarms it and rings, so a burst costs the injecting thread one wakeup and never touches the loop
+        std::unique_ptr<Doorbell> doorbell = Doorbell::create();
+        std::atomic<bool> doorbellArmed = false;
+        // DropHead only: set by the packet that takes the queue over maxPackets, which rings the doorbell
+        // so the TUN thread sheds even while the fd is stalled, until shedHead() takes it back
+        std::atomic<bool> shedPending = false;
 
-        // LibEvent properties
+        // TUN thread only: packets popped from writeQueue that have not been written yet
+        std::vector<QueuedPacket> writeBatch;
+        size_t writeBatchIndex = 0;
+        static constexpr size_t writeBatchSize = 64;
+        // Set when a write hit EAGAIN, until the next drain. The doorbell then only sheds, the write event retries
+        bool writeStalled = false;
+
+        // The TUN thread closes the device once its event loop exits
+        std::unique_ptr<TunDevice> device;
+
+        // Event loop properties. loop is set while the TUN thread is running it
         int tunFD;
-        struct event_base* base;
-        struct event* readEvent;
-        struct event* writeEvent;
+        EventLoopBackend loopBackend = EventLoop::defaultBackend();
+        std::atomic<EventLoop*> loop = nullptr;
+        // Taken by stop() to stop the loop, and by the TUN thread to clear loop before destroying it
+        std::mutex loopMutex;
         std::mutex callBackMutex;
-        using OutgoingPacketCallBack = std::function<void(const std::vector<uint8_t>&)>;
-        OutgoingPacketCallBack callBack;
+        // Each buffer holds the IP packet, with the utun header left in its headroom.
+        // The call back may move or copy buffers out of the batch to keep them past the call.
+        using PacketBatch = hs::PacketBatch;
+        using OutgoingPacketCallBack = std::function<void(PacketBatch&)>;
+        // Shared so sendOutgoingPackets can take a reference without copying the function
+        std::shared_ptr<const OutgoingPacketCallBack> callBack;
+        // Takes the packets in place of callBack when set, forwarding them from the TUN thread
+        std::shared_ptr<PacketSink> packetSink;
+
+        // Injecting thread only: the segments of a packet over the MTU, on their way into writeQueue
+        PacketBatch segmentedWrites;
+
+        // The most packets onRead drains from the fd per readiness event, set before start()
+        size_t readBatchLimit = 64;
+
+        // TUN thread only. Reads go straight into buffers from readPool, and whatever
+        // doesn't fit runs on into spillBuffer, a buffer from the large pool
+        PacketBufferPool &readPool = PacketBufferPool::small();
+        PacketBuf spillBuffer;
+        PacketBatch readBatch;
+        PacketBatch segmentBatch;
+
+        // TUN thread only, once started: coalesces TCP segments read before they're handed on, if enabled
+        std::unique_ptr<GROTable> gro;
+
+        // TUN thread only: the loop as an io_uring, when it's reading and writing the fd through completions
+        IoUringEventLoop *ring = nullptr;
+        static constexpr size_t ringReadBuffers = 256;
+        static constexpr size_t ringLargeReadBuffers = 32;
+
+        // Set before start(). From then the TUN thread's: whether it spins after events, and what decides that
+        BusyPollConfig busyPoll;
+        std::atomic<bool> spinning = false;
+        // While the spin drains writes itself, so emptying the queue doesn't arm the doorbell
+        bool pollingWrites = false;
+        size_t idleSpins = 0;
+        size_t shortWakeups = 0;
+        uint64_t blockedAt = 0;
+        std::atomic<uint64_t> busySpins = 0;
+        std::atomic<uint64_t> productiveSpins = 0;
+        std::atomic<uint64_t> switchesToBlocking = 0;
+        std::atomic<uint64_t> switchesToSpinning = 0;
+
+        std::atomic<uint64_t> readEvents = 0;
+        std::atomic<uint64_t> packetsRead = 0;
+        std::atomic<uint64_t> bytesRead = 0;
+        std::atomic<uint64_t> largePackets = 0;
+        std::atomic<uint64_t> truncatedPackets = 0;
+        std::atomic<uint64_t> badHeaders = 0;
+        std::atomic<uint64_t> superPackets = 0;
+        std::atomic<uint64_t> softwareSegments = 0;
 
         // TUN functions
         void start();
+        // Returns once the TUN thread has exited, unless called from the TUN thread itself
         void stop();
+        // Must be called before start()
+        void setEventLoopBackend(EventLoopBackend backend);
         void setOutgoingPacketCallBack(OutgoingPacketCallBack callBack);
-        void sendOutgoingPacket(const std::vector<uint8_t>& packet);
+        void setPacketSink(std::shared_ptr<PacketSink> packetSink);
+        void sendOutgoingPackets(PacketBatch& packets);
+        // Must be called before start()
+        void setGRO(const GROConfig &config);
+        // Must be called before start()
+        void setBusyPoll(const BusyPollConfig &config);
+        /**
+         * Has callBack told true when the write queue reaches the high
+         * watermark and false when it's back down to the low one, so the
+         * feeder can stop reading meanwhile. It runs on the injecting
+         * thread to pause and on the TUN thread to resume, never both at
+         * once, and mustn't block. Must be called before start()
+         */
+        void setBackpressure(const BackpressureConfig &config, std::function<void(bool paused)> callBack);
+        BusyPollStats busyPollStats() const;
+        // From one injecting thread only, never from the TUN thread or its call backs
         void enqueueWrite(const std::vector<uint8_t> &packet);
-        static void onRead(evutil_socket_t fd,
-                           short events,
-                           void* arg);
-        static void onWrite(evutil_socket_t fd,
-                            short events,
-                            void* arg);
+        void enqueueWrite(PacketBuf &&packet);
+        void enqueueWrite(const uint8_t *data, size_t length);
+        /**
+         * Writes a TCP or UDP super-packet whose payload is a run of
+         * segmentSize byte segments, the last possibly shorter, as that
+         * many packets. For UDP each segment is a datagram of its own,
+         * which the packet alone can't say. The device gets it whole if it
+         * segments packets of its kind, and it's cut here otherwise.
+         * Anything else is written as enqueueWrite(packet) would.
+         */
+        void enqueueWrite(PacketBuf &&packet, size_t segmentSize);
+        void enqueueWrite(const uint8_t *data, size_t length, size_t segmentSize);
+        WriteQueueStats writeQueueStats() const;
+        ReadStats readStats() const;
+        static void onRead(int fd, void* arg);
+        static void onWrite(int fd, void* arg);
+        static void onDoorbell(int fd, void* arg);
+        static void onGROFlush(int fd, void* arg);
+        static void onRingRead(PacketBuf &&packet, void* arg);
+        static void onRingReadsDone(void* arg);
+        static void onRingWritable(int fd, void* arg);
+        static void onRingWritten(PacketBuf &&packet, int result, void* arg);
         
         void printPacketDump(const uint8_t *data,
                              size_t length,
                              const std::string &label = "");
         uint16_t computeIPChecksum(const uint8_t *data,
                                    size_t length);
+
+    private:
+        // What one pass over the reads the loop has ready adds up to
+        struct ReadPass {
+            bool acceptsOffloads = false;
+            uint64_t now = 0;
+            size_t packets = 0;
+            size_t bytes = 0;
+        };
+        // TUN thread only: the pass the io_uring read completions reaped so far are adding to
+        std::optional<ReadPass> ringPass;
+
+        // Watches the fd for reads and writes, by readiness or, on an io_uring, by completion
+        // The TUN thread, from setting the device up to closing it
+        void runEventLoop();
+        bool watchDevice(EventLoop &eventLoop);
+        // Reads until the fd would block or the batch is full, and returns how many packets it took
+        size_t drainReads(int fd);
+        // Writes until the queue is empty or the fd would block, and returns how many packets went
+        size_t drainWrites(int fd);
+        // Spins on both for up to the busy poll budget after an event that woke the thread at wokeAt
+        void pollBusily(int fd, uint64_t wokeAt);
+        ReadPass beginReadPass();
+        // Takes one packet as read from the device, header and all, through to readBatch
+        void receive(PacketBuf &&packet, ReadPass &pass);
+        // Counts the pass, and hands readBatch on
+        void endReadPass(ReadPass &pass);
+        // Whether what the read path hands packets to can take offload super-packets as they are
+        bool consumerAcceptsOffloads();
+        // Moves whatever GRO has ready into readBatch, and schedules a flush for the rest
+        void flushGRO(uint64_t now);
+        void enqueuePacket(PacketBuf &&packet);
+        void queuePacket(PacketBuf &&packet);
+        bool pushWithPolicy(QueuedPacket &packet);
+        bool queueIsFull() const;
+        bool refillWriteBatch();
+        void shedHead();
+        void finishedWith(const QueuedPacket &packet);
+        void finishedWith(size_t bytes);
+        // Tells the back pressure call back, if the queue is still past the watermark for it
+        void updateBackpressure(bool pause);
+        // From the packet being queued to issuedAt, when its write went to the fd or the ring
+        void recordWriteLatency(const QueuedPacket &packet, uint64_t issuedAt);
+        // Turns write interest off now there's nothing left to write, and arms the doorbell for the next packet
+        void writesDrained(int fd);
     };
 }
 
@@ -12,19 +12,105 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+typedef NS_ENUM(NSInteger, TUNWriteQueuePolicy) {
+    TUNWriteQueuePolicyBlock,
+    TUNWriteQueuePolicyDropTail,
+    TUNWriteQueuePolicyDropHead,
+    TUNWriteQueuePolicyByteBudget
+};
+
+typedef NS_ENUM(NSInteger, TUNActiveQueueManagement) {
+    TUNActiveQueueManagementNone,
+    TUNActiveQueueManagementCoDel,
+    TUNActiveQueueManagementFQCoDel
+};
+
 @protocol TUNInterfaceBridgeDelegate <NSObject>
 - (void)bridgeDidReadOutboundPacket:(NSData *)packet;
+@optional
+/// The write queue reached its high watermark. Called on the thread that called
+/// writePacketToTun, which should stop feeding it. Must not block.
+- (void)bridgeShouldPauseIngress;
+/// The TUN thread wrote the queue back down to its low watermark, on that
+/// thread. Must not block.
+- (void)bridgeShouldResumeIngress;
 @end
 
 @interface TUNInterfaceBridge : NSObject
 @property (atomic, weak) id<TUNInterfaceBridgeDelegate> delegate;
 
 - (instancetype)initWithTunFD:(int32_t)tunFD;
+- (instancetype)initWithTunFD:(int32_t)tunFD
+             writeQueuePolicy:(TUNWriteQueuePolicy)policy
+                   maxPackets:(NSUInteger)maxPackets
+                     maxBytes:(NSUInteger)maxBytes
+        activeQueueManagement:(TUNActiveQueueManagement)aqm;
+/// As above, with TCP packets written to the TUN fd that are longer than mtu
+/// segmented to fit it first. Anything else is written whole. An mtu of 0
+/// leaves every packet as it is.
+- (instancetype)initWithTunFD:(int32_t)tunFD
+             writeQueuePolicy:(TUNWriteQueuePolicy)policy
+                   maxPackets:(NSUInteger)maxPackets
+                     maxBytes:(NSUInteger)maxBytes
+        activeQueueManagement:(TUNActiveQueueManagement)aqm
+                          mtu:(NSUInteger)mtu;
 
 - (void)start;
 - (void)stop;
 
 - (void)writePacketToTun:(NSData *)packet;
+
+/// Writes a TCP or UDP packet whose payload is a run of segmentSize byte
+/// segments, the last possibly shorter, as that many packets: for UDP, one
+/// datagram per segment. The kernel cuts it where the device supports it,
+/// and the TUN thread otherwise.
+- (void)writeSuperPacketToTun:(NSData *)packet segmentSize:(NSUInteger)segmentSize;
+
+/// Sends packets read from the TUN fd straight from the TUN thread as UDP
+/// datagrams to host:port, from a duplicate of socketFD, instead of through
+/// the delegate. socketFD must be a non-blocking IPv4 UDP socket, and the
+/// caller may close its copy. Only IPv4 packets are forwarded.
+- (void)forwardOutboundPacketsToUDPSocket:(int32_t)socketFD
+                                     host:(NSString *)host
+                                     port:(uint16_t)port;
+
+/// Merges consecutive segments of outbound TCP flows read from the TUN fd into
+/// packets of up to maxSize bytes before they are handed on. A flow is held for
+/// at most flushTimeout seconds waiting for more, and zero holds nothing past
+/// the read it arrived in. Must be called before start.
+- (void)coalesceOutboundTCPWithMaxSize:(NSUInteger)maxSize
+                          flushTimeout:(NSTimeInterval)flushTimeout;
+
+/// Has the TUN thread spin on the TUN fd and the write queue for up to budget
+/// seconds after each event before blocking again, trading a core for wakeup
+/// latency. If adaptive, it goes back to blocking while traffic is idle and
+/// resumes spinning once it picks up. Must be called before start.
+- (void)busyPollWithBudget:(NSTimeInterval)budget adaptive:(BOOL)adaptive;
+
+/// Asks the delegate to pause feeding writePacketToTun once highWatermark packets
+/// are waiting to be written, and to resume once they are down to lowWatermark,
+/// so excess load waits in the feeder's socket buffer rather than the heap. Set
+/// highWatermark under maxPackets. Must be called before start.
+- (void)pauseIngressAtHighWatermark:(NSUInteger)highWatermark
+                       lowWatermark:(NSUInteger)lowWatermark;
+
+/// Write queue counters: enqueued, written, writeErrors, droppedTail (turned away at
+/// maxPackets), droppedBudget (turned away at maxBytes), droppedHead, droppedAQM, segmentedPackets, segmentsCreated, queuedPackets, queuedBytes,
+/// highWaterPackets, highWaterBytes, ingressPauses, wakeups (packets that had to wake an idle
+/// TUN thread), and writeLatencyP50 and writeLatencyP99, the nanoseconds from a
+/// packet being queued to its write.
+- (NSDictionary<NSString *, NSNumber *> *)writeQueueStatistics;
+
+/// Busy poll counters: spins, productiveSpins, switchesToBlocking,
+/// switchesToSpinning and spinning.
+- (NSDictionary<NSString *, NSNumber *> *)busyPollStatistics;
+
+/// Read path counters: readEvents, packetsRead, bytesRead, largePackets,
+/// truncatedPackets, badHeaders, superPackets, softwareSegments, groMerged and
+/// groPackets.
+/// packetsRead / readEvents is the average read batch size.
+/// When forwarding natively, also forwardedPackets and forwardDrops.
+- (NSDictionary<NSString *, NSNumber *> *)readStatistics;
 @end
 
 NS_ASSUME_NONNULL_END
@@ -9,6 +9,7 @@
 
 #import "TUNInterfaceBridge.h"
 #import "TUNInterface.hpp"
+#import "UDPPacketSink.hpp"
 
 #import <memory>
 #import <vector>
@@ -20,21 +21,81 @@
 @implementation TUNInterfaceBridge {
     int32_t _tunFD;
     std::unique_ptr<hs::TUNInterface> _iface;
+    std::shared_ptr<hs::UDPPacketSink> _udpSink;
 }
 
 - (instancetype)initWithTunFD:(int32_t)tunFD {
+    hs::WriteQueueConfig defaults;
+    return [self initWithTunFD:tunFD
+              writeQueuePolicy:TUNWriteQueuePolicyDropTail
+                    maxPackets:defaults.maxPackets
+                      maxBytes:defaults.maxBytes
+         activeQueueManagement:TUNActiveQueueManagementNone];
+}
+
+- (instancetype)initWithTunFD:(int32_t)tunFD
+             writeQueuePolicy:(TUNWriteQueuePolicy)policy
+                   maxPackets:(NSUInteger)maxPackets
+                     maxBytes:(NSUInteger)maxBytes
+        activeQueueManagement:(TUNActiveQueueManagement)aqm {
+    return [self initWithTunFD:tunFD
+              writeQueuePolicy:policy
+                    maxPackets:maxPackets
+                      maxBytes:maxBytes
+         activeQueueManagement:aqm
+                           mtu:0];
+}
+
+- (instancetype)initWithTunFD:(int32_t)tunFD
+             writeQueuePolicy:(TUNWriteQueuePolicy)policy
+                   maxPackets:(NSUInteger)maxPackets
+                     maxBytes:(NSUInteger)maxBytes
+        activeQueueManagement:(TUNActiveQueueManagement)aqm
+                          mtu:(NSUInteger)mtu {
     if ((self = [super init])) {
+        hs::WriteQueueConfig config;
+        switch (policy) {
+            case TUNWriteQueuePolicyBlock:      config.policy = hs::WriteQueuePolicy::Block; break;
+            case TUNWriteQueuePolicyDropTail:   config.policy = hs::WriteQueuePolicy::DropTail; break;
+            case TUNWriteQueuePolicyDropHead:   config.policy = hs::WriteQueuePolicy::DropHead; break;
+            case TUNWriteQueuePolicyByteBudget: config.policy = hs::WriteQueuePolicy::ByteBudget; break;
+        }
+        switch (aqm) {
+            case TUNActiveQueueManagementNone:    config.aqm = hs::ActiveQueueManagement::None; break;
+            case TUNActiveQueueManagementCoDel:   config.aqm = hs::ActiveQueueManagement::CoDel; break;
+            case TUNActiveQueueManagementFQCoDel: config.aqm = hs::ActiveQueueManagement::FQCoDel; break;
+        }
+        config.maxPackets = maxPackets;
+        config.maxBytes = maxBytes;
+        config.mtu = mtu;
+
         _tunFD = tunFD;
         _pktQueue = dispatch_queue_create("tun.packetOut", DISPATCH_QUEUE_SERIAL);
-        _iface = std::make_unique<hs::TUNInterface>(_tunFD);
+        _iface = std::make_unique<hs::TUNInterface>(_tunFD, config);
+
+        _iface->setOutgoingPacketCallBack([weakSelf = self](hs::TUNInterface::PacketBatch& packets) {
+            NSMutableArray<NSData *> *pkts = [NSMutableArray arrayWithCapacity:packets.size()];
+            for (auto &packet : packets) {
+                if (packet.empty()) continue;
+
+                // Wrap the pooled buffer rather than copying it. The block holds a reference,
+                // so the buffer goes back to its pool once the NSData is gone.
+                hs::PacketBuf held = std::move(packet);
+                [pkts addObject:[[NSData alloc] initWithBytesNoCopy:held.data()
+                                                             length:held.size()
+                                                        deallocator:^(void *, NSUInteger) {
+                    (void)held;
+                }]];
+            }
+            if (pkts.count == 0) return;
 
-        _iface->setOutgoingPacketCallBack([weakSelf = self](const std::vector<uint8_t>& bytes) {
-            if (bytes.empty()) return;
-            NSData *pkt = [NSData dataWithBytes:bytes.data() length:bytes.size()];
+            // One hop per read batch rather than per packet
             dispatch_async(weakSelf.pktQueue, ^{
                 id<TUNInterfaceBridgeDelegate> del = weakSelf.delegate;
                 if ([del respondsToSelector:@selector(bridgeDidReadOutboundPacket:)]) {
-                    [del bridgeDidReadOutboundPacket:pkt];
+                    for (NSData *pkt in pkts) {
+                        [del bridgeDidReadOutboundPacket:pkt];
+                    }
                 }
             });
         });
@@ -49,14 +110,124 @@
 - (void)stop {
     if (_iface) _iface->stop();
     _iface.reset();
+    _udpSink.reset();
 }
 
 - (void)writePacketToTun:(NSData *)packet {
     if (!_iface || packet.length == 0) return;
-    const uint8_t *p = (const uint8_t *)packet.bytes;
-    std::vector<uint8_t> v;
-    v.assign(p, p + packet.length);
-    _iface->enqueueWrite(v);
+    _iface->enqueueWrite((const uint8_t *)packet.bytes, packet.length);
+}
+
+- (void)writeSuperPacketToTun:(NSData *)packet segmentSize:(NSUInteger)segmentSize {
+    if (!_iface || packet.length == 0) return;
+    _iface->enqueueWrite((const uint8_t *)packet.bytes, packet.length, segmentSize);
+}
+
+- (void)forwardOutboundPacketsToUDPSocket:(int32_t)socketFD
+                                     host:(NSString *)host
+                                     port:(uint16_t)port {
+    if (!_iface) return;
+    _udpSink = std::make_shared<hs::UDPPacketSink>(socketFD, std::string(host.UTF8String), port);
+    _iface->setPacketSink(_udpSink);
+}
+
+- (void)coalesceOutboundTCPWithMaxSize:(NSUInteger)maxSize
+                          flushTimeout:(NSTimeInterval)flushTimeout {
+    if (!_iface) return;
+    hs::GROConfig config;
+    config.enabled = true;
+    config.maxSize = maxSize;
+    config.flushTimeout = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(flushTimeout));
+    _iface->setGRO(config);
+}
+
+- (void)busyPollWithBudget:(NSTimeInterval)budget adaptive:(BOOL)adaptive {
+    if (!_iface) return;
+    hs::BusyPollConfig config;
+    config.enabled = true;
+    config.budget = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(budget));
+    if (!adaptive) {
+        config.adaptiveThreshold = 0;
+    }
+    _iface->setBusyPoll(config);
+}
+
+- (void)pauseIngressAtHighWatermark:(NSUInteger)highWatermark
+                       lowWatermark:(NSUInteger)lowWatermark {
+    if (!_iface) return;
+    hs::BackpressureConfig config;
+    config.highWatermark = highWatermark;
+    config.lowWatermark = lowWatermark;
+
+    // Straight through on whichever thread crossed the watermark, so a pause lands before the next read
+    __weak TUNInterfaceBridge *weakSelf = self;
+    _iface->setBackpressure(config, [weakSelf](bool paused) {
+        id<TUNInterfaceBridgeDelegate> del = weakSelf.delegate;
+        if (paused && [del respondsToSelector:@selector(bridgeShouldPauseIngress)]) {
+            [del bridgeShouldPauseIngress];
+        } else if (!paused && [del respondsToSelector:@selector(bridgeShouldResumeIngress)]) {
+            [del bridgeShouldResumeIngress];
+        }
+    });
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)writeQueueStatistics {
+    if (!_iface) return @{};
+    hs::WriteQueueStats s = _iface->writeQueueStats();
+    return @{
+        @"enqueued":         @(s.enqueued),
+        @"written":          @(s.written),
+        @"writeErrors":      @(s.writeErrors),
+        @"droppedTail":      @(s.droppedTail),
+        @"droppedBudget":    @(s.droppedBudget),
+        @"droppedHead":      @(s.droppedHead),
+        @"droppedAQM":       @(s.droppedAQM),
+        @"segmentedPackets": @(s.segmentedPackets),
+        @"segmentsCreated":  @(s.segmentsCreated),
+        @"queuedPackets":    @(s.queuedPackets),
+        @"queuedBytes":      @(s.queuedBytes),
+        @"highWaterPackets": @(s.highWaterPackets),
+        @"highWaterBytes":   @(s.highWaterBytes),
+        @"ingressPauses":    @(s.ingressPauses),
+        @"wakeups":          @(s.wakeups),
+        @"writeLatencyP50":  @(s.writeLatencyP50),
+        @"writeLatencyP99":  @(s.writeLatencyP99),
+    };
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)busyPollStatistics {
+    if (!_iface) return @{};
+    hs::BusyPollStats s = _iface->busyPollStats();
+    return @{
+        @"spins":              @(s.spins),
+        @"productiveSpins":    @(s.productiveSpins),
+        @"switchesToBlocking": @(s.switchesToBlocking),
+        @"switchesToSpinning": @(s.switchesToSpinning),
+        @"spinning":           @(s.spinning),
+    };
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)readStatistics {
+    if (!_iface) return @{};
+    hs::ReadStats s = _iface->readStats();
+    NSMutableDictionary<NSString *, NSNumber *> *stats = [@{
+        @"readEvents":       @(s.readEvents),
+        @"packetsRead":      @(s.packetsRead),
+        @"bytesRead":        @(s.bytesRead),
+        @"largePackets":     @(s.largePackets),
+        @"truncatedPackets": @(s.truncatedPackets),
+        @"badHeaders":       @(s.badHeaders),
+        @"superPackets":     @(s.superPackets),
+        @"softwareSegments": @(s.softwareSegments),
+        @"groMerged":        @(s.groMerged),
+        @"groPackets":       @(s.groPackets),
+    } mutableCopy];
+    if (_udpSink) {
+        hs::UDPPacketSinkStats f = _udpSink->stats();
+        stats[@"forwardedPackets"] = @(f.sent);
+        stats[@"forwardDrops"] = @(f.dropped);
+    }
+    return stats;
 }
 
 @end
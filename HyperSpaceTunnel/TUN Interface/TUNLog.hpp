@@ -0,0 +1,55 @@
+//
+//  TUNLog.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+// HS_LOG takes os_log style formats, privacy annotations included, and
+// goes to the unified log on Apple platforms and to stderr elsewhere.
+
+#if defined(__APPLE__)
+
+#include <os/log.h>
+
+#define HS_LOG(format, ...) os_log(OS_LOG_DEFAULT, format, ##__VA_ARGS__)
+
+#else
+
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+
+namespace hs::detail {
+    // Drops the {public} / {private} annotations printf doesn't understand
+    inline void logToStderr(const char *format, ...) {
+        std::string plain;
+        for (const char *p = format; *p != '\0'; ++p) {
+            plain += *p;
+            if (*p == '%' && p[1] == '{') {
+                const char *close = p + 1;
+                while (*close != '\0' && *close != '}') {
+                    ++close;
+                }
+                if (*close == '}') {
+                    p = close;
+                }
+            }
+        }
+        plain += '\n';
+
+        va_list args;
+        va_start(args, format);
+        vfprintf(stderr, plain.c_str(), args);
+        va_end(args);
+    }
+}
+
+#define HS_LOG(format, ...) hs::detail::logToStderr(format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,197 @@
+//
+//  TUNWriteQueuePolicy.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+
+#include "LatencyHistogram.hpp"
+#include "PacketBuf.hpp"
+
+namespace hs {
+    /**
+     * What TUNInterface does with a packet injected while the write
+     * queue is over its limit.
+     */
+    enum class WriteQueuePolicy {
+        // The injecting thread waits until the TUN thread has made room
+        Block,
+        // The new packet is dropped
+        DropTail,
+        // The oldest queued packets are dropped to make room for the new one. The TUN thread does the
+        // dropping, also while the fd is stalled, so a burst can run over maxPackets until it catches up.
+        // Past twice maxPackets the newest are dropped as well, and counted as DropTail's would be
+        DropHead,
+        // The new packet is dropped if it would take the queue over maxBytes, counted in droppedBudget,
+        // or over maxPackets, counted in droppedTail
+        ByteBudget
+    };
+
+    /**
+     * Active queue management run by the TUN thread in front of the utun fd.
+     */
+    enum class ActiveQueueManagement {
+        // Packets are written in the order they were injected
+        None,
+        // A single CoDel queue (RFC 8289)
+        CoDel,
+        // Per-flow CoDel queues served deficit round robin (RFC 8290)
+        FQCoDel
+    };
+
+    struct WriteQueueConfig {
+        WriteQueuePolicy policy = WriteQueuePolicy::DropTail;
+        // Counts every packet not yet written, those held by CoDel or FQ-CoDel included, so it bounds
+        // the AQM stage under every policy. DropHead alone may run over it for a moment
+        size_t maxPackets = 4096;
+        size_t maxBytes = 16 * 1024 * 1024;
+
+        ActiveQueueManagement aqm = ActiveQueueManagement::None;
+        std::chrono::nanoseconds codelTarget = std::chrono::milliseconds(5);
+        std::chrono::nanoseconds codelInterval = std::chrono::milliseconds(100);
+        size_t fqFlows = 1024;
+        size_t fqQuantum = 1514;
+
+        // Injected TCP packets longer than this are cut into segments that fit, by the device if it
+        // can and before they are queued otherwise. Anything else is written whole, for the kernel
+        // to fragment or refuse. 0 leaves every packet as it is
+        size_t mtu = 0;
+    };
+
+    /**
+     * Watermarks on the packets waiting to be written, for pausing
+     * whatever feeds the write queue before it fills, so that excess
+     * load backs up in the feeder's own socket buffer instead.
+     */
+    struct BackpressureConfig {
+        // The feeder is told to pause once this many packets are queued, which should be under
+        // maxPackets so it happens before the policy starts dropping. 0 never pauses it
+        size_t highWatermark = 0;
+        // And to resume once the TUN thread has written the queue back down to this many
+        size_t lowWatermark = 0;
+    };
+
+    /**
+     * A packet waiting to be written to the utun fd. The utun header is
+     * not stored, it's supplied by the write itself.
+     */
+    struct QueuedPacket {
+        // The IP packet
+        PacketBuf buf;
+        // steady_clock time of injection, in nanoseconds
+        uint64_t enqueuedAt = 0;
+    };
+
+    /**
+     * A point in time copy of the write queue counters.
+     */
+    struct WriteQueueStats {
+        uint64_t enqueued = 0;
+        uint64_t written = 0;
+        uint64_t writeErrors = 0;
+        // Injected packets turned away for the queue holding maxPackets
+        uint64_t droppedTail = 0;
+        // Injected packets turned away by ByteBudget for taking the queue over maxBytes
+        uint64_t droppedBudget = 0;
+        uint64_t droppedHead = 0;
+        uint64_t droppedAQM = 0;
+        // Injected TCP packets over the MTU that were segmented in software, and the segments they became
+        uint64_t segmentedPackets = 0;
+        uint64_t segmentsCreated = 0;
+        uint64_t queuedPackets = 0;
+        uint64_t queuedBytes = 0;
+        uint64_t highWaterPackets = 0;
+        uint64_t highWaterBytes = 0;
+        // Times the queue crossed the high watermark and paused the feeder
+        uint64_t ingressPauses = 0;
+        // Times a packet was queued for a TUN thread with nothing to write, and had to wake it
+        uint64_t wakeups = 0;
+        // From a packet being queued to its write being issued, in nanoseconds
+        uint64_t writeLatencyP50 = 0;
+        uint64_t writeLatencyP99 = 0;
+    };
+
+    /**
+     * The live write queue counters, updated by both the injecting
+     * thread and the TUN thread.
+     */
+    struct WriteQueueCounters {
+        std::atomic<uint64_t> enqueued = 0;
+        std::atomic<uint64_t> written = 0;
+        std::atomic<uint64_t> writeErrors = 0;
+        std::atomic<uint64_t> droppedTail = 0;
+        std::atomic<uint64_t> droppedBudget = 0;
+        std::atomic<uint64_t> droppedHead = 0;
+        std::atomic<uint64_t> droppedAQM = 0;
+        std::atomic<uint64_t> segmentedPackets = 0;
+        std::atomic<uint64_t> segmentsCreated = 0;
+        std::atomic<uint64_t> queuedPackets = 0;
+        std::atomic<uint64_t> queuedBytes = 0;
+        std::atomic<uint64_t> highWaterPackets = 0;
+        std::atomic<uint64_t> highWaterBytes = 0;
+        std::atomic<uint64_t> ingressPauses = 0;
+        std::atomic<uint64_t> wakeups = 0;
+
+        // TUN thread only records, as it issues each write
+        LatencyHistogram writeLatency;
+
+        // Called before a packet is pushed, so the TUN thread never sees it uncounted
+        void reserve(size_t bytes) {
+            queuedPackets.fetch_add(1, std::memory_order_relaxed);
+            queuedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        // Called once the push has succeeded
+        void commit() {
+            enqueued.fetch_add(1, std::memory_order_relaxed);
+            raise(highWaterPackets, queuedPackets.load(std::memory_order_relaxed));
+            raise(highWaterBytes, queuedBytes.load(std::memory_order_relaxed));
+        }
+
+        void removed(size_t bytes) {
+            queuedPackets.fetch_sub(1, std::memory_order_relaxed);
+            queuedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+
+        WriteQueueStats snapshot() const {
+            WriteQueueStats s;
+            s.enqueued = enqueued.load(std::memory_order_relaxed);
+            s.written = written.load(std::memory_order_relaxed);
+            s.writeErrors = writeErrors.load(std::memory_order_relaxed);
+            s.droppedTail = droppedTail.load(std::memory_order_relaxed);
+            s.droppedBudget = droppedBudget.load(std::memory_order_relaxed);
+            s.droppedHead = droppedHead.load(std::memory_order_relaxed);
+            s.droppedAQM = droppedAQM.load(std::memory_order_relaxed);
+            s.segmentedPackets = segmentedPackets.load(std::memory_order_relaxed);
+            s.segmentsCreated = segmentsCreated.load(std::memory_order_relaxed);
+            s.queuedPackets = queuedPackets.load(std::memory_order_relaxed);
+            s.queuedBytes = queuedBytes.load(std::memory_order_relaxed);
+            s.highWaterPackets = highWaterPackets.load(std::memory_order_relaxed);
+            s.highWaterBytes = highWaterBytes.load(std::memory_order_relaxed);
+            s.ingressPauses = ingressPauses.load(std::memory_order_relaxed);
+            s.wakeups = wakeups.load(std::memory_order_relaxed);
+            s.writeLatencyP50 = writeLatency.percentile(0.50);
+            s.writeLatencyP99 = writeLatency.percentile(0.99);
+            return s;
+        }
+
+    private:
+        static void raise(std::atomic<uint64_t> &mark, uint64_t value) {
+            uint64_t current = mark.load(std::memory_order_relaxed);
+            while (value > current &&
+                   !mark.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+            }
+        }
+    };
+}
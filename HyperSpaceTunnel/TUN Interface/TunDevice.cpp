@@ -0,0 +1,111 @@
+//
+//  TunDevice.cpp
+//  HyperSpaceTunnel
+//
+
+#include "TunDevice.hpp"
+#include "TUNLog.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace hs {
+
+    void TunDevice::prepare() {
+        int flags = fcntl(fd(), F_GETFL, 0);
+        if (flags < 0 || fcntl(fd(), F_SETFL, flags | O_NONBLOCK) < 0) {
+            HS_LOG("Failed to make TUN fd non-blocking: %{public}s", strerror(errno));
+        }
+    }
+
+    // utun and its stand-ins prefix each packet with its address family, in network byte order
+    static void writeAddressFamily(const uint8_t *packet, uint8_t *header) {
+        header[0] = 0x00;
+        header[1] = 0x00;
+        header[2] = 0x00;
+        header[3] = (packet[0] >> 4) == 6 ? AF_INET6 : AF_INET;
+    }
+
+    UtunDevice::UtunDevice(int fd)
+        : tunFD(fd) {
+    }
+
+    UtunDevice::~UtunDevice() {
+        close();
+    }
+
+    void UtunDevice::writeHeader(PacketBuf &packet, uint8_t *header) const {
+        writeAddressFamily(packet.data(), header);
+    }
+
+    void UtunDevice::prepare() {
+        // Set buffer sizes to 128 KB before handing off to the event loop
+        int bufferSize = 128 * 1024;
+
+        if (setsockopt(tunFD, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize)) < 0) {
+            HS_LOG("Failed to set receive buffer size: %{public}s", strerror(errno));
+        }
+
+        if (setsockopt(tunFD, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize)) < 0) {
+            HS_LOG("Failed to set send buffer size: %{public}s", strerror(errno));
+        }
+
+        TunDevice::prepare();
+    }
+
+    void UtunDevice::close() {
+        if (tunFD >= 0) {
+            ::close(tunFD);
+            tunFD = -1;
+        }
+    }
+
+    std::unique_ptr<FakeTunDevice> FakeTunDevice::create(size_t headerLength) {
+        int ends[2];
+
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, ends) < 0) {
+            HS_LOG("Failed to create fake TUN socketpair: %{public}s", strerror(errno));
+            return nullptr;
+        }
+
+        // Room for a full read batch of jumbo packets in each direction
+        int bufferSize = 4 * 1024 * 1024;
+        for (int end : ends) {
+            setsockopt(end, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+            setsockopt(end, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+        }
+
+        return std::unique_ptr<FakeTunDevice>(new FakeTunDevice(ends[0], ends[1], headerLength));
+    }
+
+    FakeTunDevice::FakeTunDevice(int deviceEnd, int peerEnd, size_t headerLength)
+        : ends { deviceEnd, peerEnd }
+        , headerLen(headerLength) {
+    }
+
+    FakeTunDevice::~FakeTunDevice() {
+        close();
+        if (ends[1] >= 0) {
+            ::close(ends[1]);
+            ends[1] = -1;
+        }
+    }
+
+    void FakeTunDevice::writeHeader(PacketBuf &packet, uint8_t *header) const {
+        if (headerLen == 4) {
+            writeAddressFamily(packet.data(), header);
+        } else if (headerLen > 0) {
+            memset(header, 0, headerLen);
+        }
+    }
+
+    void FakeTunDevice::close() {
+        if (ends[0] >= 0) {
+            ::close(ends[0]);
+            ends[0] = -1;
+        }
+    }
+}
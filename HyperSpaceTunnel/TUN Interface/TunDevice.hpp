@@ -0,0 +1,119 @@
+//
+//  TunDevice.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "PacketBuf.hpp"
+
+namespace hs {
+    /**
+     * The platform TUN device TUNInterface reads and writes packets through.
+     *
+     * Each packet on the fd may be framed by a fixed-length header in front
+     * of the IP packet, like the 4-byte address family utun uses. The
+     * device owns its fd and closes it in close() or on destruction.
+     */
+    class TunDevice {
+    public:
+        virtual ~TunDevice() = default;
+
+        virtual int fd() const = 0;
+
+        // Bytes in front of every packet read from or written to fd(), at most 16
+        virtual size_t headerLength() const = 0;
+
+        // Fills in headerLength() bytes at header for packet. May rewrite the packet, unsharing it first
+        virtual void writeHeader(PacketBuf &packet, uint8_t *header) const = 0;
+
+        // Strips the header from a packet just read, keeping any offload metadata it carries.
+        // Returns false if the packet should be dropped.
+        virtual bool readHeader(PacketBuf &packet) const {
+            packet.pull(headerLength());
+            return true;
+        }
+
+        /**
+         * Whether a TCP super-packet, marked with its segment size, can be
+         * written as it is for the kernel to segment. UDP and anything
+         * else longer than the MTU is written whole either way, unless
+         * its builder gave a segment size.
+         */
+        virtual bool segmentsLargePackets() const {
+            return false;
+        }
+
+        /**
+         * Whether a UDP super-packet, marked with the segment size its
+         * builder gave, can be written as it is for the kernel to cut
+         * into datagrams.
+         */
+        virtual bool segmentsUDPPackets() const {
+            return false;
+        }
+
+        // Called on the TUN thread before the event loop starts. Makes fd() non-blocking
+        virtual void prepare();
+
+        virtual void close() = 0;
+    };
+
+    /**
+     * A macOS / iOS utun fd, as handed over by NetworkExtension.
+     */
+    class UtunDevice final : public TunDevice {
+    public:
+        explicit UtunDevice(int fd);
+        ~UtunDevice() override;
+
+        UtunDevice(const UtunDevice&) = delete;
+        UtunDevice& operator=(const UtunDevice&) = delete;
+
+        int fd() const override { return tunFD; }
+        size_t headerLength() const override { return 4; }
+        void writeHeader(PacketBuf &packet, uint8_t *header) const override;
+        void prepare() override;
+        void close() override;
+
+    private:
+        int tunFD;
+    };
+
+    /**
+     * A TUN device without a real interface behind it, for tests and
+     * benchmarks. TUNInterface gets one end of a datagram socketpair, and
+     * the test drives the other through peerFD(), which sees exactly what
+     * a kernel TUN driver would.
+     */
+    class FakeTunDevice final : public TunDevice {
+    public:
+        // headerLength 4 frames packets like utun, 0 like Linux IFF_NO_PI
+        static std::unique_ptr<FakeTunDevice> create(size_t headerLength = 0);
+        ~FakeTunDevice() override;
+
+        FakeTunDevice(const FakeTunDevice&) = delete;
+        FakeTunDevice& operator=(const FakeTunDevice&) = delete;
+
+        int fd() const override { return ends[0]; }
+        int peerFD() const { return ends[1]; }
+        size_t headerLength() const override { return headerLen; }
+        void writeHeader(PacketBuf &packet, uint8_t *header) const override;
+        void close() override;
+
+    private:
+        FakeTunDevice(int deviceEnd, int peerEnd, size_t headerLength);
+
+        int ends[2];
+        size_t headerLen;
+    };
+}
@@ -0,0 +1,123 @@
+//
+//  UDPPacketSink.cpp
+//  HyperSpaceTunnel
+//
+
+#include "UDPPacketSink.hpp"
+#include "TUNLog.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace hs {
+
+    UDPPacketSink::UDPPacketSink(int socketFD,
+                                 const std::string &host,
+                                 uint16_t port) {
+        fd = dup(socketFD);
+        if (fd < 0) {
+            HS_LOG("Failed to duplicate the data plane socket: %{public}s", strerror(errno));
+        }
+
+        memset(&destination, 0, sizeof(destination));
+#if defined(__APPLE__)
+        destination.sin_len = sizeof(destination);
+#endif
+        destination.sin_family = AF_INET;
+        destination.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &destination.sin_addr) != 1) {
+            HS_LOG("Invalid data plane destination %{public}s", host.c_str());
+        }
+    }
+
+    UDPPacketSink::~UDPPacketSink() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    void UDPPacketSink::send(PacketBatch &packets) {
+        // Scratch space lives on the stack so queues on several threads can share one sink
+        struct iovec iovecs[maxChunk];
+        size_t count = 0;
+
+        for (PacketBuf &packet : packets) {
+            // The external app only takes IPv4
+            if (packet.empty() || (packet.data()[0] >> 4) != 4) {
+                continue;
+            }
+
+            iovecs[count].iov_base = packet.data();
+            iovecs[count].iov_len = packet.size();
+            count += 1;
+
+            if (count == maxChunk) {
+                sendChunk(iovecs, count);
+                count = 0;
+            }
+        }
+
+        if (count > 0) {
+            sendChunk(iovecs, count);
+        }
+    }
+
+    void UDPPacketSink::sendChunk(struct iovec *iovecs, size_t count) {
+        if (fd < 0) {
+            dropped.fetch_add(count, std::memory_order_relaxed);
+            return;
+        }
+
+        uint64_t ok = 0;
+
+#if defined(__linux__)
+        // One system call for the whole chunk
+        struct mmsghdr messages[maxChunk];
+        memset(messages, 0, sizeof(struct mmsghdr) * count);
+        for (size_t i = 0; i < count; ++i) {
+            messages[i].msg_hdr.msg_name = &destination;
+            messages[i].msg_hdr.msg_namelen = sizeof(destination);
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        size_t done = 0;
+        while (done < count) {
+            int n = sendmmsg(fd, messages + done, static_cast<unsigned int>(count - done), 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                // The first unsent message failed on its own, skip past it
+                done += 1;
+                continue;
+            }
+            done += static_cast<size_t>(n);
+            ok += static_cast<uint64_t>(n);
+        }
+#else
+        for (size_t i = 0; i < count; ++i) {
+            ssize_t n = sendto(fd, iovecs[i].iov_base, iovecs[i].iov_len, 0,
+                               reinterpret_cast<const struct sockaddr *>(&destination), sizeof(destination));
+            if (n >= 0) {
+                ok += 1;
+            }
+        }
+#endif
+
+        sent.fetch_add(ok, std::memory_order_relaxed);
+        dropped.fetch_add(count - ok, std::memory_order_relaxed);
+    }
+
+    UDPPacketSinkStats UDPPacketSink::stats() const {
+        UDPPacketSinkStats s;
+        s.sent = sent.load(std::memory_order_relaxed);
+        s.dropped = dropped.load(std::memory_order_relaxed);
+        return s;
+    }
+}
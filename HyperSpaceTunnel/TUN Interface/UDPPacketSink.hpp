@@ -0,0 +1,67 @@
+//
+//  UDPPacketSink.hpp
+//  HyperSpaceTunnel
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "PacketSink.hpp"
+
+namespace hs {
+    /**
+     * A point in time copy of a UDPPacketSink's counters.
+     */
+    struct UDPPacketSinkStats {
+        uint64_t sent = 0;
+        uint64_t dropped = 0;
+    };
+
+    /**
+     * Sends each IPv4 packet as one UDP datagram to a fixed destination,
+     * which is how the external app receives what the tunnel reads.
+     *
+     * The socket is a dup of one the caller opened, so datagrams keep the
+     * source address the external app already knows, and the sink can
+     * outlive the caller's copy. The socket must be non-blocking. A packet
+     * the socket has no room for is dropped and counted rather than waited
+     * on. send() is safe to call from several threads at once.
+     */
+    class UDPPacketSink final : public PacketSink {
+    public:
+        UDPPacketSink(int socketFD,
+                      const std::string &host,
+                      uint16_t port);
+        ~UDPPacketSink() override;
+
+        UDPPacketSink(const UDPPacketSink&) = delete;
+        UDPPacketSink& operator=(const UDPPacketSink&) = delete;
+
+        void send(PacketBatch &packets) override;
+
+        UDPPacketSinkStats stats() const;
+
+    private:
+        static constexpr size_t maxChunk = 64;
+
+        void sendChunk(struct iovec *iovecs, size_t count);
+
+        int fd;
+        struct sockaddr_in destination;
+
+        std::atomic<uint64_t> sent = 0;
+        std::atomic<uint64_t> dropped = 0;
+    };
+}
@@ -15,16 +15,24 @@ final class DataEndpoint {
     private let fd: Int32
     private var source: DispatchSourceRead?
     private let queue = DispatchQueue(label: "dataEndpoint.queue")
+    // Only touched on queue. A suspended source must be resumed before it can be cancelled
+    private var readingPaused = false
+
+    // Where packets read from the tunnel go, for the external app
+    static let replyHost = "127.0.0.1"
+    static let replyPort: UInt16 = 5502
 
     private var outgoingPacketDestination: sockaddr_in = {
         var addr = sockaddr_in()
         addr.sin_len = UInt8(MemoryLayout<sockaddr_in>.size)
         addr.sin_family = sa_family_t(AF_INET)
-        addr.sin_port = CFSwapInt16HostToBig(5502)
-        addr.sin_addr.s_addr = inet_addr("127.0.0.1")
+        addr.sin_port = CFSwapInt16HostToBig(DataEndpoint.replyPort)
+        addr.sin_addr.s_addr = inet_addr(DataEndpoint.replyHost)
         return addr
     }()
 
+    var socketFD: Int32 { fd }
+
     init?(port: UInt16) {
         let sock = socket(AF_INET, SOCK_DGRAM, 0)
         guard sock >= 0 else { return nil }
@@ -94,5 +102,31 @@ final class DataEndpoint {
         }
     }
 
-    func stop() { source?.cancel(); source = nil }
+    // Datagrams that arrive meanwhile wait in the socket's receive buffer, and past that are dropped by the kernel
+    func pauseReading() {
+        queue.async { [weak self] in
+            guard let self, let source = self.source, !self.readingPaused else { return }
+            source.suspend()
+            self.readingPaused = true
+        }
+    }
+
+    func resumeReading() {
+        queue.async { [weak self] in
+            guard let self, let source = self.source, self.readingPaused else { return }
+            source.resume()
+            self.readingPaused = false
+        }
+    }
+
+    func stop() {
+        queue.sync {
+            if readingPaused {
+                source?.resume()
+                readingPaused = false
+            }
+            source?.cancel()
+            source = nil
+        }
+    }
 }
@@ -41,12 +41,26 @@ final class DataServer {
             self.bridge.writePacket(toTun: data)
         }
         endpoint.start()
+
+        // Packets read from the tunnel go out on the endpoint's socket straight from the TUN thread
+        bridge.forwardOutboundPackets(toUDPSocket: endpoint.socketFD,
+                                      host: DataEndpoint.replyHost,
+                                      port: DataEndpoint.replyPort)
     }
 
     func stop() {
         endpoint.stop()
     }
 
+    // Back pressure from the TUN write queue, passed on to the socket the external app writes to
+    func pauseIngress() {
+        endpoint.pauseReading()
+    }
+
+    func resumeIngress() {
+        endpoint.resumeReading()
+    }
+
     func sendPacketsToExternalApp(_ ipv4Packet: [UInt8]) {
         guard let b0 = ipv4Packet.first, (b0 >> 4) == 4 else { return }
         endpoint.reply(ipv4Packet)
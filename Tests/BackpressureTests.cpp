@@ -0,0 +1,80 @@
+//
+//  BackpressureTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Fills the write queue of a stalled fake device past its high watermark and drains it back under
+// the low one, checking the feeder is told to pause and to resume exactly once each, in that order,
+// as the queue crosses 3072 and 1024 packets
+
+#include "TestSupport.hpp"
+#include "TUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#include <mutex>
+#include <sys/socket.h>
+
+using namespace hs;
+
+struct Crossing {
+    bool paused;
+    // Packets queued when the call back ran
+    uint64_t queued;
+};
+
+static void testPauseAndResumeOnce() {
+    auto device = FakeTunDevice::create(0);
+    const int peer = device->peerFD();
+    // Stalled after a packet or two until the peer is read
+    int bufferSize = 1;
+    setsockopt(device->fd(), SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+
+    WriteQueueConfig config;
+    config.maxPackets = 4096;
+    TUNInterface tun(std::move(device), config);
+
+    std::mutex mutex;
+    std::vector<Crossing> crossings;
+    tun.setBackpressure(BackpressureConfig{ .highWatermark = 3072, .lowWatermark = 1024 }, [&](bool paused) {
+        std::lock_guard<std::mutex> lock(mutex);
+        crossings.push_back({ paused, tun.writeQueueStats().queuedPackets });
+    });
+    tun.start();
+
+    // Well past the high watermark, and short of maxPackets so none are dropped
+    constexpr size_t injected = 4000;
+    const std::vector<uint8_t> packet = test::udpPacket(100);
+    for (size_t i = 0; i < injected; ++i) {
+        tun.enqueueWrite(packet);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        HS_CHECK(crossings.size() == 1);
+        HS_CHECK(crossings[0].paused);
+        HS_CHECK(crossings[0].queued >= 3072);
+    }
+    HS_CHECK(tun.writeQueueStats().droppedTail == 0);
+
+    size_t received = 0;
+    HS_CHECK(test::waitFor([&] {
+        uint8_t buffer[2048];
+        while (recv(peer, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+            received += 1;
+        }
+        return received == injected;
+    }));
+    tun.stop();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    HS_CHECK(crossings.size() == 2);
+    HS_CHECK(!crossings[1].paused);
+    HS_CHECK(crossings[1].queued <= 1024);
+    HS_CHECK(tun.writeQueueStats().ingressPauses == 1);
+}
+
+int main() {
+    std::printf("pause and resume once\n");
+    testPauseAndResumeOnce();
+    std::printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,135 @@
+//
+//  CoDelTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Runs CoDel on a simulated clock, holding every packet's sojourn time at a chosen value, and
+// checks when it drops against RFC 8289: never under target, first after one interval above
+// it, then interval/sqrt(count) apart. Then checks FQ-CoDel serves a sparse flow first
+
+#include "TestSupport.hpp"
+#include "CoDel.hpp"
+
+#include <cmath>
+
+using namespace hs;
+
+static constexpr uint64_t millisecond = 1000000;
+static constexpr uint64_t target = 5 * millisecond;
+static constexpr uint64_t interval = 100 * millisecond;
+static constexpr size_t packetSize = 1000;
+
+static QueuedPacket packetAt(uint64_t enqueuedAt, uint16_t sourcePort = 1000) {
+    const std::vector<uint8_t> bytes = test::udpPacket(packetSize, sourcePort);
+    QueuedPacket packet;
+    packet.buf = PacketBuf::copyOf(bytes.data(), bytes.size());
+    packet.enqueuedAt = enqueuedAt;
+    return packet;
+}
+
+// Dequeues once every step from start until end, with the queue refilled before each dequeue to
+// ten packets that have all waited sojourn, and returns when each drop happened
+static std::vector<uint64_t> run(CoDelQueue &codel, uint64_t sojourn, uint64_t start, uint64_t end, uint64_t step) {
+    std::vector<uint64_t> drops;
+    for (uint64_t now = start; now < end; now += step) {
+        while (codel.dropHead().has_value()) {
+        }
+        for (int i = 0; i < 10; ++i) {
+            codel.enqueue(packetAt(now - sojourn));
+        }
+        HS_CHECK(codel.dequeue(now, [&](QueuedPacket &) { drops.push_back(now); }).has_value());
+    }
+    return drops;
+}
+
+static void testNoDropUnderTarget() {
+    CoDelQueue codel(target, interval, packetSize);
+    HS_CHECK(run(codel, target - 1, 10 * interval, 60 * interval, millisecond).empty());
+
+    // Nor when less than one packet stays queued behind the head, however long it waited
+    CoDelQueue shallow(target, interval, packetSize);
+    for (uint64_t now = 10 * interval; now < 60 * interval; now += millisecond) {
+        shallow.enqueue(packetAt(now - 10 * target));
+        HS_CHECK(shallow.dequeue(now, [](QueuedPacket &) { HS_CHECK(false); }).has_value());
+    }
+}
+
+static void testFirstDropAfterInterval() {
+    CoDelQueue codel(target, interval, packetSize);
+    const uint64_t start = 10 * interval;
+    const std::vector<uint64_t> drops = run(codel, 2 * target, start, start + interval + millisecond, millisecond);
+    HS_CHECK(drops.size() == 1);
+    HS_CHECK(drops[0] == start + interval);
+}
+
+static void testDropSpacing() {
+    CoDelQueue codel(target, interval, packetSize);
+    const uint64_t start = 10 * interval;
+    const uint64_t step = 10000;
+    const std::vector<uint64_t> drops = run(codel, 2 * target, start, start + 30 * interval, step);
+
+    // The first drop starts count at 1, and each drop after it comes interval/sqrt(count) after the one before
+    HS_CHECK(drops.size() > 10);
+    HS_CHECK(drops[0] == start + interval);
+    uint64_t scheduled = drops[0];
+    for (size_t i = 1; i < drops.size(); ++i) {
+        scheduled += static_cast<uint64_t>(static_cast<double>(interval) / std::sqrt(static_cast<double>(i)));
+        HS_CHECK(drops[i] >= scheduled && drops[i] < scheduled + step);
+    }
+
+    // Once the sojourn time falls back under target the drops stop
+    HS_CHECK(run(codel, target - 1, start + 30 * interval, start + 60 * interval, step).empty());
+}
+
+// Which of the ports a packet came from, by its UDP source port
+static uint16_t sourcePortOf(const QueuedPacket &packet) {
+    return test::read16(packet.buf.data() + 20);
+}
+
+// A packet from a new flow goes out ahead of a flow that has built up a queue, where plain CoDel
+// makes it wait behind that queue
+static void testSparseFlowFirst() {
+    constexpr uint16_t bulk = 1;
+    for (size_t flowCount : {1024, 1}) {
+        FQCoDelScheduler scheduler(flowCount, 1514, target, interval, [](QueuedPacket &) { HS_CHECK(false); });
+        for (int i = 0; i < 100; ++i) {
+            scheduler.enqueue(packetAt(0, bulk));
+        }
+        // Past its first quantum, so the bulk flow is on the old list
+        for (int i = 0; i < 3; ++i) {
+            HS_CHECK(sourcePortOf(*scheduler.dequeue(0)) == bulk);
+        }
+
+        // Several sparse flows, since any one of them could hash onto the bulk flow's queue
+        for (uint16_t port = 2; port < 10; ++port) {
+            scheduler.enqueue(packetAt(0, port));
+        }
+
+        const uint16_t next = sourcePortOf(*scheduler.dequeue(0));
+        if (flowCount > 1) {
+            HS_CHECK(next != bulk);
+        } else {
+            HS_CHECK(next == bulk);
+        }
+
+        size_t left = 0;
+        while (scheduler.dequeue(0).has_value()) {
+            left += 1;
+        }
+        HS_CHECK(left == 100 + 8 - 4);
+        HS_CHECK(scheduler.empty());
+    }
+}
+
+int main() {
+    std::printf("no drop under target\n");
+    testNoDropUnderTarget();
+    std::printf("first drop after one interval\n");
+    testFirstDropAfterInterval();
+    std::printf("drop spacing\n");
+    testDropSpacing();
+    std::printf("sparse flow first\n");
+    testSparseFlowFirst();
+    std::printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+//
+//  DoorbellTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Checks that a burst of packets injected while the TUN thread is idle rings its doorbell once,
+// not once per packet, and that no packet is left unwritten when one is queued just as the TUN
+// thread runs dry and re-arms the doorbell
+
+#include "TestSupport.hpp"
+#include "TUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#include <atomic>
+#include <sys/socket.h>
+#include <thread>
+
+using namespace hs;
+
+static constexpr size_t packetSize = 200;
+
+// Reads the peer until count packets have arrived, and returns how many did
+static size_t receive(int peer, size_t count) {
+    size_t received = 0;
+    test::waitFor([&] {
+        uint8_t packet[2048];
+        while (recv(peer, packet, sizeof(packet), MSG_DONTWAIT) > 0) {
+            received += 1;
+        }
+        return received >= count;
+    });
+    return received;
+}
+
+// Holds the TUN thread in a read handler while a burst is injected, so the burst can only
+// find the doorbell armed for its first packet however the threads are scheduled
+static void testBurstRingsOnce() {
+    auto device = FakeTunDevice::create(0);
+    const int peer = device->peerFD();
+    TUNInterface tun(std::move(device));
+
+    std::atomic<bool> inHandler = false;
+    std::atomic<bool> release = false;
+    tun.setOutgoingPacketCallBack([&](PacketBatch &) {
+        inHandler = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    });
+    tun.start();
+
+    // Nothing queued yet, so starting armed the doorbell without ringing it
+    const std::vector<uint8_t> packet = test::udpPacket(packetSize);
+    HS_CHECK(send(peer, packet.data(), packet.size(), 0) == static_cast<ssize_t>(packet.size()));
+    HS_CHECK(test::waitFor([&] { return inHandler.load(); }));
+    HS_CHECK(tun.writeQueueStats().wakeups == 0);
+
+    constexpr size_t burst = 64;
+    for (size_t i = 0; i < burst; ++i) {
+        tun.enqueueWrite(packet);
+    }
+    HS_CHECK(tun.writeQueueStats().wakeups == 1);
+
+    release = true;
+    HS_CHECK(receive(peer, burst) == burst);
+
+    // Written out and armed again, so the next burst rings once more
+    HS_CHECK(test::waitFor([&] { return tun.writeQueueStats().queuedPackets == 0; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (size_t i = 0; i < burst; ++i) {
+        tun.enqueueWrite(packet);
+    }
+    HS_CHECK(receive(peer, burst) == burst);
+    const WriteQueueStats stats = tun.writeQueueStats();
+    HS_CHECK(stats.wakeups >= 2 && stats.wakeups < 2 + burst);
+    HS_CHECK(stats.written == 2 * burst);
+    tun.stop();
+}
+
+// One packet at a time, each waited for, so every one is queued to an idle TUN thread
+static void testSinglePacketsAfterRearm() {
+    auto device = FakeTunDevice::create(0);
+    const int peer = device->peerFD();
+    TUNInterface tun(std::move(device));
+    tun.start();
+
+    const std::vector<uint8_t> packet = test::udpPacket(packetSize);
+    for (int i = 0; i < 200; ++i) {
+        tun.enqueueWrite(packet);
+        HS_CHECK(receive(peer, 1) == 1);
+    }
+    HS_CHECK(tun.writeQueueStats().wakeups <= 200);
+    tun.stop();
+}
+
+// A producer injecting in short bursts with gaps, so packets keep landing while the TUN thread is
+// between running dry and re-arming. One left behind would never be written
+static void testNothingStranded() {
+    auto device = FakeTunDevice::create(0);
+    const int peer = device->peerFD();
+    // However far the producer gets ahead, nothing is dropped
+    WriteQueueConfig config;
+    config.policy = WriteQueuePolicy::Block;
+    TUNInterface tun(std::move(device), config);
+    tun.start();
+
+    constexpr size_t packets = 50000;
+    std::atomic<size_t> received = 0;
+    std::thread reader([&] {
+        received = receive(peer, packets);
+    });
+
+    const std::vector<uint8_t> packet = test::udpPacket(packetSize);
+    for (size_t i = 0; i < packets; ++i) {
+        tun.enqueueWrite(packet);
+        if (i % 7 == 0) {
+            std::this_thread::yield();
+        }
+    }
+    reader.join();
+
+    const WriteQueueStats stats = tun.writeQueueStats();
+    HS_CHECK(received == packets);
+    HS_CHECK(stats.written == packets);
+    HS_CHECK(stats.droppedTail == 0);
+    HS_CHECK(stats.wakeups > 0 && stats.wakeups <= packets);
+    tun.stop();
+}
+
+int main() {
+    std::printf("burst rings once\n");
+    testBurstRingsOnce();
+    std::printf("single packets after re-arm\n");
+    testSinglePacketsAfterRearm();
+    std::printf("nothing stranded\n");
+    testNothingStranded();
+    std::printf("ok\n");
+    return 0;
+}
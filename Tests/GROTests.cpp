@@ -0,0 +1,293 @@
+//
+//  GROTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Feeds GROTable TCP segments and checks what it releases: merged packets with their lengths
+// and checksums recomputed, and the pushes, short segments, gaps, option changes, limits and
+// corrupt segments that end a merge or keep a segment out of one
+
+#include "TestSupport.hpp"
+#include "GRO.hpp"
+
+using namespace hs;
+
+static constexpr uint8_t ACK = 0x10;
+static constexpr uint8_t PSH = 0x08;
+
+static PacketBuf segmentAt(int version, uint32_t sequence, size_t payload, uint8_t flags = ACK,
+                           uint16_t sourcePort = 40000, std::vector<uint8_t> options = {}) {
+    test::TCPSegment segment;
+    segment.version = version;
+    segment.sequence = sequence;
+    segment.payload = payload;
+    segment.flags = flags;
+    segment.sourcePort = sourcePort;
+    segment.options = std::move(options);
+    const std::vector<uint8_t> bytes = test::tcpPacket(segment);
+    return PacketBuf::copyOf(bytes.data(), bytes.size());
+}
+
+// A timestamp option, padded with two no-ops
+static std::vector<uint8_t> timestamp(uint32_t value) {
+    std::vector<uint8_t> option = { 1, 1, 8, 10, 0, 0, 0, 0, 0, 0, 0, 0 };
+    test::write32(&option[4], value);
+    return option;
+}
+
+static size_t headersFor(int version, size_t options = 0) {
+    return (version == 4 ? 40 : 60) + options;
+}
+
+static uint32_t sequenceOf(const PacketBuf &packet) {
+    const size_t ipHeader = (packet.data()[0] >> 4) == 4 ? 20 : 40;
+    return test::read32(packet.data() + ipHeader + 4);
+}
+
+// A whole packet GRO released: its lengths and checksums hold, and its payload runs on from its sequence number
+static void checkPacket(const PacketBuf &packet, size_t payload, size_t options = 0) {
+    const uint8_t *p = packet.data();
+    const bool v4 = (p[0] >> 4) == 4;
+    const size_t headers = headersFor(v4 ? 4 : 6, options);
+
+    HS_CHECK(packet.size() == headers + payload);
+    if (v4) {
+        HS_CHECK(test::read16(p + 2) == packet.size());
+    } else {
+        HS_CHECK(test::read16(p + 4) + 40u == packet.size());
+    }
+    HS_CHECK(test::ipChecksumHolds(p));
+    HS_CHECK(test::transportChecksumHolds(p, packet.size()));
+
+    const uint32_t sequence = sequenceOf(packet);
+    for (size_t i = 0; i < payload; ++i) {
+        HS_CHECK(p[headers + i] == test::payloadByte(sequence + static_cast<uint32_t>(i)));
+    }
+}
+
+static void testInOrderMerge(int version, size_t mss) {
+    GROTable table(GROConfig{ .enabled = true });
+    PacketBatch out;
+
+    for (uint32_t i = 0; i < 4; ++i) {
+        table.receive(segmentAt(version, 1000 + i * static_cast<uint32_t>(mss), mss), 0, out);
+    }
+    HS_CHECK(out.empty());
+    table.flush(out);
+
+    HS_CHECK(out.size() == 1);
+    checkPacket(out[0], 4 * mss);
+    HS_CHECK(sequenceOf(out[0]) == 1000);
+    HS_CHECK(out[0].offload().gsoType == (version == 4 ? PacketBuf::GSOType::TCPv4 : PacketBuf::GSOType::TCPv6));
+    HS_CHECK(out[0].offload().gsoSize == mss);
+    HS_CHECK(table.stats().merged == 3);
+    HS_CHECK(table.stats().superPackets == 1);
+    HS_CHECK(table.empty());
+}
+
+// A lone segment goes out exactly as it came
+static void testSingleSegment() {
+    GROTable table(GROConfig{ .enabled = true });
+    PacketBatch out;
+    PacketBuf segment = segmentAt(4, 1, 1000);
+    const std::vector<uint8_t> bytes(segment.data(), segment.data() + segment.size());
+
+    table.receive(std::move(segment), 0, out);
+    table.flush(out);
+    HS_CHECK(out.size() == 1);
+    HS_CHECK(std::vector<uint8_t>(out[0].data(), out[0].data() + out[0].size()) == bytes);
+    HS_CHECK(!out[0].hasOffload());
+}
+
+static void testPushEndsMerge() {
+    GROTable table(GROConfig{ .enabled = true });
+    PacketBatch out;
+
+    table.receive(segmentAt(4, 0, 1000), 0, out);
+    table.receive(segmentAt(4, 1000, 1000), 0, out);
+    table.receive(segmentAt(4, 2000, 1000, ACK | PSH), 0, out);
+
+    HS_CHECK(out.size() == 1);
+    HS_CHECK(table.empty());
+    checkPacket(out[0], 3000);
+    HS_CHECK(out[0].data()[20 + 13] & PSH);
+
+    // A push that starts a flow isn't held at all
+    table.receive(segmentAt(4, 3000, 1000, ACK | PSH), 0, out);
+    HS_CHECK(out.size() == 2);
+    HS_CHECK(table.empty());
+}
+
+static void testShortSegmentEndsMerge() {
+    GROTable table(GROConfig{ .enabled = true });
+    PacketBatch out;
+
+    table.receive(segmentAt(6, 0, 1000), 0, out);
+    table.receive(segmentAt(6, 1000, 1000), 0, out);
+    table.receive(segmentAt(6, 2000, 400), 0, out);
+
+    HS_CHECK(out.size() == 1);
+    HS_CHECK(table.empty());
+    checkPacket(out[0], 2400);
+    HS_CHECK(out[0].offload().gsoSize == 1000);
+
+    // A segment longer than the first can't be described by one segment size
+    table.receive(segmentAt(6, 2400, 500), 0, out);
+    table.receive(segmentAt(6, 2900, 1000), 0, out);
+    HS_CHECK(out.size() == 2);
+    checkPacket(out[1], 500);
+    table.flush(out);
+    HS_CHECK(out.size() == 3);
+    checkPacket(out[2], 1000);
+}
+
+// A segment that can't continue its flow's merge releases what the flow held before it
+static void testOutOfOrderFlushesFirst() {
+    GROTable table(GROConfig{ .enabled = true });
+    PacketBatch out;
+
+    table.receive(segmentAt(4, 0, 1000), 0, out);
+    table.receive(segmentAt(4, 1000, 1000), 0, out);
+    // 2000 to 3000 is missing
+    table.receive(segmentAt(4, 3000, 1000), 0, out);
+
+    HS_CHECK(out.size() == 1);
+    checkPacket(out[0], 2000);
+    HS_CHECK(sequenceOf(out[0]) == 0);
+
+    table.flush(out);
+    HS_CHECK(out.size() == 2);
+    checkPacket(out[1], 1000);
+    HS_CHECK(sequenceOf(out[1]) == 3000);
+}
+
+static void testOptionsMismatchFlushesFirst() {
+    GROTable table(GROConfig{ .enabled = true });
+    PacketBatch out;
+
+    table.receive(segmentAt(4, 0, 1000, ACK, 40000, timestamp(1)), 0, out);
+    table.receive(segmentAt(4, 1000, 1000, ACK, 40000, timestamp(1)), 0, out);
+    table.receive(segmentAt(4, 2000, 1000, ACK, 40000, timestamp(2)), 0, out);
+
+    HS_CHECK(out.size() == 1);
+    checkPacket(out[0], 2000, 12);
+    table.flush(out);
+    HS_CHECK(out.size() == 2);
+    checkPacket(out[1], 1000, 12);
+    HS_CHECK(test::read32(out[1].data() + 20 + 24) == 2);
+}
+
+static void testMaxSize() {
+    GROConfig config{ .enabled = true };
+    config.maxSize = 3000;
+    GROTable table(config);
+    PacketBatch out;
+
+    // 40 bytes of headers and two 1000 byte payloads, with no room left for a third
+    table.receive(segmentAt(4, 0, 1000), 0, out);
+    HS_CHECK(out.empty());
+    table.receive(segmentAt(4, 1000, 1000), 0, out);
+    HS_CHECK(out.size() == 1);
+    checkPacket(out[0], 2000);
+
+    table.receive(segmentAt(4, 2000, 1000), 0, out);
+    table.flush(out);
+    HS_CHECK(out.size() == 2);
+    checkPacket(out[1], 1000);
+    HS_CHECK(sequenceOf(out[1]) == 2000);
+}
+
+static void testMaxFlows() {
+    GROConfig config{ .enabled = true };
+    config.maxFlows = 2;
+    GROTable table(config);
+    PacketBatch out;
+
+    table.receive(segmentAt(4, 0, 1000, ACK, 1), 0, out);
+    table.receive(segmentAt(4, 0, 1000, ACK, 2), 0, out);
+    HS_CHECK(out.empty());
+
+    // A third flow pushes out the oldest
+    table.receive(segmentAt(4, 0, 1000, ACK, 3), 0, out);
+    HS_CHECK(out.size() == 1);
+    HS_CHECK(test::read16(out[0].data() + 20) == 1);
+
+    // The flows still held keep merging
+    table.receive(segmentAt(4, 1000, 1000, ACK, 2), 0, out);
+    table.flush(out);
+    HS_CHECK(out.size() == 3);
+    HS_CHECK(test::read16(out[1].data() + 20) == 2);
+    checkPacket(out[1], 2000);
+    HS_CHECK(test::read16(out[2].data() + 20) == 3);
+    checkPacket(out[2], 1000);
+}
+
+static void testFlushTimeout() {
+    GROConfig config{ .enabled = true };
+    config.flushTimeout = std::chrono::milliseconds(1);
+    GROTable table(config);
+    PacketBatch out;
+
+    table.receive(segmentAt(4, 0, 1000), 5000, out);
+    HS_CHECK(table.nextFlushAt() == 5000 + 1000000);
+    table.flushExpired(5000 + 999999, out);
+    HS_CHECK(out.empty());
+    table.flushExpired(5000 + 1000000, out);
+    HS_CHECK(out.size() == 1);
+    HS_CHECK(!table.nextFlushAt().has_value());
+}
+
+// A segment whose checksum doesn't hold goes on untouched, and nothing merges into or with it
+static void testBadChecksumDoesNotMerge() {
+    GROTable table(GROConfig{ .enabled = true });
+    PacketBatch out;
+
+    table.receive(segmentAt(4, 0, 1000), 0, out);
+
+    PacketBuf corrupt = segmentAt(4, 1000, 1000);
+    corrupt.data()[40 + 500] ^= 0x01;
+    const std::vector<uint8_t> corruptBytes(corrupt.data(), corrupt.data() + corrupt.size());
+    table.receive(std::move(corrupt), 0, out);
+
+    HS_CHECK(out.size() == 2);
+    checkPacket(out[0], 1000);
+    HS_CHECK(std::vector<uint8_t>(out[1].data(), out[1].data() + out[1].size()) == corruptBytes);
+    HS_CHECK(!test::transportChecksumHolds(out[1].data(), out[1].size()));
+    HS_CHECK(table.empty());
+
+    // The segment after it can't continue a merge that was never held
+    table.receive(segmentAt(4, 2000, 1000), 0, out);
+    table.flush(out);
+    HS_CHECK(out.size() == 3);
+    checkPacket(out[2], 1000);
+    HS_CHECK(table.stats().merged == 0);
+}
+
+int main() {
+    for (int version : {4, 6}) {
+        for (size_t mss : {1000, 999, 1}) {
+            std::printf("in order merge, IPv%d, %zu byte segments\n", version, mss);
+            testInOrderMerge(version, mss);
+        }
+    }
+    std::printf("single segment\n");
+    testSingleSegment();
+    std::printf("push ends merge\n");
+    testPushEndsMerge();
+    std::printf("short segment ends merge\n");
+    testShortSegmentEndsMerge();
+    std::printf("out of order flushes first\n");
+    testOutOfOrderFlushesFirst();
+    std::printf("options mismatch flushes first\n");
+    testOptionsMismatchFlushesFirst();
+    std::printf("maxSize\n");
+    testMaxSize();
+    std::printf("maxFlows\n");
+    testMaxFlows();
+    std::printf("flush timeout\n");
+    testFlushTimeout();
+    std::printf("bad checksum does not merge\n");
+    testBadChecksumDoesNotMerge();
+    std::printf("ok\n");
+    return 0;
+}
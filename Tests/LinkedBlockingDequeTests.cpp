@@ -0,0 +1,252 @@
+//
+//  LinkedBlockingDequeTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Checks that the deque's pooled nodes stop allocating once it has reached its working size,
+// that putFirst, offer, poll, remove and clear keep order and the permit counts in step,
+// and that putAll and drainTo move batches in order without losing or duplicating any
+
+#include "TestSupport.hpp"
+#include "LinkedBlockingDeque.hpp"
+
+#include <atomic>
+#include <iterator>
+#include <new>
+#include <thread>
+
+using namespace hs;
+
+// Every allocation this program makes, counted while counting is on
+static std::atomic<bool> countingAllocations = false;
+static std::atomic<size_t> allocations = 0;
+
+void *operator new(size_t size) {
+    if (countingAllocations.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void *p = std::malloc(size > 0 ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+
+static void testNoAllocationOnceWarm() {
+    LinkedBlockingDeque<int> deque;
+
+    // Grows the pool to the most the loop below ever holds
+    for (int i = 0; i < 100; ++i) {
+        deque.put(i);
+    }
+    for (int i = 0; i < 100; ++i) {
+        HS_CHECK(deque.take() == i);
+    }
+
+    allocations = 0;
+    countingAllocations = true;
+    for (int round = 0; round < 1000; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            if (i % 2 == 0) {
+                deque.put(i);
+            } else {
+                HS_CHECK(deque.offer(i));
+            }
+        }
+        for (int i = 0; i < 100; ++i) {
+            HS_CHECK(deque.poll() == i);
+        }
+    }
+    countingAllocations = false;
+    HS_CHECK(allocations == 0);
+
+    // Past the working size the pool grows a slab at a time, not a node at a time
+    countingAllocations = true;
+    for (int i = 0; i < 1000; ++i) {
+        deque.put(i);
+    }
+    countingAllocations = false;
+    HS_CHECK(allocations > 0 && allocations < 1000 / 8);
+}
+
+static void testPutFirst() {
+    LinkedBlockingDeque<int> deque;
+    deque.putFirst(1);
+    deque.put(2);
+    deque.putFirst(0);
+    deque.put(3);
+    for (int i = 0; i < 4; ++i) {
+        HS_CHECK(deque.take() == i);
+    }
+    HS_CHECK(deque.isEmpty());
+
+    // putFirst onto an empty deque also moves the tail, so a put after it still lands last
+    deque.putFirst(4);
+    deque.put(5);
+    HS_CHECK(deque.take() == 4);
+    HS_CHECK(deque.take() == 5);
+}
+
+static void testOfferAndPoll() {
+    LinkedBlockingDeque<int> deque(2);
+    HS_CHECK(deque.offer(1));
+    HS_CHECK(deque.offer(2));
+    HS_CHECK(!deque.offer(3));
+    HS_CHECK(deque.remainingCapacity() == 0);
+
+    HS_CHECK(deque.poll() == 1);
+    HS_CHECK(deque.poll() == 2);
+    HS_CHECK(!deque.poll().has_value());
+    HS_CHECK(deque.size() == 0);
+
+    // The holes poll gave back can be filled again
+    HS_CHECK(deque.offer(4));
+    HS_CHECK(deque.offer(5));
+    HS_CHECK(!deque.offer(6));
+}
+
+static void testRemove() {
+    LinkedBlockingDeque<int> deque(3);
+    deque.put(1);
+    deque.put(2);
+    deque.put(3);
+
+    HS_CHECK(deque.remove(2));
+    HS_CHECK(!deque.remove(9));
+    HS_CHECK(deque.size() == 2);
+    HS_CHECK(deque.contains(1) && !deque.contains(2) && deque.contains(3));
+
+    // Removing the last element moves the tail back, and frees its hole
+    HS_CHECK(deque.remove(3));
+    HS_CHECK(deque.offer(4));
+    HS_CHECK(deque.offer(5));
+    HS_CHECK(!deque.offer(6));
+
+    HS_CHECK(deque.take() == 1);
+    HS_CHECK(deque.take() == 4);
+    HS_CHECK(deque.take() == 5);
+    // A failed remove returned the permit it reserved, and a successful one didn't
+    HS_CHECK(!deque.poll().has_value());
+    HS_CHECK(!deque.remove(1));
+}
+
+static void testClear() {
+    LinkedBlockingDeque<int> deque(5);
+    for (int i = 0; i < 5; ++i) {
+        deque.put(i);
+    }
+    deque.clear();
+    HS_CHECK(deque.size() == 0);
+    HS_CHECK(!deque.poll().has_value());
+
+    // Every hole is back
+    for (int i = 0; i < 5; ++i) {
+        HS_CHECK(deque.offer(i));
+    }
+    HS_CHECK(!deque.offer(5));
+    HS_CHECK(deque.take() == 0);
+}
+
+static void testProducerConsumer() {
+    LinkedBlockingDeque<int> deque(16);
+    constexpr int items = 100000;
+
+    std::thread producer([&] {
+        for (int i = 0; i < items; ++i) {
+            deque.put(i);
+        }
+    });
+    for (int i = 0; i < items; ++i) {
+        HS_CHECK(deque.take() == i);
+    }
+    producer.join();
+    HS_CHECK(deque.isEmpty());
+}
+
+static void testPutAllAndDrainTo() {
+    LinkedBlockingDeque<int> deque(8);
+    deque.put(0);
+    deque.putAll(std::vector<int>{1, 2, 3});
+    const std::vector<int> more{4, 5};
+    deque.putAll(more);
+    HS_CHECK(deque.size() == 6);
+
+    std::vector<int> drained;
+    HS_CHECK(deque.drainTo(std::back_inserter(drained), 4) == 4);
+    HS_CHECK(drained == std::vector<int>({0, 1, 2, 3}));
+    HS_CHECK(deque.drainTo(std::back_inserter(drained)) == 2);
+    HS_CHECK(drained == std::vector<int>({0, 1, 2, 3, 4, 5}));
+    HS_CHECK(deque.drainTo(std::back_inserter(drained)) == 0);
+
+    // Every hole came back, and the permits drainTo took are gone
+    HS_CHECK(deque.remainingCapacity() == 8);
+    HS_CHECK(!deque.poll().has_value());
+
+    // An rvalue range is moved from
+    std::vector<std::vector<int>> vectors(3, std::vector<int>(10, 7));
+    LinkedBlockingDeque<std::vector<int>> vectorDeque;
+    vectorDeque.putAll(std::move(vectors));
+    for (const std::vector<int> &moved : vectors) {
+        HS_CHECK(moved.empty());
+    }
+    HS_CHECK(vectorDeque.take()->size() == 10);
+}
+
+// A putAll longer than the capacity goes in a capacity at a time as a consumer drains it
+static void testPutAllPastCapacity() {
+    LinkedBlockingDeque<int> deque(16);
+    constexpr int items = 100000;
+
+    std::thread producer([&] {
+        std::vector<int> batch;
+        for (int i = 0; i < items; ++i) {
+            batch.push_back(i);
+            if (batch.size() == 100 || i == items - 1) {
+                deque.putAll(batch);
+                batch.clear();
+            }
+        }
+    });
+
+    std::vector<int> drained;
+    drained.reserve(items);
+    while (drained.size() < items) {
+        if (deque.drainTo(std::back_inserter(drained), 64) == 0) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+
+    for (int i = 0; i < items; ++i) {
+        HS_CHECK(drained[i] == i);
+    }
+    HS_CHECK(deque.isEmpty());
+}
+
+int main() {
+    std::printf("no allocation once warm\n");
+    testNoAllocationOnceWarm();
+    std::printf("putFirst\n");
+    testPutFirst();
+    std::printf("offer and poll\n");
+    testOfferAndPoll();
+    std::printf("remove\n");
+    testRemove();
+    std::printf("clear\n");
+    testClear();
+    std::printf("producer and consumer\n");
+    testProducerConsumer();
+    std::printf("putAll and drainTo\n");
+    testPutAllAndDrainTo();
+    std::printf("putAll past capacity\n");
+    testPutAllPastCapacity();
+    std::printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,274 @@
+//
+//  OffloadTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Cuts TCP packets longer than the MTU the way TUNInterface does before writing them, and
+// checks every segment's lengths, IP ID, sequence number, flags and checksums against a sum
+// recomputed from scratch, with the ID and sequence number wrapping partway through. Then the
+// same for UDP super-packets cut into datagrams at the segment size their builder gave
+
+#include "TestSupport.hpp"
+#include "Offload.hpp"
+#include "TUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#include <sys/socket.h>
+
+using namespace hs;
+
+static constexpr uint8_t FIN = 0x01;
+static constexpr uint8_t PSH = 0x08;
+static constexpr uint8_t ACK = 0x10;
+static constexpr uint8_t CWR = 0x80;
+
+static PacketBuf copyOf(const std::vector<uint8_t> &bytes) {
+    return PacketBuf::copyOf(bytes.data(), bytes.size());
+}
+
+static std::vector<uint8_t> bytesOf(const PacketBuf &packet) {
+    return std::vector<uint8_t>(packet.data(), packet.data() + packet.size());
+}
+
+// Checks segments cut from original at mss payload bytes each
+static void checkSegments(const std::vector<std::vector<uint8_t>> &segments, const test::TCPSegment &original, size_t mss) {
+    const bool v4 = original.version == 4;
+    const size_t headers = (v4 ? 40 : 60) + original.options.size();
+    const size_t expected = (original.payload + mss - 1) / mss;
+    HS_CHECK(segments.size() == expected);
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const std::vector<uint8_t> &s = segments[i];
+        const uint8_t *ip = s.data();
+        const uint8_t *tcp = ip + (v4 ? 20 : 40);
+        const bool first = i == 0;
+        const bool last = i + 1 == segments.size();
+        const size_t payload = last ? original.payload - i * mss : mss;
+
+        HS_CHECK(s.size() == headers + payload);
+        if (v4) {
+            HS_CHECK(test::read16(ip + 2) == s.size());
+            HS_CHECK(test::read16(ip + 4) == static_cast<uint16_t>(original.identification + i));
+        } else {
+            HS_CHECK(test::read16(ip + 4) + 40u == s.size());
+        }
+
+        const uint32_t sequence = original.sequence + static_cast<uint32_t>(i * mss);
+        HS_CHECK(test::read32(tcp + 4) == sequence);
+        HS_CHECK(test::read32(tcp + 8) == original.acknowledgment);
+
+        // CWR only on the first segment, FIN and PSH only on the last, ACK on all
+        uint8_t flags = original.flags;
+        if (!first) {
+            flags &= static_cast<uint8_t>(~CWR);
+        }
+        if (!last) {
+            flags &= static_cast<uint8_t>(~(FIN | PSH));
+        }
+        HS_CHECK(tcp[13] == flags);
+        HS_CHECK(memcmp(tcp + 20, original.options.data(), original.options.size()) == 0);
+
+        HS_CHECK(test::ipChecksumHolds(ip));
+        HS_CHECK(test::transportChecksumHolds(ip, s.size()));
+        for (size_t j = 0; j < payload; ++j) {
+            HS_CHECK(ip[headers + j] == test::payloadByte(sequence + static_cast<uint32_t>(j)));
+        }
+    }
+}
+
+static void testSegmentToMTU(int version, size_t mtu, std::vector<uint8_t> options) {
+    test::TCPSegment original;
+    original.version = version;
+    original.payload = 20000;
+    // Both wrap partway through
+    original.sequence = 0xFFFFF000;
+    original.identification = 0xFFFC;
+    original.flags = ACK | PSH | FIN | CWR;
+    original.options = std::move(options);
+    const std::vector<uint8_t> bytes = test::tcpPacket(original);
+
+    const size_t headers = (version == 4 ? 40 : 60) + original.options.size();
+    PacketBuf packet = copyOf(bytes);
+    HS_CHECK(offload::markForSegmentation(packet, mtu));
+    HS_CHECK(packet.offload().gsoType == (version == 4 ? PacketBuf::GSOType::TCPv4 : PacketBuf::GSOType::TCPv6));
+    HS_CHECK(packet.offload().gsoSize == mtu - headers);
+    // Marked once
+    HS_CHECK(!offload::markForSegmentation(packet, mtu));
+
+    PacketBatch out;
+    const size_t count = offload::segmentToMTU(copyOf(bytes), mtu, out);
+    HS_CHECK(count == out.size());
+
+    std::vector<std::vector<uint8_t>> segments;
+    for (const PacketBuf &segment : out) {
+        HS_CHECK(segment.size() <= mtu);
+        HS_CHECK(!segment.hasOffload());
+        segments.push_back(bytesOf(segment));
+    }
+    checkSegments(segments, original, mtu - headers);
+}
+
+// Checks datagrams cut from a UDP packet of payload bytes at segmentSize bytes each
+static void checkDatagrams(const std::vector<std::vector<uint8_t>> &datagrams, int version, size_t payload,
+                           size_t segmentSize, uint16_t identification) {
+    const bool v4 = version == 4;
+    const size_t ipHeader = v4 ? 20 : 40;
+    HS_CHECK(datagrams.size() == (payload + segmentSize - 1) / segmentSize);
+
+    for (size_t i = 0; i < datagrams.size(); ++i) {
+        const std::vector<uint8_t> &d = datagrams[i];
+        const uint8_t *ip = d.data();
+        const size_t n = i + 1 == datagrams.size() ? payload - i * segmentSize : segmentSize;
+
+        HS_CHECK(d.size() == ipHeader + 8 + n);
+        if (v4) {
+            HS_CHECK(test::read16(ip + 2) == d.size());
+            HS_CHECK(test::read16(ip + 4) == static_cast<uint16_t>(identification + i));
+        } else {
+            HS_CHECK(test::read16(ip + 4) + 40u == d.size());
+        }
+        HS_CHECK(test::read16(ip + ipHeader + 4) == 8 + n);
+        HS_CHECK(test::read16(ip + ipHeader + 6) != 0);
+
+        HS_CHECK(test::ipChecksumHolds(ip));
+        HS_CHECK(test::transportChecksumHolds(ip, d.size()));
+        for (size_t j = 0; j < n; ++j) {
+            HS_CHECK(ip[ipHeader + 8 + j] == test::payloadByte(static_cast<uint32_t>(i * segmentSize + j)));
+        }
+    }
+}
+
+static void testUDPSuperPacket(int version, size_t segmentSize) {
+    const size_t payload = 20000;
+    const std::vector<uint8_t> bytes = test::udpDatagram(version, payload, 0xFFFC);
+
+    PacketBuf packet = copyOf(bytes);
+    HS_CHECK(offload::markSuperPacket(packet, segmentSize));
+    HS_CHECK(packet.offload().gsoType == PacketBuf::GSOType::UDP);
+    HS_CHECK(packet.offload().gsoSize == segmentSize);
+    // Marked once
+    HS_CHECK(!offload::markSuperPacket(packet, segmentSize));
+
+    PacketBatch out;
+    const size_t count = offload::segment(std::move(packet), out);
+    HS_CHECK(count == out.size());
+
+    std::vector<std::vector<uint8_t>> datagrams;
+    for (const PacketBuf &datagram : out) {
+        HS_CHECK(!datagram.hasOffload());
+        datagrams.push_back(bytesOf(datagram));
+    }
+    checkDatagrams(datagrams, version, payload, segmentSize, 0xFFFC);
+
+    // A datagram that fits in one segment isn't marked at all
+    PacketBuf small = copyOf(test::udpDatagram(version, segmentSize));
+    HS_CHECK(!offload::markSuperPacket(small, segmentSize));
+    HS_CHECK(!small.hasOffload());
+}
+
+// Packets that fit, and oversized UDP, which has no segment size to cut at, go out unchanged
+static void testLeftAlone() {
+    test::TCPSegment small;
+    small.payload = 1000;
+    const std::vector<uint8_t> tcp = test::tcpPacket(small);
+    const std::vector<uint8_t> udp = test::udpPacket(9000);
+
+    for (const std::vector<uint8_t> &bytes : { tcp, udp }) {
+        PacketBatch out;
+        HS_CHECK(offload::segmentToMTU(copyOf(bytes), 1400, out) == 1);
+        HS_CHECK(bytesOf(out[0]) == bytes);
+        HS_CHECK(!out[0].hasOffload());
+    }
+}
+
+// TUNInterface cuts an oversized injected TCP packet to WriteQueueConfig::mtu on a device that can't
+static void testThroughInterface() {
+    auto device = FakeTunDevice::create(4);
+    const int peer = device->peerFD();
+
+    WriteQueueConfig config;
+    config.mtu = 1280;
+    TUNInterface tun(std::move(device), config);
+    tun.start();
+
+    test::TCPSegment original;
+    original.version = 6;
+    original.payload = 9000;
+    original.sequence = 0xFFFFFF00;
+    const std::vector<uint8_t> bytes = test::tcpPacket(original);
+    tun.enqueueWrite(bytes);
+
+    const size_t mss = 1280 - 60;
+    const size_t expected = (original.payload + mss - 1) / mss;
+    std::vector<std::vector<uint8_t>> segments;
+    HS_CHECK(test::waitFor([&] {
+        uint8_t framed[2048];
+        ssize_t n;
+        while ((n = recv(peer, framed, sizeof(framed), MSG_DONTWAIT)) > 0) {
+            segments.emplace_back(framed + 4, framed + n);
+        }
+        return segments.size() >= expected;
+    }));
+    tun.stop();
+
+    checkSegments(segments, original, mss);
+    const WriteQueueStats stats = tun.writeQueueStats();
+    HS_CHECK(stats.segmentedPackets == 1);
+    HS_CHECK(stats.segmentsCreated == expected);
+}
+
+// A UDP super-packet injected with its segment size comes out of a device that can't segment as datagrams
+static void testUDPThroughInterface() {
+    auto device = FakeTunDevice::create(4);
+    const int peer = device->peerFD();
+
+    TUNInterface tun(std::move(device));
+    tun.start();
+
+    const size_t payload = 9000;
+    const size_t segmentSize = 1200;
+    const std::vector<uint8_t> bytes = test::udpDatagram(6, payload);
+    tun.enqueueWrite(bytes.data(), bytes.size(), segmentSize);
+
+    const size_t expected = (payload + segmentSize - 1) / segmentSize;
+    std::vector<std::vector<uint8_t>> datagrams;
+    HS_CHECK(test::waitFor([&] {
+        uint8_t framed[2048];
+        ssize_t n;
+        while ((n = recv(peer, framed, sizeof(framed), MSG_DONTWAIT)) > 0) {
+            datagrams.emplace_back(framed + 4, framed + n);
+        }
+        return datagrams.size() >= expected;
+    }));
+    tun.stop();
+
+    checkDatagrams(datagrams, 6, payload, segmentSize, 0);
+    const WriteQueueStats stats = tun.writeQueueStats();
+    HS_CHECK(stats.segmentedPackets == 1);
+    HS_CHECK(stats.segmentsCreated == expected);
+}
+
+int main() {
+    const std::vector<uint8_t> timestamp = { 1, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 2 };
+    for (int version : {4, 6}) {
+        for (size_t mtu : {1500, 1281}) {
+            std::printf("segmentToMTU, IPv%d, MTU %zu\n", version, mtu);
+            testSegmentToMTU(version, mtu, {});
+            testSegmentToMTU(version, mtu, timestamp);
+        }
+    }
+    for (int version : {4, 6}) {
+        for (size_t segmentSize : {1200, 1}) {
+            std::printf("UDP super-packet, IPv%d, %zu byte segments\n", version, segmentSize);
+            testUDPSuperPacket(version, segmentSize);
+        }
+    }
+    std::printf("left alone\n");
+    testLeftAlone();
+    std::printf("through TUNInterface\n");
+    testThroughInterface();
+    std::printf("UDP through TUNInterface\n");
+    testUDPThroughInterface();
+    std::printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,151 @@
+//
+//  SPSCRingBufferTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Checks the ring keeps order as its indices wrap many times round a small capacity, that pop_bulk
+// takes what's there up to its limit across the wrap, and that a producer and a consumer on two
+// threads pass a long run of values through it in order with none lost
+
+#include "TestSupport.hpp"
+#include "SPSCRingBuffer.hpp"
+
+#include <iterator>
+#include <memory>
+#include <thread>
+
+using namespace hs;
+
+static void testCapacity() {
+    HS_CHECK(SPSCRingBuffer<int>(1).capacity() == 2);
+    HS_CHECK(SPSCRingBuffer<int>(5).capacity() == 8);
+    HS_CHECK(SPSCRingBuffer<int>(64).capacity() == 64);
+
+    SPSCRingBuffer<int> ring(4);
+    for (int i = 0; i < 4; ++i) {
+        HS_CHECK(ring.try_push(i));
+    }
+    HS_CHECK(!ring.try_push(4));
+    HS_CHECK(ring.size() == 4);
+    HS_CHECK(ring.try_pop() == 0);
+    HS_CHECK(ring.try_push(4));
+    HS_CHECK(!ring.try_push(5));
+}
+
+// Fills and empties by different amounts each round, so the indices pass every slot boundary
+static void testWraparound() {
+    SPSCRingBuffer<int> ring(4);
+    int pushed = 0;
+    int popped = 0;
+
+    for (int round = 0; round < 1000; ++round) {
+        const int in = 1 + round % 4;
+        for (int i = 0; i < in; ++i) {
+            HS_CHECK(ring.try_push(pushed++));
+        }
+        HS_CHECK(ring.size() == static_cast<size_t>(pushed - popped));
+
+        const int out = 1 + (round * 3) % in;
+        for (int i = 0; i < out; ++i) {
+            HS_CHECK(ring.try_pop() == popped++);
+        }
+        while (std::optional<int> value = ring.try_pop()) {
+            HS_CHECK(*value == popped++);
+        }
+        HS_CHECK(ring.empty());
+        HS_CHECK(!ring.try_pop().has_value());
+    }
+    HS_CHECK(pushed == popped);
+}
+
+static void testPopBulk() {
+    SPSCRingBuffer<int> ring(8);
+    std::vector<int> out;
+
+    HS_CHECK(ring.pop_bulk(std::back_inserter(out), 10) == 0);
+    HS_CHECK(out.empty());
+
+    // Start five in, so the run below wraps
+    for (int i = 0; i < 5; ++i) {
+        HS_CHECK(ring.try_push(-1));
+    }
+    HS_CHECK(ring.pop_bulk(std::back_inserter(out), 5) == 5);
+    out.clear();
+
+    for (int i = 0; i < 7; ++i) {
+        HS_CHECK(ring.try_push(i));
+    }
+    HS_CHECK(ring.pop_bulk(std::back_inserter(out), 3) == 3);
+    HS_CHECK(out == std::vector<int>({0, 1, 2}));
+    HS_CHECK(ring.pop_bulk(std::back_inserter(out), 10) == 4);
+    HS_CHECK(out == std::vector<int>({0, 1, 2, 3, 4, 5, 6}));
+    HS_CHECK(ring.empty());
+
+    // The slots it took are free again, a whole ring's worth
+    for (int i = 0; i < 8; ++i) {
+        HS_CHECK(ring.try_push(i));
+    }
+    HS_CHECK(!ring.try_push(8));
+    out.clear();
+    HS_CHECK(ring.pop_bulk(std::back_inserter(out), 8) == 8);
+    HS_CHECK(out == std::vector<int>({0, 1, 2, 3, 4, 5, 6, 7}));
+
+    // Move-only elements are moved out
+    SPSCRingBuffer<std::unique_ptr<int>> owners(4);
+    HS_CHECK(owners.try_push(std::make_unique<int>(1)));
+    HS_CHECK(owners.try_emplace(new int(2)));
+    std::vector<std::unique_ptr<int>> taken;
+    HS_CHECK(owners.pop_bulk(std::back_inserter(taken), 4) == 2);
+    HS_CHECK(*taken[0] == 1 && *taken[1] == 2);
+}
+
+static void testTwoThreadOrdering() {
+    SPSCRingBuffer<uint64_t> ring(64);
+    constexpr uint64_t count = 2000000;
+
+    std::thread producer([&] {
+        for (uint64_t i = 0; i < count; ++i) {
+            while (!ring.try_push(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    // Alternates single and bulk pops, so both publish the head the producer waits on
+    uint64_t expected = 0;
+    std::vector<uint64_t> batch;
+    while (expected < count) {
+        if (expected % 2 == 0) {
+            if (std::optional<uint64_t> value = ring.try_pop()) {
+                HS_CHECK(*value == expected);
+                expected += 1;
+                continue;
+            }
+        } else {
+            batch.clear();
+            if (ring.pop_bulk(std::back_inserter(batch), 17) > 0) {
+                for (uint64_t value : batch) {
+                    HS_CHECK(value == expected);
+                    expected += 1;
+                }
+                continue;
+            }
+        }
+        std::this_thread::yield();
+    }
+    producer.join();
+    HS_CHECK(ring.empty());
+}
+
+int main() {
+    std::printf("capacity\n");
+    testCapacity();
+    std::printf("wraparound\n");
+    testWraparound();
+    std::printf("pop_bulk\n");
+    testPopBulk();
+    std::printf("two thread ordering\n");
+    testTwoThreadOrdering();
+    std::printf("ok\n");
+    return 0;
+}
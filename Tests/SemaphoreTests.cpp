@@ -0,0 +1,96 @@
+//
+//  SemaphoreTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Checks Semaphore's counted acquire and release, the batch form the deque's putAll,
+// drainTo and clear use, including a bulk waiter parked beside a single one
+
+#include "TestSupport.hpp"
+#include "Semaphore.hpp"
+
+#include <atomic>
+#include <thread>
+
+using namespace hs;
+
+static void testCounts() {
+    Semaphore semaphore(5);
+    semaphore.wait(3);
+    HS_CHECK(semaphore.value() == 2);
+    HS_CHECK(semaphore.try_wait_up_to(10) == 2);
+    HS_CHECK(semaphore.try_wait_up_to(10) == 0);
+    HS_CHECK(!semaphore.try_wait());
+
+    semaphore.signal(4);
+    HS_CHECK(semaphore.try_wait_up_to(3) == 3);
+    HS_CHECK(semaphore.try_wait());
+    HS_CHECK(semaphore.value() == 0);
+
+    // Zero and negative counts are no-ops
+    semaphore.wait(0);
+    semaphore.signal(-1);
+    HS_CHECK(semaphore.value() == 0);
+}
+
+// A waiter for n permits is let through once they've all been released, however they arrive
+static void testBulkWaiter() {
+    Semaphore semaphore(0);
+    std::atomic<bool> acquired = false;
+
+    std::thread waiter([&] {
+        semaphore.wait(3);
+        acquired = true;
+    });
+
+    semaphore.signal();
+    semaphore.signal();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    HS_CHECK(!acquired);
+
+    semaphore.signal();
+    HS_CHECK(test::waitFor([&] { return acquired.load(); }));
+    waiter.join();
+    HS_CHECK(semaphore.value() == 0);
+}
+
+// One permit released while a bulk waiter and a single waiter are both parked goes to the single
+// one, even if the wake lands on the bulk waiter, which can't use it
+static void testBulkWaiterBesideSingleWaiter() {
+    for (int round = 0; round < 50; ++round) {
+        Semaphore semaphore(0);
+        std::atomic<bool> bulkAcquired = false;
+        std::atomic<bool> singleAcquired = false;
+
+        std::thread bulk([&] {
+            semaphore.wait(2);
+            bulkAcquired = true;
+        });
+        std::thread single([&] {
+            semaphore.wait();
+            singleAcquired = true;
+        });
+        // Lets both park
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+        semaphore.signal();
+        HS_CHECK(test::waitFor([&] { return singleAcquired.load(); }));
+        HS_CHECK(!bulkAcquired);
+
+        semaphore.signal(2);
+        HS_CHECK(test::waitFor([&] { return bulkAcquired.load(); }));
+        bulk.join();
+        single.join();
+    }
+}
+
+int main() {
+    std::printf("counts\n");
+    testCounts();
+    std::printf("bulk waiter\n");
+    testBulkWaiter();
+    std::printf("bulk waiter beside a single waiter\n");
+    testBulkWaiterBesideSingleWaiter();
+    std::printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,210 @@
+//
+//  TestPackets.hpp
+//  HyperSpace Service Tests
+//
+//  Copyright (c) 2025, WhiteStar Communications, Inc.
+//  All rights reserved.
+//  Licensed under the BSD 2-Clause License.
+//  See LICENSE file in the project root for details.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Packets built for the tests and the benchmarks, which both include this. Checksums are summed
+// here a word at a time, independently of hs::checksum, so tests can check the engine against them
+namespace hs::test {
+    inline uint16_t read16(const uint8_t *p) {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    inline uint32_t read32(const uint8_t *p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+               (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    inline void write16(uint8_t *p, uint16_t value) {
+        p[0] = static_cast<uint8_t>(value >> 8);
+        p[1] = static_cast<uint8_t>(value);
+    }
+
+    inline void write32(uint8_t *p, uint32_t value) {
+        write16(p, static_cast<uint16_t>(value >> 16));
+        write16(p + 2, static_cast<uint16_t>(value));
+    }
+
+    // The ones' complement sum of data as big-endian words, an odd last byte padded with zero, folded
+    inline uint16_t onesComplementSum(const uint8_t *data, size_t length, uint64_t sum = 0) {
+        for (; length > 1; data += 2, length -= 2) {
+            sum += read16(data);
+        }
+        if (length == 1) {
+            sum += static_cast<uint32_t>(data[0]) << 8;
+        }
+        while (sum >> 16) {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        return static_cast<uint16_t>(sum);
+    }
+
+    // The IPv4 or IPv6 pseudo header's sum for a transport segment of transportLength bytes
+    inline uint64_t pseudoHeaderSum(const uint8_t *ip, uint8_t protocol, size_t transportLength) {
+        const bool v4 = (ip[0] >> 4) == 4;
+        uint64_t sum = v4 ? onesComplementSum(ip + 12, 8) : onesComplementSum(ip + 8, 32);
+        return sum + protocol + transportLength;
+    }
+
+    // Whether an IPv4 header checksum holds. IPv6 has none, so it always does
+    inline bool ipChecksumHolds(const uint8_t *packet) {
+        return (packet[0] >> 4) != 4 || onesComplementSum(packet, static_cast<size_t>(packet[0] & 0x0F) * 4) == 0xFFFF;
+    }
+
+    // Whether the TCP or UDP checksum of a packet with no IPv4 options or IPv6 extension headers holds
+    inline bool transportChecksumHolds(const uint8_t *packet, size_t length) {
+        const bool v4 = (packet[0] >> 4) == 4;
+        const size_t ipHeader = v4 ? 20 : 40;
+        const uint8_t protocol = v4 ? packet[9] : packet[6];
+        return onesComplementSum(packet + ipHeader, length - ipHeader,
+                                 pseudoHeaderSum(packet, protocol, length - ipHeader)) == 0xFFFF;
+    }
+
+    // The byte a TCP payload built below carries at sequence number, so merged or cut payloads can be checked
+    inline uint8_t payloadByte(uint32_t sequence, uint8_t seed = 0) {
+        return static_cast<uint8_t>(sequence * 31 + (sequence >> 8) + seed);
+    }
+
+    struct TCPSegment {
+        // 4 or 6
+        int version = 4;
+        size_t payload = 1000;
+        uint32_t sequence = 1;
+        uint32_t acknowledgment = 1;
+        // ACK
+        uint8_t flags = 0x10;
+        uint16_t sourcePort = 40000;
+        uint16_t identification = 1;
+        // TCP options, a multiple of 4 bytes
+        std::vector<uint8_t> options;
+        uint8_t seed = 0;
+    };
+
+    // A TCP packet from 10.0.0.1 or fd00::1 to 10.0.0.2 or fd00::2, with every checksum valid
+    inline std::vector<uint8_t> tcpPacket(const TCPSegment &segment) {
+        const bool v4 = segment.version == 4;
+        const size_t ipHeader = v4 ? 20 : 40;
+        const size_t tcpHeader = 20 + segment.options.size();
+        const size_t length = ipHeader + tcpHeader + segment.payload;
+
+        std::vector<uint8_t> p(length, 0);
+        if (v4) {
+            p[0] = 0x45;
+            write16(&p[2], static_cast<uint16_t>(length));
+            write16(&p[4], segment.identification);
+            // Don't fragment
+            p[6] = 0x40;
+            p[8] = 64;
+            p[9] = 6;
+            p[12] = 10; p[15] = 1;
+            p[16] = 10; p[19] = 2;
+            write16(&p[10], static_cast<uint16_t>(~onesComplementSum(p.data(), 20)));
+        } else {
+            p[0] = 0x60;
+            write16(&p[4], static_cast<uint16_t>(length - 40));
+            p[6] = 6;
+            p[7] = 64;
+            p[8] = 0xFD; p[23] = 1;
+            p[24] = 0xFD; p[39] = 2;
+        }
+
+        uint8_t *tcp = &p[ipHeader];
+        write16(tcp, segment.sourcePort);
+        write16(tcp + 2, 443);
+        write32(tcp + 4, segment.sequence);
+        write32(tcp + 8, segment.acknowledgment);
+        tcp[12] = static_cast<uint8_t>((tcpHeader / 4) << 4);
+        tcp[13] = segment.flags;
+        write16(tcp + 14, 65535);
+        std::copy(segment.options.begin(), segment.options.end(), tcp + 20);
+        for (size_t i = 0; i < segment.payload; ++i) {
+            tcp[tcpHeader + i] = payloadByte(segment.sequence + static_cast<uint32_t>(i), segment.seed);
+        }
+        write16(tcp + 16, static_cast<uint16_t>(~onesComplementSum(tcp, length - ipHeader,
+                                                                   pseudoHeaderSum(p.data(), 6, length - ipHeader))));
+        return p;
+    }
+
+    // A length byte IPv4 UDP packet from 10.0.0.1 to 10.0.0.2, with a valid header checksum.
+    // sourcePort picks the flow, and the payload is a pattern seeded by seed
+    inline std::vector<uint8_t> udpPacket(size_t length, uint16_t sourcePort = 1000, uint8_t seed = 0) {
+        std::vector<uint8_t> p(length, 0);
+        p[0] = 0x45;
+        p[2] = static_cast<uint8_t>(length >> 8);
+        p[3] = static_cast<uint8_t>(length);
+        p[8] = 64;
+        p[9] = 17;
+        p[12] = 10; p[15] = 1;
+        p[16] = 10; p[19] = 2;
+
+        uint32_t sum = 0;
+        for (size_t i = 0; i < 20; i += 2) {
+            sum += static_cast<uint32_t>((p[i] << 8) | p[i + 1]);
+        }
+        while (sum >> 16) {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        p[10] = static_cast<uint8_t>(~sum >> 8);
+        p[11] = static_cast<uint8_t>(~sum);
+
+        p[20] = static_cast<uint8_t>(sourcePort >> 8);
+        p[21] = static_cast<uint8_t>(sourcePort);
+        p[23] = 53;
+        p[24] = static_cast<uint8_t>((length - 20) >> 8);
+        p[25] = static_cast<uint8_t>(length - 20);
+        for (size_t i = 28; i < length; ++i) {
+            p[i] = static_cast<uint8_t>(i * 31 + seed);
+        }
+        return p;
+    }
+
+    // A UDP packet from 10.0.0.1 or fd00::1 to 10.0.0.2 or fd00::2 with every checksum valid,
+    // its payload byte i being payloadByte(i)
+    inline std::vector<uint8_t> udpDatagram(int version, size_t payload, uint16_t identification = 1) {
+        const bool v4 = version == 4;
+        const size_t ipHeader = v4 ? 20 : 40;
+        const size_t length = ipHeader + 8 + payload;
+
+        std::vector<uint8_t> p(length, 0);
+        if (v4) {
+            p[0] = 0x45;
+            write16(&p[2], static_cast<uint16_t>(length));
+            write16(&p[4], identification);
+            p[8] = 64;
+            p[9] = 17;
+            p[12] = 10; p[15] = 1;
+            p[16] = 10; p[19] = 2;
+            write16(&p[10], static_cast<uint16_t>(~onesComplementSum(p.data(), 20)));
+        } else {
+            p[0] = 0x60;
+            write16(&p[4], static_cast<uint16_t>(length - 40));
+            p[6] = 17;
+            p[7] = 64;
+            p[8] = 0xFD; p[23] = 1;
+            p[24] = 0xFD; p[39] = 2;
+        }
+
+        uint8_t *udp = &p[ipHeader];
+        write16(udp, 40000);
+        write16(udp + 2, 443);
+        write16(udp + 4, static_cast<uint16_t>(length - ipHeader));
+        for (size_t i = 0; i < payload; ++i) {
+            udp[8 + i] = payloadByte(static_cast<uint32_t>(i));
+        }
+        write16(udp + 6, static_cast<uint16_t>(~onesComplementSum(udp, length - ipHeader,
+                                                                  pseudoHeaderSum(p.data(), 17, length - ipHeader))));
+        return p;
+    }
+}
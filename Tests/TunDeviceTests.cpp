@@ -0,0 +1,126 @@
+//
+//  TunDeviceTests.cpp
+//  HyperSpace Service Tests
+//
+
+#include "TestSupport.hpp"
+#include "TUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#if defined(__linux__)
+#include "LinuxTunDevice.hpp"
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <sys/socket.h>
+
+using namespace hs;
+
+// A packet the kernel routed to the device comes out of the outgoing call back without its header
+static void testRead(size_t headerLength) {
+    auto device = FakeTunDevice::create(headerLength);
+    const int peer = device->peerFD();
+
+    TUNInterface tun(std::move(device));
+    std::mutex mutex;
+    std::vector<std::vector<uint8_t>> received;
+    tun.setOutgoingPacketCallBack([&](PacketBatch &batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (PacketBuf &packet : batch) {
+            received.emplace_back(packet.data(), packet.data() + packet.size());
+        }
+    });
+    tun.start();
+
+    std::vector<std::vector<uint8_t>> sent;
+    for (uint16_t i = 0; i < 20; ++i) {
+        std::vector<uint8_t> packet = test::udpPacket(100 + i, 1000 + i);
+        std::vector<uint8_t> framed(headerLength, 0);
+        if (headerLength == 4) {
+            framed[3] = AF_INET;
+        }
+        framed.insert(framed.end(), packet.begin(), packet.end());
+        HS_CHECK(send(peer, framed.data(), framed.size(), 0) == static_cast<ssize_t>(framed.size()));
+        sent.push_back(std::move(packet));
+    }
+
+    HS_CHECK(test::waitFor([&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        return received.size() == sent.size();
+    }));
+    tun.stop();
+
+    HS_CHECK(received == sent);
+    HS_CHECK(tun.readStats().packetsRead == sent.size());
+}
+
+// An injected packet reaches the device with the header the device asks for in front
+static void testWrite(size_t headerLength) {
+    auto device = FakeTunDevice::create(headerLength);
+    const int peer = device->peerFD();
+
+    TUNInterface tun(std::move(device));
+    tun.start();
+
+    std::vector<uint8_t> packet = test::udpPacket(300);
+    tun.enqueueWrite(packet.data(), packet.size());
+
+    // Without headroom of its own the header is gathered in from beside the packet
+    PacketBuf bare = PacketBuf::copyOf(packet.data(), packet.size(), 0);
+    tun.enqueueWrite(std::move(bare));
+
+    for (int i = 0; i < 2; ++i) {
+        uint8_t framed[2048];
+        ssize_t n = -1;
+        HS_CHECK(test::waitFor([&] {
+            n = recv(peer, framed, sizeof(framed), MSG_DONTWAIT);
+            return n >= 0;
+        }));
+        HS_CHECK(static_cast<size_t>(n) == headerLength + packet.size());
+        HS_CHECK(memcmp(framed + headerLength, packet.data(), packet.size()) == 0);
+        if (headerLength == 4) {
+            HS_CHECK(framed[0] == 0 && framed[1] == 0 && framed[2] == 0 && framed[3] == AF_INET);
+        }
+    }
+    tun.stop();
+
+    HS_CHECK(tun.writeQueueStats().written == 2);
+}
+
+#if defined(__linux__)
+// Opening a real device needs /dev/net/tun and CAP_NET_ADMIN, so without them there's nothing to check
+static void testLinuxDevice() {
+    std::unique_ptr<LinuxTunDevice> device = LinuxTunDevice::open();
+    if (!device) {
+        std::printf("  /dev/net/tun unavailable, skipped\n");
+        return;
+    }
+    HS_CHECK(device->fd() >= 0);
+    HS_CHECK(!device->name().empty());
+    HS_CHECK(device->headerLength() == 0);
+    HS_CHECK(!device->segmentsLargePackets());
+
+    LinuxTunOptions offload;
+    offload.virtioNetHeader = true;
+    std::unique_ptr<LinuxTunDevice> virtio = LinuxTunDevice::open("", offload);
+    HS_CHECK(virtio != nullptr);
+    HS_CHECK(virtio->headerLength() > 0);
+    HS_CHECK(virtio->segmentsLargePackets());
+}
+#endif
+
+int main() {
+    for (size_t headerLength : {0, 4}) {
+        std::printf("fake device, %zu byte header\n", headerLength);
+        testRead(headerLength);
+        testWrite(headerLength);
+    }
+#if defined(__linux__)
+    std::printf("linux device\n");
+    testLinuxDevice();
+#endif
+    std::printf("ok\n");
+    return 0;
+}
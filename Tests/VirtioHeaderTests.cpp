@@ -0,0 +1,215 @@
+//
+//  VirtioHeaderTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Reads the virtio-net headers a TUN device opened with IFF_VNET_HDR puts in front of packets,
+// writes them back out from the metadata read, and finishes partial checksums, checking the
+// results against headers and checksums worked out by hand
+
+#include "TestSupport.hpp"
+#include "Offload.hpp"
+
+using namespace hs;
+
+static std::vector<uint8_t> headerBytes(const offload::VirtioNetHeader &header) {
+    std::vector<uint8_t> bytes(sizeof(header));
+    memcpy(bytes.data(), &header, sizeof(header));
+    return bytes;
+}
+
+// A packet as read from the device, header first
+static PacketBuf framed(const offload::VirtioNetHeader &header, const std::vector<uint8_t> &packet) {
+    std::vector<uint8_t> bytes = headerBytes(header);
+    bytes.insert(bytes.end(), packet.begin(), packet.end());
+    return PacketBuf::copyOf(bytes.data(), bytes.size());
+}
+
+static std::vector<uint8_t> written(PacketBuf &packet) {
+    std::vector<uint8_t> bytes(sizeof(offload::VirtioNetHeader));
+    offload::writeVirtioHeader(packet, bytes.data());
+    return bytes;
+}
+
+// A TCP super-packet with a partial checksum, as the kernel hands one over, comes back out with the same header
+static void testTCPRoundTrip(int version) {
+    const bool v4 = version == 4;
+    const size_t ipHeader = v4 ? 20 : 40;
+
+    test::TCPSegment segment;
+    segment.version = version;
+    segment.payload = 3000;
+    segment.options = { 1, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 2 };
+    const std::vector<uint8_t> bytes = test::tcpPacket(segment);
+
+    offload::VirtioNetHeader header{};
+    header.flags = offload::virtioNeedsChecksum;
+    header.gsoType = v4 ? offload::virtioGSOTCPv4 : offload::virtioGSOTCPv6;
+    header.headerLength = static_cast<uint16_t>(ipHeader + 32);
+    header.gsoSize = 1000;
+    header.checksumStart = static_cast<uint16_t>(ipHeader);
+    header.checksumOffset = 16;
+
+    PacketBuf packet = framed(header, bytes);
+    HS_CHECK(offload::readVirtioHeader(packet));
+    HS_CHECK(packet.size() == bytes.size());
+    HS_CHECK(memcmp(packet.data(), bytes.data(), bytes.size()) == 0);
+    HS_CHECK(packet.offload().gsoType == (v4 ? PacketBuf::GSOType::TCPv4 : PacketBuf::GSOType::TCPv6));
+    HS_CHECK(packet.offload().gsoSize == 1000);
+    HS_CHECK(packet.offload().checksumPartial);
+    HS_CHECK(packet.checksumStart() == ipHeader);
+    HS_CHECK(packet.offload().checksumOffset == 16);
+
+    HS_CHECK(written(packet) == headerBytes(header));
+
+    // The ECN bit is accepted on the way in
+    header.gsoType |= offload::virtioGSOECN;
+    PacketBuf ecn = framed(header, bytes);
+    HS_CHECK(offload::readVirtioHeader(ecn));
+    HS_CHECK(ecn.offload().gsoType == (v4 ? PacketBuf::GSOType::TCPv4 : PacketBuf::GSOType::TCPv6));
+}
+
+// A super-packet marked here, with no partial checksum, gets one: the field holds the pseudo header sum
+// until completeChecksum finishes it back into the checksum the packet was built with
+static void testTCPHeaderFromMark(int version) {
+    const bool v4 = version == 4;
+    const size_t ipHeader = v4 ? 20 : 40;
+
+    test::TCPSegment segment;
+    segment.version = version;
+    segment.payload = 5000;
+    const std::vector<uint8_t> bytes = test::tcpPacket(segment);
+
+    PacketBuf packet = PacketBuf::copyOf(bytes.data(), bytes.size());
+    HS_CHECK(offload::markForSegmentation(packet, 1500));
+
+    offload::VirtioNetHeader header;
+    const std::vector<uint8_t> headerOut = written(packet);
+    memcpy(&header, headerOut.data(), sizeof(header));
+    HS_CHECK(header.flags == offload::virtioNeedsChecksum);
+    HS_CHECK(header.gsoType == (v4 ? offload::virtioGSOTCPv4 : offload::virtioGSOTCPv6));
+    HS_CHECK(header.gsoSize == 1500 - ipHeader - 20);
+    HS_CHECK(header.headerLength == ipHeader + 20);
+    HS_CHECK(header.checksumStart == ipHeader);
+    HS_CHECK(header.checksumOffset == 16);
+
+    const uint16_t pseudo = test::onesComplementSum(nullptr, 0, test::pseudoHeaderSum(bytes.data(), 6, bytes.size() - ipHeader));
+    HS_CHECK(test::read16(packet.data() + ipHeader + 16) == pseudo);
+
+    offload::completeChecksum(packet);
+    HS_CHECK(!packet.offload().checksumPartial);
+    HS_CHECK(packet.offload().gsoType != PacketBuf::GSOType::None);
+    HS_CHECK(memcmp(packet.data(), bytes.data(), bytes.size()) == 0);
+}
+
+// A plain packet gets an all zero header
+static void testNoOffload() {
+    const std::vector<uint8_t> bytes = test::udpDatagram(4, 100);
+    PacketBuf packet = PacketBuf::copyOf(bytes.data(), bytes.size());
+    HS_CHECK(written(packet) == std::vector<uint8_t>(sizeof(offload::VirtioNetHeader), 0));
+
+    PacketBuf read = framed(offload::VirtioNetHeader{}, bytes);
+    HS_CHECK(offload::readVirtioHeader(read));
+    HS_CHECK(!read.hasOffload());
+    HS_CHECK(read.size() == bytes.size());
+}
+
+static void testRejected() {
+    const std::vector<uint8_t> bytes = test::tcpPacket(test::TCPSegment{});
+
+    // Too short to hold a header
+    PacketBuf tooShort = PacketBuf::copyOf(bytes.data(), sizeof(offload::VirtioNetHeader) - 1);
+    HS_CHECK(!offload::readVirtioHeader(tooShort));
+
+    // A GSO type this code doesn't know
+    offload::VirtioNetHeader unknown{};
+    unknown.gsoType = 3;
+    unknown.gsoSize = 1000;
+    PacketBuf unknownPacket = framed(unknown, bytes);
+    HS_CHECK(!offload::readVirtioHeader(unknownPacket));
+
+    // Segmentation with no segment size
+    offload::VirtioNetHeader noSize{};
+    noSize.gsoType = offload::virtioGSOTCPv4;
+    PacketBuf noSizePacket = framed(noSize, bytes);
+    HS_CHECK(!offload::readVirtioHeader(noSizePacket));
+
+    // A checksum field past the end of the packet
+    offload::VirtioNetHeader pastEnd{};
+    pastEnd.flags = offload::virtioNeedsChecksum;
+    pastEnd.checksumStart = static_cast<uint16_t>(bytes.size() - 10);
+    pastEnd.checksumOffset = 9;
+    PacketBuf pastEndPacket = framed(pastEnd, bytes);
+    HS_CHECK(!offload::readVirtioHeader(pastEndPacket));
+}
+
+// 10.0.0.1:1000 to 10.0.0.2:53 over UDP, with a four byte payload and the pseudo header sum in the
+// checksum field, as the kernel leaves a partial checksum
+static std::vector<uint8_t> partialUDP(uint16_t payloadHigh, uint16_t payloadLow) {
+    std::vector<uint8_t> p(32, 0);
+    p[0] = 0x45;
+    test::write16(&p[2], 32);
+    p[8] = 64;
+    p[9] = 17;
+    p[12] = 10; p[15] = 1;
+    p[16] = 10; p[19] = 2;
+
+    // 0x0a00 + 0x0001 + 0x0a00 + 0x0002 + 17 + 12
+    test::write16(&p[20], 1000);
+    test::write16(&p[22], 53);
+    test::write16(&p[24], 12);
+    test::write16(&p[26], 0x1420);
+    test::write16(&p[28], payloadHigh);
+    test::write16(&p[30], payloadLow);
+    return p;
+}
+
+static void testCompleteChecksum() {
+    // 0x03e8 + 0x0035 + 0x000c + 0x1420 + 0x0102 + 0x0304 = 0x1c4f, and ~0x1c4f = 0xe3b0
+    const std::vector<uint8_t> bytes = partialUDP(0x0102, 0x0304);
+    PacketBuf packet = PacketBuf::copyOf(bytes.data(), bytes.size());
+    packet.setChecksumPartial(20, 6);
+    offload::completeChecksum(packet);
+    HS_CHECK(test::read16(packet.data() + 26) == 0xE3B0);
+    HS_CHECK(!packet.hasOffload());
+    HS_CHECK(test::transportChecksumHolds(packet.data(), packet.size()));
+
+    // A payload that brings the sum to 0xffff computes to zero, which UDP sends as all ones
+    const std::vector<uint8_t> zero = partialUDP(0xE7B6, 0x0000);
+    PacketBuf zeroPacket = PacketBuf::copyOf(zero.data(), zero.size());
+    zeroPacket.setChecksumPartial(20, 6);
+    offload::completeChecksum(zeroPacket);
+    HS_CHECK(test::read16(zeroPacket.data() + 26) == 0xFFFF);
+
+    // Through a header read from the device, so checksumStart is counted from after it
+    offload::VirtioNetHeader header{};
+    header.flags = offload::virtioNeedsChecksum;
+    header.checksumStart = 20;
+    header.checksumOffset = 6;
+    PacketBuf read = framed(header, bytes);
+    HS_CHECK(offload::readVirtioHeader(read));
+    offload::completeChecksum(read);
+    HS_CHECK(test::read16(read.data() + 26) == 0xE3B0);
+
+    // Nothing to do for a packet with no partial checksum
+    PacketBuf whole = PacketBuf::copyOf(bytes.data(), bytes.size());
+    offload::completeChecksum(whole);
+    HS_CHECK(test::read16(whole.data() + 26) == 0x1420);
+}
+
+int main() {
+    for (int version : {4, 6}) {
+        std::printf("TCP round trip, IPv%d\n", version);
+        testTCPRoundTrip(version);
+        std::printf("TCP header from mark, IPv%d\n", version);
+        testTCPHeaderFromMark(version);
+    }
+    std::printf("no offload\n");
+    testNoOffload();
+    std::printf("rejected\n");
+    testRejected();
+    std::printf("completeChecksum\n");
+    testCompleteChecksum();
+    std::printf("ok\n");
+    return 0;
+}
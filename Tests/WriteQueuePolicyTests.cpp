@@ -0,0 +1,208 @@
+//
+//  WriteQueuePolicyTests.cpp
+//  HyperSpace Service Tests
+//
+
+// Stalls a fake device by leaving its peer unread, and checks what each WriteQueuePolicy does
+// with packets injected past the limit: Block waits until a drain or stop() lets it go, DropTail
+// and ByteBudget turn away the newest, and DropHead sheds the oldest while the fd stays stalled
+
+#include "TestSupport.hpp"
+#include "TUNInterface.hpp"
+#include "TunDevice.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <sys/socket.h>
+#include <thread>
+
+using namespace hs;
+
+static constexpr size_t packetSize = 1000;
+static constexpr size_t injected = 100;
+
+// A device whose fd stops taking writes after a packet or two, until its peer is read
+static std::unique_ptr<TunDevice> stallingDevice(int &peer) {
+    auto device = FakeTunDevice::create(0);
+    peer = device->peerFD();
+    int bufferSize = 1;
+    setsockopt(device->fd(), SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    return device;
+}
+
+// Packet i comes from source port i + 1, so the order they arrive in can be checked
+static void inject(TUNInterface &tun, size_t count, size_t first = 0) {
+    for (size_t i = first; i < first + count; ++i) {
+        tun.enqueueWrite(test::udpPacket(packetSize, static_cast<uint16_t>(i + 1)));
+    }
+}
+
+// Reads the peer until expected packets have arrived, and returns their indices
+static std::vector<size_t> drain(int peer, size_t expected) {
+    std::vector<size_t> received;
+    HS_CHECK(test::waitFor([&] {
+        uint8_t packet[2048];
+        ssize_t n;
+        while ((n = recv(peer, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+            HS_CHECK(static_cast<size_t>(n) == packetSize);
+            received.push_back(test::read16(packet + 20) - 1u);
+        }
+        return received.size() >= expected;
+    }));
+    return received;
+}
+
+static bool inOrder(const std::vector<size_t> &indices) {
+    for (size_t i = 1; i < indices.size(); ++i) {
+        if (indices[i] <= indices[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testDropTail() {
+    int peer;
+    WriteQueueConfig config;
+    config.policy = WriteQueuePolicy::DropTail;
+    config.maxPackets = 8;
+    TUNInterface tun(stallingDevice(peer), config);
+    tun.start();
+
+    inject(tun, injected);
+    WriteQueueStats stats = tun.writeQueueStats();
+    HS_CHECK(stats.enqueued + stats.droppedTail == injected);
+    HS_CHECK(stats.droppedTail > 0);
+    HS_CHECK(stats.droppedBudget == 0 && stats.droppedHead == 0);
+    HS_CHECK(stats.queuedPackets <= config.maxPackets);
+
+    // What was taken is written once the peer reads, oldest first
+    const std::vector<size_t> received = drain(peer, stats.enqueued);
+    HS_CHECK(received.size() == stats.enqueued);
+    HS_CHECK(received[0] == 0);
+    HS_CHECK(inOrder(received));
+    tun.stop();
+}
+
+static void testByteBudget() {
+    int peer;
+    WriteQueueConfig config;
+    config.policy = WriteQueuePolicy::ByteBudget;
+    config.maxBytes = 10 * packetSize;
+    TUNInterface tun(stallingDevice(peer), config);
+    tun.start();
+
+    inject(tun, injected);
+    WriteQueueStats stats = tun.writeQueueStats();
+    HS_CHECK(stats.enqueued + stats.droppedBudget == injected);
+    HS_CHECK(stats.droppedBudget > 0);
+    HS_CHECK(stats.droppedTail == 0 && stats.droppedHead == 0);
+    HS_CHECK(stats.queuedBytes <= config.maxBytes);
+    HS_CHECK(stats.highWaterBytes <= config.maxBytes);
+
+    const std::vector<size_t> received = drain(peer, stats.enqueued);
+    HS_CHECK(received.size() == stats.enqueued);
+    HS_CHECK(inOrder(received));
+    tun.stop();
+}
+
+static void testDropHead() {
+    int peer;
+    WriteQueueConfig config;
+    config.policy = WriteQueuePolicy::DropHead;
+    config.maxPackets = 8;
+    TUNInterface tun(stallingDevice(peer), config);
+    tun.start();
+
+    // Every packet goes in, and the TUN thread sheds the oldest without the fd ever becoming writable.
+    // Bursts of maxPackets, since one of more than twice that overruns the ring before it catches up
+    for (size_t i = 0; i < injected; i += config.maxPackets) {
+        inject(tun, std::min(config.maxPackets, injected - i), i);
+        HS_CHECK(test::waitFor([&] { return tun.writeQueueStats().queuedPackets <= config.maxPackets; }));
+    }
+    WriteQueueStats stats = tun.writeQueueStats();
+    HS_CHECK(stats.enqueued == injected);
+    HS_CHECK(stats.droppedTail == 0 && stats.droppedBudget == 0);
+    HS_CHECK(stats.droppedHead >= injected - config.maxPackets - stats.written);
+
+    // What's left is the newest, written once the peer reads
+    const size_t left = injected - stats.droppedHead;
+    const std::vector<size_t> received = drain(peer, left);
+    HS_CHECK(received.size() == left);
+    HS_CHECK(received.back() == injected - 1);
+    HS_CHECK(inOrder(received));
+    tun.stop();
+}
+
+// Starts injecting on another thread, and returns once it is stuck with the queue full
+static std::thread blockedInjector(TUNInterface &tun, size_t maxPackets, std::atomic<bool> &done) {
+    std::thread injector([&] {
+        inject(tun, injected);
+        done = true;
+    });
+
+    HS_CHECK(test::waitFor([&] { return tun.writeQueueStats().queuedPackets >= maxPackets; }));
+    const uint64_t enqueued = tun.writeQueueStats().enqueued;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    HS_CHECK(!done);
+    HS_CHECK(tun.writeQueueStats().enqueued == enqueued);
+    return injector;
+}
+
+static void testBlockReleasedByDrain() {
+    int peer;
+    WriteQueueConfig config;
+    config.policy = WriteQueuePolicy::Block;
+    config.maxPackets = 8;
+    TUNInterface tun(stallingDevice(peer), config);
+    tun.start();
+
+    std::atomic<bool> done = false;
+    std::thread injector = blockedInjector(tun, config.maxPackets, done);
+
+    // Reading the peer lets the TUN thread write, which lets the injector go on, with nothing lost
+    const std::vector<size_t> received = drain(peer, injected);
+    injector.join();
+    HS_CHECK(received.size() == injected);
+    for (size_t i = 0; i < injected; ++i) {
+        HS_CHECK(received[i] == i);
+    }
+
+    const WriteQueueStats stats = tun.writeQueueStats();
+    HS_CHECK(stats.enqueued == injected);
+    HS_CHECK(stats.droppedTail == 0 && stats.droppedHead == 0 && stats.droppedBudget == 0);
+    HS_CHECK(stats.highWaterPackets <= config.maxPackets);
+    tun.stop();
+}
+
+static void testBlockReleasedByStop() {
+    int peer;
+    WriteQueueConfig config;
+    config.policy = WriteQueuePolicy::Block;
+    config.maxPackets = 8;
+    TUNInterface tun(stallingDevice(peer), config);
+    tun.start();
+
+    std::atomic<bool> done = false;
+    std::thread injector = blockedInjector(tun, config.maxPackets, done);
+
+    // With the fd still stalled, stopping is all that can let it go
+    tun.stop();
+    HS_CHECK(test::waitFor([&] { return done.load(); }));
+    injector.join();
+}
+
+int main() {
+    std::printf("DropTail\n");
+    testDropTail();
+    std::printf("ByteBudget\n");
+    testByteBudget();
+    std::printf("DropHead\n");
+    testDropHead();
+    std::printf("Block released by drain\n");
+    testBlockReleasedByDrain();
+    std::printf("Block released by stop\n");
+    testBlockReleasedByStop();
+    std::printf("ok\n");
+    return 0;
+}